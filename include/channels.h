@@ -52,6 +52,81 @@ class BanItem : public HostItem
 {
 };
 
+/** Ways of showing the members of a channel in a cached NAMES list.
+ * Modules select these from Module::OnNamesListCache.
+ */
+enum NamesListFormat
+{
+	/** Show every prefix a member has, not only the highest */
+	NAMES_ALLPREFIXES = 1,
+	/** Show nick!ident@host instead of only the nick */
+	NAMES_USERHOST = 2,
+	/** One past the highest combination of the above */
+	NAMES_FORMATS = 4
+};
+
+/** The body of a channel's 353 replies, rendered in advance so that a JOIN to a large
+ * channel does not have to walk every member. Each format is built the first time it
+ * is asked for and is then patched as members join, leave, or change prefix, nick or host.
+ */
+class CoreExport NamesCache
+{
+	/** Where a member is in the rendered lines */
+	struct Entry
+	{
+		/** Index of the line holding the member */
+		size_t line;
+		/** The member as rendered, including the trailing space */
+		std::string item;
+	};
+
+	/** The rendered lines for one format */
+	struct Format
+	{
+		/** Line bodies, each at most maxlen bytes long (some may be empty) */
+		std::vector<std::string> lines;
+		/** Position of each member */
+		std::map<User*, Entry> entries;
+		/** Total length of all rendered members */
+		size_t length;
+		/** Line length the lines were built for */
+		size_t maxlen;
+	};
+
+	/** The channel this cache belongs to */
+	Channel* const chan;
+
+	/** Built formats, indexed by NamesListFormat flags, or NULL */
+	Format* formats[NAMES_FORMATS];
+
+	std::string Render(Membership* memb, unsigned int format);
+	void Insert(Format* fmt, User* user, const std::string& item);
+	void Remove(Format* fmt, std::map<User*, Entry>::iterator entry);
+	void Build(Format* fmt, unsigned int format);
+
+	NamesCache(const NamesCache&);
+	void operator=(const NamesCache&);
+
+ public:
+	/** Create an empty cache
+	 * @param c The channel to cache NAMES for
+	 */
+	NamesCache(Channel* c);
+	~NamesCache();
+
+	/** Get the line bodies of the NAMES list in a format, building it if needed
+	 * @param format A combination of NamesListFormat flags
+	 * @return The line bodies; empty lines should be skipped
+	 */
+	const std::vector<std::string>& Get(unsigned int format);
+
+	/** Bring a user's entry in every built format up to date. Users who are quitting
+	 * or are no longer on the channel are removed.
+	 * @param user The user whose membership, prefixes, nick or host have changed
+	 */
+	void Update(User* user);
+};
+
 /** Holds all relevent information for a channel.
  * This class represents a channel, and contains its name, modes, topic, topic set time,
  * etc, and an instance of the BanList type.
@@ -101,6 +176,10 @@ class CoreExport Channel : public Extensible, public InviteBase
 	 */
 	UserMembList userlist;
 
+	/** Pre-rendered NAMES replies for members, see UserList
+	 */
+	NamesCache names;
+
 	/** Channel topic.
 	 * If this is an empty string, no channel topic is set.
 	 */
@@ -301,6 +380,12 @@ class CoreExport Channel : public Extensible, public InviteBase
 	/** Write a line of text that already includes the source */
 	void RawWriteAllExcept(User* user, bool serversource, char status, CUList &except_list, const std::string& text);
 
+	/** Write a message to the local users on the channel, each getting the variant chosen for them
+	 * @param msg The variants of the message
+	 * @param except_list A list of users NOT to send the message to
+	 */
+	void WriteVariants(MessageVariants& msg, const CUList& except_list);
+
 	/** Returns the maximum number of bans allowed to be set on this channel
 	 * @return The maximum number of bans allowed
 	 */
@@ -45,24 +45,124 @@ struct WhowasRequest : public Request
 /* Forward ref for timer */
 class WhoWasMaintainTimer;
 
-/* Forward ref for typedefs */
-class WhoWasGroup;
-
 /** Timer that is used to maintain the whowas list, called once an hour
  */
 extern WhoWasMaintainTimer* timer;
 
-/** A group of users related by nickname
+/** Strings which many whowas entries have in common, such as server names and
+ * hosts, each stored once and reference counted
  */
-typedef std::deque<WhoWasGroup*> whowas_set;
+class WhoWasStrings
+{
+	typedef nspace::hash_map<std::string, unsigned long, nspace::hash<std::string> > StringMap;
+
+	/** Each string and the number of entries using it
+	 */
+	StringMap strings;
+
+ public:
+	/** Bytes used by the stored strings, including an estimate of the hash overhead
+	 */
+	size_t memory;
+
+	WhoWasStrings() : memory(0) { }
+
+	/** Get the shared copy of a string, adding it if needed
+	 * @param str The string
+	 * @return A pointer which stays valid until the matching Release
+	 */
+	const std::string* Intern(const std::string& str);
 
-/** Sets of users in the whowas system
+	/** Drop a reference taken by Intern
+	 * @param str The pointer returned by Intern
+	 */
+	void Release(const std::string* str);
+
+	/** Get the number of distinct strings stored
+	 */
+	size_t size() const { return strings.size(); }
+};
+
+/** Used to hold WHOWAS information. Entries are allocated with Create, which places
+ * the ident and GECOS in the same allocation after the object.
  */
-typedef std::map<irc::string,whowas_set*> whowas_users;
+class WhoWasGroup
+{
+	WhoWasGroup() { }
+	~WhoWasGroup() { }
+
+ public:
+	/** The next newer entry for the same nick, or NULL
+	 */
+	WhoWasGroup* next;
+	/** Real host
+	 */
+	const std::string* host;
+	/** Displayed host
+	 */
+	const std::string* dhost;
+	/** Server name
+	 */
+	const std::string* server;
+	/** Signon time
+	 */
+	time_t signon;
+	/** Time the entry was added
+	 */
+	time_t added;
+	/** Size of the allocation holding this entry
+	 */
+	size_t bytes;
+
+	/** Ident
+	 */
+	const char* ident() const { return reinterpret_cast<const char*>(this + 1); }
+	/** Fullname (GECOS)
+	 */
+	const char* gecos() const { return ident() + strlen(ident()) + 1; }
+
+	/** Create an entry for a user
+	 * @param user The user who is quitting or changing nick
+	 * @param shared Where hosts and server names are stored
+	 */
+	static WhoWasGroup* Create(User* user, WhoWasStrings& shared);
 
-/** Sets of time and users in whowas list
+	/** Free an entry made by Create
+	 * @param shared The strings given to Create
+	 */
+	void Destroy(WhoWasStrings& shared);
+};
+
+/** The whowas entries for one nick, oldest first. Nicks are kept in a least
+ * recently used list, which decides which nick is dropped when the store is full.
+ */
+struct WhoWasNick
+{
+	/** The nick, as it was first added
+	 */
+	std::string nick;
+	/** Oldest entry
+	 */
+	WhoWasGroup* oldest;
+	/** Newest entry
+	 */
+	WhoWasGroup* newest;
+	/** Number of entries
+	 */
+	unsigned int count;
+	/** Neighbours in the LRU list, towards the least and most recently used ends
+	 */
+	WhoWasNick* older;
+	WhoWasNick* newer;
+};
+
+/** Sets of users in the whowas system, by nick
  */
-typedef std::deque<std::pair<time_t,irc::string> > whowas_users_fifo;
+#ifdef HASHMAP_DEPRECATED
+	typedef nspace::hash_map<std::string, WhoWasNick*, nspace::insensitive, irc::StrHashComp> whowas_users;
+#else
+	typedef nspace::hash_map<std::string, WhoWasNick*, nspace::hash<std::string>, irc::StrHashComp> whowas_users;
+#endif
 
 /** Handle /WHOWAS. These command handlers can be reloaded by the core,
  * and handle basic RFC1459 commands. Commands within modules work
@@ -72,13 +172,37 @@ typedef std::deque<std::pair<time_t,irc::string> > whowas_users_fifo;
 class CommandWhowas : public Command
 {
   private:
-	/** Whowas container, contains a map of vectors of users tracked by WHOWAS
+	/** Whowas container, contains the entries for each nick tracked by WHOWAS
 	 */
 	whowas_users whowas;
 
-	/** Whowas container, contains a map of time_t to users tracked by WHOWAS
+	/** Hosts and server names used by the entries
+	 */
+	WhoWasStrings shared;
+
+	/** Least and most recently used nicks
+	 */
+	WhoWasNick* lru;
+	WhoWasNick* mru;
+
+	/** Total number of entries
 	 */
-	whowas_users_fifo whowas_fifo;
+	size_t entries;
+
+	/** Bytes used by entries and nicks, not counting shared strings
+	 */
+	size_t memory;
+
+	/** Move a nick to the most recently used end of the LRU list */
+	void Touch(WhoWasNick* n);
+	/** Remove the oldest entry for a nick, and the nick if it has no entries left */
+	void PopOldest(WhoWasNick* n);
+	/** Remove a nick and all of its entries */
+	void Remove(WhoWasNick* n);
+	/** Drop least recently used nicks until the store is within its limits */
+	void Shrink();
+	/** Bytes counted for a nick, not including its entries */
+	static size_t NickBytes(const WhoWasNick* n);
 
   public:
 	CommandWhowas(Module* parent);
@@ -93,41 +217,11 @@ class CommandWhowas : public Command
 	std::string GetStats();
 	void PruneWhoWas(time_t t);
 	void MaintainWhoWas(time_t t);
+	/** Add the memory used by the entries to a report */
+	void GetMemory(MemoryReport& report);
 	~CommandWhowas();
 };
 
-/** Used to hold WHOWAS information
- */
-class WhoWasGroup
-{
- public:
-	/** Real host
-	 */
-	std::string host;
-	/** Displayed host
-	 */
-	std::string dhost;
-	/** Ident
-	 */
-	std::string ident;
-	/** Server name
-	 */
-	std::string server;
-	/** Fullname (GECOS)
-	 */
-	std::string gecos;
-	/** Signon time
-	 */
-	time_t signon;
-
-	/** Initialize this WhoWasFroup with a user
-	 */
-	WhoWasGroup(User* user);
-	/** Destructor
-	 */
-	~WhoWasGroup();
-};
-
 class WhoWasMaintainTimer : public Timer
 {
   public:
@@ -177,6 +177,70 @@ class CoreExport OperInfo : public refcountbase
 	}
 };
 
+/** Index of the connect classes by IP range, exact host and port, so that finding
+ * the classes a connecting user can be placed in does not test every <connect>
+ * block. Only masks containing wildcards are still matched one by one. Recent
+ * lookups are remembered; the index belongs to a ServerConfig, so a rehash
+ * starts with a new, empty one.
+ */
+class CoreExport ConnectClassIndex
+{
+	/** Positions in Classes, in order */
+	typedef std::vector<size_t> PosList;
+
+	/** Classes by CIDR range (including single addresses), with the mask lengths in use */
+	std::map<irc::sockets::cidr_mask, PosList> ranges;
+	std::set<int> lengths;
+	/** Classes by exact, lower case host or IP */
+	std::map<std::string, PosList> exact;
+	/** Classes with wildcard masks, matched the old way */
+	PosList wildcards;
+	/** Required port for each class, or 0 */
+	std::vector<int> ports;
+	/** Host mask of each class */
+	std::vector<std::string> hosts;
+	/** Lookups by "ip port host" */
+	std::map<std::string, PosList> memo;
+
+ public:
+	/** Rebuild the index, see ServerConfig::CrossCheckConnectBlocks */
+	void Build(const ClassVector& classes);
+
+	/** Get the positions in the class list of the non-named classes whose host and port
+	 * match the given connection, in configuration order
+	 * @param sa The client's address
+	 * @param ip The client's address as a string
+	 * @param port The server port the client connected to
+	 * @param host The client's hostname
+	 */
+	const std::vector<size_t>& Find(const irc::sockets::sockaddrs& sa, const std::string& ip, int port, const std::string& host);
+};
+
+/** Work done by a module on the configuration reader thread during a rehash,
+ * see Module::OnPrepareConfig
+ */
+class CoreExport ConfigPrepareJob : public classbase
+{
+ public:
+	/** The module which created this job */
+	Module* const creator;
+
+	ConfigPrepareJob(Module* Creator) : creator(Creator) { }
+	virtual ~ConfigPrepareJob() { }
+
+	/** Called on the configuration reader thread with the configuration being loaded.
+	 * This must only read from conf and write to members of the job: it is NOT safe
+	 * to use most of the codebase here, including logging and sending messages.
+	 * @param conf The new configuration
+	 */
+	virtual void Prepare(ServerConfig* conf) = 0;
+
+	/** Called on the main thread if the new configuration is valid, just before
+	 * OnRehash, to swap in whatever Prepare() built
+	 */
+	virtual void Commit() = 0;
+};
+
 /** This class holds the bulk of the runtime configuration for the ircd.
  * It allows for reading new config values, accessing configuration files,
  * and storage of the configuration data needed to run the ircd, such as
@@ -252,6 +316,11 @@ class CoreExport ServerConfig
 	 */
 	int WhoWasMaxKeep;
 
+	/** Max bytes of memory used by WhoWas. When reached, the least
+	 *  recently used nicks are dropped.
+	 */
+	int WhoWasMaxMemory;
+
 	/** Holds the server name of the local server
 	 * as defined by the administrator.
 	 */
@@ -401,6 +470,16 @@ class CoreExport ServerConfig
 	 */
 	unsigned int SoftLimit;
 
+	/** The most objects, such as quitting users, deleted in each
+	 * iteration of the main loop. The rest wait for later iterations.
+	 * 0 means no limit.
+	 */
+	unsigned int MaxCull;
+
+	/** Main loop iterations which take at least this many milliseconds are logged, 0 to disable
+	 */
+	unsigned int SlowLoop;
+
 	/** Maximum number of targets for a multi target command
 	 * such as PRIVMSG or KICK
 	 */
@@ -444,6 +523,10 @@ class CoreExport ServerConfig
 	 */
 	ClassVector Classes;
 
+	/** Index of Classes used when placing users in a class
+	 */
+	ConnectClassIndex ClassIndex;
+
 	/** The 005 tokens of this server (ISUPPORT)
 	 * populated/repopulated upon loading or unloading
 	 * modules.
@@ -539,6 +622,12 @@ class CoreExport ServerConfig
 	 */
 	void Send005(User* user);
 
+	/** Jobs to run on the configuration reader thread for modules, see Module::OnPrepareConfig
+	 */
+	std::vector<ConfigPrepareJob*> PrepareJobs;
+
+	~ServerConfig();
+
 	/** Read the entire configuration into memory
 	 * and initialize this class. All other methods
 	 * should be used only by the core.
@@ -591,12 +680,12 @@ class CoreExport ConfigReaderThread : public Thread
 {
 	ServerConfig* Config;
 	volatile bool done;
+	/** Time in milliseconds spent reading the configuration and running the module jobs */
+	unsigned long ReadTime, PrepareTime;
  public:
 	const std::string TheUserUID;
-	ConfigReaderThread(const std::string &useruid)
-		: Config(new ServerConfig), done(false), TheUserUID(useruid)
-	{
-	}
+	/** Collects the module jobs for the new configuration, see Module::OnPrepareConfig */
+	ConfigReaderThread(const std::string &useruid);
 
 	virtual ~ConfigReaderThread()
 	{
@@ -607,6 +696,8 @@ class CoreExport ConfigReaderThread : public Thread
 	/** Run in the main thread to apply the configuration */
 	void Finish();
 	bool IsDone() { return done; }
+	/** Returns true if module jobs have not been committed yet, during which no module may be unloaded */
+	bool IsPreparing() { return !Config->PrepareJobs.empty(); }
 };
 
 #endif
@@ -155,6 +155,26 @@ class CoreExport Command : public ServiceProvider
 	 */
 	int Penalty;
 
+	/** Counters kept for each place a command can come from
+	 */
+	struct Timings
+	{
+		/** Time taken by each run, including the OnPreCommand and OnPostCommand hooks for local users
+		 */
+		LatencyHistogram latency;
+		/** Heap allocations made while running
+		 */
+		unsigned long allocations;
+
+		Timings() : allocations(0) { }
+	};
+
+	/** Timings of the command when run by local users and when received from
+	 * other servers, or NULL until it is first run from there
+	 */
+	Timings* local_timings;
+	Timings* remote_timings;
+
 	/** Create a new command.
 	 * @param me The module which created this command.
 	 * @param cmd Command name. This must be UPPER CASE.
@@ -165,7 +185,7 @@ class CoreExport Command : public ServiceProvider
 	Command(Module* me, const std::string &cmd, int minpara = 0, int maxpara = 0) :
 		ServiceProvider(me, cmd, SERVICE_COMMAND), flags_needed(0), min_params(minpara), max_params(maxpara),
 		use_count(0), total_bytes(0), disabled(false), works_before_reg(false), allow_empty_last_param(true),
-		Penalty(1)
+		Penalty(1), local_timings(NULL), remote_timings(NULL)
 	{
 	}
 
@@ -227,6 +247,32 @@ class CoreExport Command : public ServiceProvider
 	virtual ~Command();
 };
 
+/** Times a command while it is in scope, adding the time and the heap allocations
+ * made to the command's local or remote timings. Nothing is added unless the command's
+ * handler was reached, so that runs which were refused do not count.
+ */
+class CoreExport CommandTimer
+{
+	Command* const cmd;
+	const bool remote;
+	const uint64_t start;
+	const unsigned long allocations;
+	bool ran;
+
+ public:
+	/** Start timing
+	 * @param Cmd The command
+	 * @param Remote True if the command came from another server
+	 */
+	CommandTimer(Command* Cmd, bool Remote)
+		: cmd(Cmd), remote(Remote), start(LoopTimings::Now()), allocations(HeapAllocations), ran(false) { }
+
+	/** Note that the command's handler is being called, so the run is counted */
+	void Ran() { ran = true; }
+
+	~CommandTimer();
+};
+
 class CoreExport SplitCommand : public Command
 {
  public:
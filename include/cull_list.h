@@ -33,15 +33,42 @@ class CoreExport CullList
 	std::vector<classbase*> list;
 	std::vector<LocalUser*> SQlist;
 
+	/** Every object in list, so that one added twice is only deleted once
+	 */
+	std::set<classbase*> queued;
+
+	/** Position in list of the first object which has not been culled yet
+	 */
+	size_t first;
+
  public:
+	/** Number of objects deleted so far
+	 */
+	unsigned long culled;
+
+	/** The most objects which have been waiting to be culled at once
+	 */
+	size_t peak;
+
+	CullList() : first(0), culled(0), peak(0) { }
+
 	/** Adds an item to the cull list
 	 */
-	void AddItem(classbase* item) { list.push_back(item); }
+	void AddItem(classbase* item);
 	void AddSQItem(LocalUser* item) { SQlist.push_back(item); }
 
 	/** Applies the cull list (deletes the contents)
 	 */
-	void Apply();
+	void Apply() { Apply(0); }
+
+	/** Cull and delete the oldest objects in the list, leaving the rest for a later call
+	 * @param limit The most objects to delete, or 0 to delete all of them
+	 */
+	void Apply(size_t limit);
+
+	/** Get the number of objects waiting to be culled
+	 */
+	size_t Pending() const { return list.size() - first; }
 };
 
 class CoreExport ActionList
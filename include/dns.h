@@ -43,6 +43,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "socket.h"
 #include "hashcomp.h"
 
+class MemoryReport;
+
 /**
  * Result status, used internally
  */
@@ -437,6 +439,15 @@ class CoreExport DNS : public EventHandler
 	 * items in the hash which are still valid.
 	 */
 	int PruneCache();
+
+	/** Time taken by the nameserver to answer each request, in microseconds
+	 */
+	LatencyHistogram latency;
+
+	/** Add the memory used by the cache to a report
+	 * @param report The report to add to
+	 */
+	void GetMemory(MemoryReport& report);
 };
 
 #endif
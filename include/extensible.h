@@ -39,8 +39,20 @@ enum SerializeFormat
 class CoreExport ExtensionItem : public ServiceProvider, public usecountbase
 {
  public:
+	/** Index of this item's value in the storage of every Extensible. Slots are
+	 * handed out when an item is created and reused once it is destroyed, so
+	 * they stay small and dense.
+	 */
+	const unsigned int slot;
+
 	ExtensionItem(const std::string& key, Module* owner);
 	virtual ~ExtensionItem();
+
+	/** Find the item using a slot
+	 * @return The item, or NULL if the slot is not in use
+	 */
+	static ExtensionItem* FromSlot(unsigned int slot);
+
 	/** Serialize this item into a string
 	 *
 	 * @param format The format to serialize to
@@ -56,19 +68,24 @@ class CoreExport ExtensionItem : public ServiceProvider, public usecountbase
 	virtual void unserialize(SerializeFormat format, Extensible* container, const std::string& value) = 0;
 	/** Free the item */
 	virtual void free(void* item) = 0;
+	/** Estimate the memory used by a value, for /STATS M
+	 * @param item The value
+	 * @return Bytes used, or 0 if the value is held in the pointer itself
+	 */
+	virtual size_t GetSize(void* item) const;
 
  protected:
-	/** Get the item from the internal map */
-	void* get_raw(const Extensible* container) const;
-	/** Set the item in the internal map; returns old value */
+	/** Get the item from the container's storage */
+	inline void* get_raw(const Extensible* container) const;
+	/** Set the item in the container's storage; returns old value */
 	void* set_raw(Extensible* container, void* value);
-	/** Remove the item from the internal map; returns old value */
+	/** Remove the item from the container's storage; returns old value */
 	void* unset_raw(Extensible* container);
 };
 
 /** class Extensible is the parent class of many classes such as User and Channel.
  * class Extensible implements a system which allows modules to 'extend' the class by attaching data within
- * a map associated with the object. In this way modules can store their own custom information within user
+ * a vector associated with the object, indexed by ExtensionItem::slot. In this way modules can store their own custom information within user
  * objects, channel objects and server objects, without breaking other modules (this is more sensible than using
  * a flags variable, and each module defining bits within the flag as 'theirs' as it is less prone to conflict and
  * supports arbitary data storage).
@@ -76,7 +93,10 @@ class CoreExport ExtensionItem : public ServiceProvider, public usecountbase
 class CoreExport Extensible : public classbase
 {
  public:
-	typedef std::map<reference<ExtensionItem>,void*> ExtensibleStore;
+	/** Values indexed by the slot of their ExtensionItem, NULL where unset. The
+	 * vector is only as long as the highest slot set on this object.
+	 */
+	typedef std::vector<void*> ExtensibleStore;
 
 	// Friend access for the protected getter/setter
 	friend class ExtensionItem;
@@ -87,7 +107,8 @@ class CoreExport Extensible : public classbase
 	ExtensibleStore extensions;
  public:
 	/**
-	 * Get the extension items for iteraton (i.e. for metadata sync during netburst)
+	 * Get the extension items for iteraton (i.e. for metadata sync during netburst).
+	 * Use ExtensionItem::FromSlot to find the item for each value which is set.
 	 */
 	inline const ExtensibleStore& GetExtList() const { return extensions; }
 
@@ -97,6 +118,11 @@ class CoreExport Extensible : public classbase
 	void doUnhookExtensions(const std::vector<reference<ExtensionItem> >& toRemove);
 };
 
+inline void* ExtensionItem::get_raw(const Extensible* container) const
+{
+	return slot < container->extensions.size() ? container->extensions[slot] : NULL;
+}
+
 class CoreExport ExtensionManager
 {
 	std::map<std::string, reference<ExtensionItem> > types;
@@ -157,6 +183,11 @@ class SimpleExtItem : public LocalExtItem
 	{
 		delete static_cast<T*>(item);
 	}
+
+	virtual size_t GetSize(void*) const
+	{
+		return sizeof(T);
+	}
 };
 
 class CoreExport LocalStringExt : public SimpleExtItem<std::string>
@@ -165,6 +196,7 @@ class CoreExport LocalStringExt : public SimpleExtItem<std::string>
 	LocalStringExt(const std::string& key, Module* owner);
 	virtual ~LocalStringExt();
 	std::string serialize(SerializeFormat format, const Extensible* container, void* item) const;
+	size_t GetSize(void* item) const;
 };
 
 class CoreExport LocalIntExt : public LocalExtItem
@@ -189,6 +221,7 @@ class CoreExport StringExtItem : public ExtensionItem
 	void set(Extensible* container, const std::string& value);
 	void unset(Extensible* container);
 	void free(void* item);
+	size_t GetSize(void* item) const;
 };
 
 #endif
@@ -99,6 +99,22 @@ template<typename T> const T& SearchAndReplace(T& text, const T& pattern, const
 namespace irc
 {
 
+	/** Hash a string as folded by national_case_insensitive_map, used by the nick
+	 * and channel hash maps. Equal strings under the case map hash equally.
+	 * @param str The string to hash
+	 * @param len Length of the string
+	 * @return The hash value
+	 */
+	CoreExport size_t CaseFoldHash(const char* str, size_t len);
+
+	/** Check if two strings of the same length are equal under national_case_insensitive_map
+	 * @param s1 First string
+	 * @param s2 Second string
+	 * @param len Length of both strings
+	 * @return True if the strings are equal
+	 */
+	CoreExport bool CaseFoldEqual(const char* s1, const char* s2, size_t len);
+
 	/** This class returns true if two strings match.
 	 * Case sensitivity is ignored, and the RFC 'character set'
 	 * is adhered to
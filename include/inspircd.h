@@ -77,6 +77,7 @@ CoreExport extern InspIRCd* ServerInstance;
 
 #include "caller.h"
 #include "cull_list.h"
+#include "latency.h"
 #include "extensible.h"
 #include "numerics.h"
 #include "uid.h"
@@ -87,6 +88,7 @@ CoreExport extern InspIRCd* ServerInstance;
 #include "logger.h"
 #include "usermanager.h"
 #include "socket.h"
+#include "wildcard.h"
 #include "ctables.h"
 #include "command_parse.h"
 #include "mode.h"
@@ -233,6 +235,12 @@ class serverstats
 	/** Total bytes of data received
 	 */
 	unsigned long statsRecv;
+	/** Bytes waiting in the send queues of local users
+	 */
+	unsigned long statsSendQ;
+	/** Number of local users disconnected for going over their hard sendq limit
+	 */
+	unsigned long statsSendQExceeded;
 #ifdef _WIN32
 	/** Cpu usage at last sample
 	*/
@@ -255,7 +263,8 @@ class serverstats
 	 */
 	serverstats()
 		: statsAccept(0), statsRefused(0), statsUnknown(0), statsCollisions(0), statsDns(0),
-		statsDnsGood(0), statsDnsBad(0), statsConnects(0), statsSent(0), statsRecv(0)
+		statsDnsGood(0), statsDnsBad(0), statsConnects(0), statsSent(0), statsRecv(0),
+		statsSendQ(0), statsSendQExceeded(0)
 	{
 	}
 };
@@ -329,6 +338,10 @@ class CoreExport InspIRCd
 	/** Actions that must happen outside of the current call stack */
 	ActionList AtomicActions;
 
+	/** Timings of the main loop
+	 */
+	LoopTimings LoopTimes;
+
 	/**** Functors ****/
 
 	IsNickHandler HandleIsNick;
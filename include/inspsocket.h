@@ -149,6 +149,8 @@ class CoreExport StreamSocket : public EventHandler
 	bool GetNextLine(std::string& line, char delim = '\n');
 	/** Useful for implementing sendq exceeded */
 	inline size_t getSendQSize() const { return sendq_len; }
+	/** Gets the number of bytes received but not yet processed */
+	inline size_t getRecvQSize() const { return recvq.length(); }
 
 	/**
 	 * Close the socket, remove from socket engine, etc
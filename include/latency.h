@@ -0,0 +1,223 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+class Module;
+
+/** Number of heap allocations made with operator new, by the core and modules.
+ * Each thread has its own count, so the main thread's count does not include the
+ * work of other threads. Only counted when built with --enable-allocation-counting,
+ * as that replaces the global operator new; otherwise, and always on Windows where
+ * each module has its own operator new, this stays at zero.
+ */
+#ifdef _WIN32
+CoreExport extern unsigned long HeapAllocations;
+#else
+CoreExport extern __thread unsigned long HeapAllocations;
+#endif
+
+/** A histogram of durations in microseconds. Each power of two is split into
+ * four buckets, so a value is counted within 25% of its real size, and the
+ * histogram has a fixed size no matter how widely the values vary.
+ */
+class CoreExport LatencyHistogram
+{
+ public:
+	/** Number of buckets. Values which do not fit in the last one (over two
+	 * hours) are counted in it anyway.
+	 */
+	static const unsigned int BUCKETS = 128;
+
+ private:
+	unsigned long buckets[BUCKETS];
+
+	/** Get the bucket a value is counted in */
+	static unsigned int Bucket(uint64_t usecs);
+
+ public:
+	/** Number of values added */
+	unsigned long count;
+	/** Sum of the values added */
+	uint64_t total;
+	/** Largest value added */
+	uint64_t max;
+
+	LatencyHistogram() { Clear(); }
+
+	/** Add a value
+	 * @param usecs The duration in microseconds
+	 */
+	void Add(uint64_t usecs);
+
+	/** Forget all of the values added */
+	void Clear();
+
+	/** Get the value which a given share of the values are no larger than
+	 * @param pct The share, from 0 to 100
+	 * @return The upper bound of the bucket the percentile falls in, or 0 if there are no values
+	 */
+	uint64_t Percentile(double pct) const;
+
+	/** Get the largest value which can be counted in a bucket */
+	static uint64_t BucketLimit(unsigned int bucket);
+
+	/** Get the number of values counted in a bucket */
+	unsigned long BucketCount(unsigned int bucket) const { return buckets[bucket]; }
+
+	/** Describe the histogram in one line, as the count, mean, median, 90th and 99th percentiles and maximum */
+	std::string Summary() const;
+};
+
+/** Times the phases of each main loop iteration and, when asked to, finds
+ * out what made an iteration slow.
+ */
+class CoreExport LoopTimings
+{
+ public:
+	/** The parts of an iteration which are timed */
+	enum Phase
+	{
+		/** Socket events, after the socket engine stops waiting */
+		PHASE_EVENTS,
+		/** Timers and the hourly garbage collection, run once a second */
+		PHASE_TIMERS,
+		/** Registration and ping checks of local users and the module background timer, run once a second */
+		PHASE_BACKGROUND,
+		/** Deleting culled objects and running deferred actions */
+		PHASE_CULL,
+		/** The whole iteration, not including the time spent waiting for events */
+		PHASE_ITERATION,
+		PHASE_COUNT
+	};
+
+	/** The sorts of work which are traced */
+	enum TraceKind
+	{
+		TRACE_SOCKET,
+		TRACE_COMMAND,
+		TRACE_HOOK,
+		TRACE_TIMER,
+		TRACE_COUNT
+	};
+
+	/** Names of the phases and kinds, for reports */
+	static const char* const PhaseNames[PHASE_COUNT];
+	static const char* const TraceNames[TRACE_COUNT];
+
+	/** True if sockets, commands, module hooks and timers are timed so that
+	 * slow iterations can be explained. Set from <performance:slowloop>.
+	 */
+	static bool tracing;
+
+	/** True if the time spent in each module's hooks is added up in
+	 * Module::hook_usecs. Set by modules which report it.
+	 */
+	static bool timehooks;
+
+	/** Histogram of each phase */
+	LatencyHistogram phases[PHASE_COUNT];
+
+	/** Number of iterations which took longer than <performance:slowloop> */
+	unsigned long slow;
+
+	/** Time the socket engine last stopped waiting, set by InspIRCd::UpdateTime */
+	uint64_t wake;
+
+	LoopTimings();
+
+	/** Record how long a phase took in this iteration */
+	void Record(Phase phase, uint64_t usecs)
+	{
+		phases[phase].Add(usecs);
+		current[phase] += usecs;
+	}
+
+	/** Note a traced piece of work, remembering it if it is the slowest of its kind in this iteration
+	 * @param kind What was being done
+	 * @param usecs How long it took
+	 * @param name The command, hook or class name
+	 * @param detail The user or module involved, if any
+	 */
+	void Note(TraceKind kind, uint64_t usecs, const char* name, const std::string& detail);
+
+	/** Finish an iteration, logging it if it was slower than the limit
+	 * @param limit The limit in milliseconds, or 0 for none
+	 */
+	void EndIteration(unsigned int limit);
+
+	/** Get the current time of a monotonic clock in microseconds */
+	static uint64_t Now();
+
+ private:
+	/** Time spent in each phase in this iteration */
+	uint64_t current[PHASE_COUNT];
+
+	/** The slowest traced work of each kind in this iteration */
+	struct Slowest
+	{
+		uint64_t usecs;
+		/** Copied, as the work may belong to a module which is unloaded before the iteration ends */
+		std::string name;
+		std::string detail;
+	} slowest[TRACE_COUNT];
+};
+
+/** Times a piece of work for LoopTimings::Note while it is in scope, if tracing is on
+ */
+class CoreExport TraceTimer
+{
+	const LoopTimings::TraceKind kind;
+	const char* const name;
+	const std::string* const detail;
+	Module* const module;
+	const uint64_t start;
+
+	/** Note the time taken */
+	void Finish();
+
+ public:
+	/** Start timing
+	 * @param Kind What is being done
+	 * @param Name The command, hook or class name, which must outlive the timer
+	 * @param Detail The user or module involved, which must outlive the timer
+	 */
+	TraceTimer(LoopTimings::TraceKind Kind, const char* Name, const std::string& Detail)
+		: kind(Kind), name(Name), detail(&Detail), module(NULL), start(LoopTimings::tracing ? LoopTimings::Now() : 0) { }
+
+	TraceTimer(LoopTimings::TraceKind Kind, const char* Name)
+		: kind(Kind), name(Name), detail(NULL), module(NULL), start(LoopTimings::tracing ? LoopTimings::Now() : 0) { }
+
+	/** Start timing a module hook, which is also added to the module's totals if LoopTimings::timehooks is set
+	 * @param Mod The module
+	 * @param Name The hook name, which must outlive the timer
+	 */
+	TraceTimer(Module* Mod, const char* Name)
+		: kind(LoopTimings::TRACE_HOOK), name(Name), detail(NULL), module(Mod),
+		start((LoopTimings::tracing || LoopTimings::timehooks) ? LoopTimings::Now() : 0) { }
+
+	~TraceTimer()
+	{
+		if (start)
+			Finish();
+	}
+};
+
+#endif
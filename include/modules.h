@@ -131,6 +131,7 @@ struct ModResult {
 		++safei; \
 		try \
 		{ \
+			TraceTimer _trace(*_i, #y + 2); /* skip I_, naming hooks as DO_EACH_HOOK does */ \
 			(*_i)->x ; \
 		} \
 		catch (CoreException& modexcept) \
@@ -156,7 +157,10 @@ do { \
 		iter_ ## n ++; \
 		try \
 		{ \
-			v = (mod_ ## n)->n args;
+			{ \
+				TraceTimer trace_ ## n(mod_ ## n, #n); \
+				v = (mod_ ## n)->n args; \
+			}
 
 #define WHILE_EACH_HOOK(n) \
 		} \
@@ -275,6 +279,41 @@ class CoreExport Event : public classbase
 	void Send();
 };
 
+/** The memory used by each part of the server, as shown by /STATS M and m_httpd_stats.
+ * The figures are estimates: they count the objects and the strings and containers
+ * they own, not the allocator's own overhead.
+ */
+class CoreExport MemoryReport
+{
+ public:
+	struct Entry
+	{
+		/** What the memory is used for */
+		std::string name;
+		/** Number of objects */
+		size_t count;
+		/** Bytes used by the objects */
+		size_t bytes;
+	};
+
+	std::vector<Entry> entries;
+
+	/** Add a figure to the report
+	 * @param name What the memory is used for
+	 * @param count Number of objects
+	 * @param bytes Bytes used by the objects
+	 */
+	void Add(const std::string& name, size_t count, size_t bytes);
+
+	/** Fill the report with the core's figures, then those of the modules
+	 */
+	void Collect();
+
+	/** Get the total bytes of every entry
+	 */
+	size_t Total() const;
+};
+
 class CoreExport DataProvider : public ServiceProvider
 {
  public:
@@ -339,6 +378,7 @@ enum Implementation
 	I_OnWhoisLine, I_OnBuildNeighborList, I_OnGarbageCollect, I_OnSetConnectClass,
 	I_OnText, I_OnPassCompare, I_OnRunTestSuite, I_OnNamesListItem, I_OnNumeric, I_OnHookIO,
 	I_OnPreRehash, I_OnModuleRehash, I_OnSendWhoLine, I_OnChangeIdent, I_OnSetUserIP,
+	I_OnPrepareConfig, I_OnBufferFlushed, I_OnNamesListCache, I_OnMemoryReport,
 	I_END
 };
 
@@ -362,6 +402,12 @@ class CoreExport Module : public classbase, public usecountbase
 	 */
 	bool dying;
 
+	/** Time spent in this module's hooks in microseconds, and the number of
+	 * hook calls timed. Only counted while LoopTimings::timehooks is set.
+	 */
+	uint64_t hook_usecs;
+	unsigned long hook_calls;
+
 	/** Default constructor.
 	 * Creates a module class. Don't do any type of hook registration or checks
 	 * for other modules here; do that in init().
@@ -477,6 +523,15 @@ class CoreExport Module : public classbase, public usecountbase
 	 */
 	virtual void OnModuleRehash(User* user, const std::string &parameter);
 
+	/** Called on rehash, before the configuration is read.
+	 * Modules which do expensive work in OnRehash (such as compiling patterns) can add a job
+	 * here. Its Prepare() method is run on the configuration reader thread once the new
+	 * configuration has been read, and its Commit() method on the main thread just before
+	 * OnRehash, if the new configuration is valid. The job is deleted by the core.
+	 * @param jobs The list of jobs to add to
+	 */
+	virtual void OnPrepareConfig(std::vector<ConfigPrepareJob*>& jobs);
+
 	/** Called on rehash.
 	 * This method is called after a rehash has completed. You should use it to reload any module
 	 * configuration from the main configuration file.
@@ -1273,6 +1328,12 @@ class CoreExport Module : public classbase, public usecountbase
 	 */
 	virtual ModResult OnSetConnectClass(LocalUser* user, ConnectClass* myclass);
 
+	/** Called when everything queued for a local user has been written to their socket.
+	 * Modules sending large replies in parts (such as LIST) can send the next part here.
+	 * @param user The user whose send queue is now empty
+	 */
+	virtual void OnBufferFlushed(LocalUser* user);
+
 	/** Add test suite hooks here. These are used for testing functionality of a module
 	 * via the --testsuite debugging parameter.
 	 */
@@ -1284,6 +1345,23 @@ class CoreExport Module : public classbase, public usecountbase
 	 */
 	virtual void OnNamesListItem(User* issuer, Membership* item, std::string &prefixes, std::string &nick);
 
+	/** Called before a NAMES list is sent to a member of the channel, to decide whether the
+	 * channel's pre-rendered list can be used. The cached list is only used if every module
+	 * implementing OnNamesListItem also implements this.
+	 * @param issuer The user who will receive the list
+	 * @param chan The channel
+	 * @param format Add NamesListFormat flags here to change how all members are shown
+	 * @return MOD_RES_DENY if some members may be hidden from the issuer or shown differently,
+	 * so that OnNamesListItem is called for each member instead; MOD_RES_PASSTHRU otherwise
+	 */
+	virtual ModResult OnNamesListCache(User* issuer, Channel* chan, unsigned int& format);
+
+	/** Called when the server's memory use is being reported, so a module can add
+	 * what it stores outside of users' and channels' extension items
+	 * @param report The report to add to
+	 */
+	virtual void OnMemoryReport(MemoryReport& report);
+
 	virtual ModResult OnNumeric(User* user, unsigned int numeric, const std::string &text);
 
 	/** Called whenever a result from /WHO is about to be returned
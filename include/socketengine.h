@@ -259,6 +259,11 @@ public:
 	unsigned long WriteEvents;
 	unsigned long ErrorEvents;
 
+	/** How long DispatchEvents may wait for an event, in milliseconds. The
+	 * main loop sets this to 0 while it still has objects waiting to be culled.
+	 */
+	int DispatchTimeout;
+
 	/** Constructor.
 	 * The constructor transparently initializes
 	 * the socket engine which the ircd is using.
@@ -27,6 +27,7 @@ class BanItem;
 class BufferedSocket;
 class Channel;
 class Command;
+class ConfigPrepareJob;
 class ConfigReader;
 class ConfigTag;
 class DNSHeader;
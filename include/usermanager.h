@@ -25,12 +25,100 @@
 /** A list of ip addresses cross referenced against clone counts */
 typedef std::map<irc::sockets::cidr_mask, unsigned int> clonemap;
 
+/** Secondary indexes over registered users by host, displayed host and server,
+ * so that WHO with a host mask does not have to test every user. The keys a user
+ * was indexed under are kept, so the index can be updated when they change.
+ */
+class CoreExport UserIndex
+{
+	typedef std::multimap<std::string, User*> KeyMap;
+
+	/** The keys a user is indexed under */
+	struct Entry
+	{
+		std::string host;
+		std::string dhost;
+		std::string server;
+	};
+
+	/** Users by lower case host and displayed host */
+	KeyMap hosts, dhosts;
+	/** Users by lower case host and displayed host, reversed so that suffixes are prefixes */
+	KeyMap rhosts, rdhosts;
+	/** Users by server name */
+	std::map<std::string, std::set<User*> > servers;
+	/** Indexed users */
+	std::map<User*, Entry> entries;
+
+	static void Erase(KeyMap& map, const std::string& key, User* user);
+	static void FindPrefix(const KeyMap& map, const std::string& prefix, std::vector<User*>& out);
+	static void FindExact(const KeyMap& map, const std::string& key, std::vector<User*>& out);
+
+ public:
+	/** Index a registered user */
+	void Add(User* user);
+
+	/** Remove a user, if indexed */
+	void Remove(User* user);
+
+	/** Reindex a user if their host, displayed host or server changed */
+	void Update(User* user);
+
+	/** Find the users whose nick, displayed host, host (if realhost) or server (if
+	 * matchservers) may match a WHO mask.
+	 * @param mask The mask to search for
+	 * @param realhost True to also search real hosts
+	 * @param matchservers True to also search server names
+	 * @param out The candidates, which must still be matched against the mask
+	 * @return False if the mask cannot be narrowed down by the index, in which case
+	 * every user has to be checked
+	 */
+	bool Search(const std::string& mask, bool realhost, bool matchservers, std::vector<User*>& out) const;
+};
+
+/** Assigns each client capability a bit in LocalUser::caps, so that checking
+ * whether a user has a capability is a single AND
+ */
+class CoreExport CapabilityBits
+{
+	/** Bits which are in use */
+	CapMask used;
+
+	/** The bit of each registered capability, by name */
+	std::map<std::string, CapMask> names;
+
+ public:
+	CapabilityBits() : used(0) { }
+
+	/** Take a free bit for a capability
+	 * @param name The capability, used in the error if none are free
+	 * @return The bit
+	 * @throws ModuleException if every bit is in use
+	 */
+	CapMask Register(const std::string& name);
+
+	/** Give a bit back, removing it from every local user so it can be reused
+	 * @param bit A bit returned by Register
+	 */
+	void Unregister(CapMask bit);
+
+	/** Find the bit of a capability provided by a module
+	 * @param name The capability
+	 * @return The bit, or 0 if no module provides the capability
+	 */
+	CapMask Find(const std::string& name) const;
+};
+
 class CoreExport UserManager
 {
  private:
 	/** Map of local ip addresses for clone counting
 	 */
 	clonemap local_clones;
+
+	/** Number of netsplit batches opened, used to give each one a unique reference
+	 */
+	unsigned long netsplit_batches;
  public:
 	UserManager();
 
@@ -62,6 +150,14 @@ class CoreExport UserManager
 	 */
 	std::list<User*> all_opers;
 
+	/** Index of registered users by host and server, used by WHO
+	 */
+	UserIndex index;
+
+	/** Bits assigned to client capabilities
+	 */
+	CapabilityBits Caps;
+
 	/** Number of unregistered users online right now.
 	 * (Unregistered means before USER/NICK/dns)
 	 */
@@ -95,6 +191,17 @@ class CoreExport UserManager
 	 */
 	void QuitUser(User *user, const std::string &quitreason, const char* operreason = "");
 
+	/** Disconnect several users at once, such as everyone behind a server which has split.
+	 * Module hooks run for all of them before any QUIT is sent, and local users who share
+	 * channels with several of them see each QUIT once.
+	 * @param users The users to remove
+	 * @param quitreason The quit reason to show to normal users
+	 * @param operreason The quit reason to show to opers
+	 * @param netsplit If not empty, the two server names of a netsplit. Users with the
+	 * batch capability then get the QUITs inside an IRCv3 netsplit batch.
+	 */
+	void QuitUsers(const std::vector<User*>& users, const std::string &quitreason, const char* operreason = "", const std::string& netsplit = "");
+
 	/** Add a user to the local clone map
 	 * @param user The user to add
 	 */
@@ -146,6 +146,12 @@ struct CoreExport ConnectClass : public refcountbase
 	 */
 	unsigned long limit;
 
+	/** Bytes received from and sent to users in this class. These are kept
+	 * when the class is updated by a rehash.
+	 */
+	unsigned long bytes_in;
+	unsigned long bytes_out;
+
 	/** Create a new connect class with no settings.
 	 */
 	ConnectClass(ConfigTag* tag, char type, const std::string& mask);
@@ -222,6 +228,28 @@ struct CoreExport ConnectClass : public refcountbase
 	}
 };
 
+/** A message sent in one of several variants, such as with and without a capability
+ * or for opers and non-opers. Each variant is rendered once by the caller, and the
+ * fan-out functions send every recipient the one chosen by Select().
+ */
+class CoreExport MessageVariants
+{
+ public:
+	/** The variants, complete lines without CR LF */
+	std::vector<std::string> lines;
+
+	virtual ~MessageVariants() { }
+
+	/** Choose the variant a user is sent
+	 * @param user A local user who would receive the message
+	 * @return An index into lines, or -1 to send the user nothing
+	 */
+	virtual int Select(LocalUser* user) = 0;
+
+	/** Send a user their variant, if any */
+	void SendTo(LocalUser* user);
+};
+
 /** Holds all information about a user
  * This class stores all information about a user connected to the irc server. Everything about a
  * connection is stored here primarily, from the user's socket ID (file descriptor) through to the
@@ -599,6 +627,13 @@ class CoreExport User : public Extensible
 	 */
 	void WriteCommonRaw(const std::string &line, bool include_self = true);
 
+	/** Write a message to all users that can see this user, each getting the variant chosen for them.
+	 * This is where neighbours are worked out and each user is sent at most one line.
+	 * @param msg The variants of the message
+	 * @param include_self Should the message be sent back to the author?
+	 */
+	void WriteCommonVariants(MessageVariants& msg, bool include_self);
+
 	/** Write to all users that can see this user (including this user in the list), appending CR/LF
 	 * @param text The format string for text to send to the users
 	 * @param ... POD-type format arguments
@@ -723,11 +758,21 @@ class CoreExport User : public Extensible
 
 class CoreExport UserIOHandler : public StreamSocket
 {
+	/** The size of the sendq last added to serverstats::statsSendQ
+	 */
+	size_t counted_sendq;
+
+	/** Bring serverstats::statsSendQ up to date with the size of the sendq
+	 */
+	void CountSendQ();
+
  public:
 	LocalUser* const user;
-	UserIOHandler(LocalUser* me) : user(me) {}
+	UserIOHandler(LocalUser* me) : counted_sendq(0), user(me) {}
 	void OnDataReady();
 	void OnError(BufferedSocketError error);
+	void DoWrite();
+	CullResult cull();
 
 	/** Adds to the user's write buffer.
 	 * You may add any amount of text up to this users sendq value, if you exceed the
@@ -737,7 +782,13 @@ class CoreExport UserIOHandler : public StreamSocket
 	void AddWriteBuf(const std::string &data);
 };
 
-typedef unsigned int already_sent_t;
+/** Marks which local users a message has been sent to. Each fan-out takes a new
+ * value, so this is wide enough that it never wraps round to one still in use.
+ */
+typedef uint64_t already_sent_t;
+
+/** A set of client capabilities, one bit each as assigned by CapabilityBits */
+typedef uint64_t CapMask;
 
 class CoreExport LocalUser : public User, public InviteBase
 {
@@ -747,7 +798,7 @@ class CoreExport LocalUser : public User, public InviteBase
 
 	UserIOHandler eh;
 
-	/** Position in UserManager::local_users
+	/** Position in UserManager::local_users, or its end once the user has quit
 	 */
 	LocalUserList::iterator localuseriter;
 
@@ -767,6 +818,10 @@ class CoreExport LocalUser : public User, public InviteBase
 	 */
 	unsigned int cmds_out;
 
+	/** Client capabilities this user has enabled
+	 */
+	CapMask caps;
+
 	/** Password specified by the user when they registered (if any).
 	 * This is stored even if the \<connect> block doesnt need a password, so that
 	 * modules may check it.
@@ -833,6 +888,13 @@ class CoreExport LocalUser : public User, public InviteBase
 	void Write(const std::string& text);
 	void Write(const char*, ...) CUSTOM_PRINTF(2, 3);
 
+	/** Queue several complete lines to this user as one buffer, so they go out
+	 * in a single write rather than one buffer per line.
+	 * @param block The lines, each already terminated by CR LF and no longer than MAXBUF
+	 * @param count The number of lines in the block, for statistics
+	 */
+	void WriteBlock(const std::string& block, unsigned int count);
+
 	/** Returns the list of channels this user has been invited to but has not yet joined.
 	 * @return A list of channels the user is invited to
 	 */
@@ -0,0 +1,109 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef WILDCARD_H
+#define WILDCARD_H
+
+namespace irc
+{
+	/** A glob pattern parsed once, for masks which are matched many times such as
+	 * xlines. Matching gives the same result as InspIRCd::Match and InspIRCd::MatchCIDR
+	 * on the original mask, but the text between '*'s is folded in advance and searched
+	 * for directly, and any CIDR part is only parsed once.
+	 */
+	class CoreExport wildcard_mask
+	{
+		/** A run of literal characters and '?'s between two '*'s */
+		struct segment
+		{
+			/** The original text, '?' marks any character */
+			std::string raw;
+			/** The text folded through the case map */
+			std::string folded;
+			/** Offset of the first character which is not '?', or npos */
+			std::string::size_type anchor;
+			/** Number of characters folding to the anchor (0 if more than two) */
+			unsigned int anchors;
+			/** The characters folding to the anchor */
+			unsigned char anchorchars[2];
+		};
+
+		/** The original mask */
+		std::string mask;
+		/** Case map given when compiling, NULL for national_case_insensitive_map */
+		const unsigned char* map;
+		/** The case map the segments were folded with */
+		const unsigned char* foldmap;
+		/** True if the mask contains at least one '*' */
+		bool stars;
+		/** Text before the first '*', or the whole mask if there are none */
+		segment prefix;
+		/** Text after the last '*' */
+		segment suffix;
+		/** Text between the other '*'s, in order */
+		std::vector<segment> middle;
+
+		/** True if the mask (after any user@) contains '/' */
+		bool hascidr;
+		/** True if the range was parsed in advance */
+		bool cidrparsed;
+		/** Position of the last '@' in the mask, or npos */
+		std::string::size_type at;
+		/** The parsed range */
+		irc::sockets::cidr_mask range;
+
+		void CompileSegment(segment& seg, const std::string& text);
+		bool MatchSegment(const segment& seg, const char* str) const;
+		const char* FindSegment(const segment& seg, const char* str, const char* end) const;
+		bool MatchRange(const std::string& address) const;
+
+	 public:
+		/** Create an empty mask, which only matches an empty string */
+		wildcard_mask();
+
+		/** Compile a mask
+		 * @param pattern The glob pattern, optionally user@ followed by a CIDR range
+		 * @param casemap The character map to use when matching, or NULL to use
+		 * national_case_insensitive_map as it is when matching
+		 */
+		wildcard_mask(const std::string& pattern, const unsigned char* casemap = NULL);
+
+		/** Replace the mask
+		 * @param pattern The glob pattern
+		 * @param casemap The character map, as in the constructor
+		 */
+		void compile(const std::string& pattern, const unsigned char* casemap = NULL);
+
+		/** Get the original mask */
+		const std::string& str() const { return mask; }
+
+		/** Match a string against the mask, as InspIRCd::Match does
+		 * @param text The string to match
+		 * @return True if the string matches
+		 */
+		bool Match(const std::string& text) const;
+
+		/** Match a string against the mask as a CIDR range, then as a glob, as
+		 * InspIRCd::MatchCIDR does
+		 * @param text The string to match
+		 * @return True if the string matches
+		 */
+		bool MatchCIDR(const std::string& text) const;
+	};
+}
+
+#endif
@@ -51,7 +51,7 @@ class CoreExport XLine : public classbase
 	 * @param t The line type, should be set by the derived class constructor
 	 */
 	XLine(time_t s_time, long d, std::string src, std::string re, const std::string &t)
-		: set_time(s_time), duration(d), source(src), reason(re), type(t)
+		: set_time(s_time), duration(d), source(src), reason(re), hits(0), type(t)
 	{
 		expiry = set_time + duration;
 	}
@@ -136,6 +136,10 @@ class CoreExport XLine : public classbase
 	 */
 	time_t expiry;
 
+	/** Number of times the line has matched a user or mask
+	 */
+	unsigned long hits;
+
 	/** "Q", "K", etc. Set only by derived classes constructor to the
 	 * type of line this is.
 	 */
@@ -159,10 +163,12 @@ class CoreExport KLine : public XLine
 	 * @param host Host to match
 	 */
 	KLine(time_t s_time, long d, std::string src, std::string re, std::string ident, std::string host)
-		: XLine(s_time, d, src, re, "K"), identmask(ident), hostmask(host)
+		: XLine(s_time, d, src, re, "K"), identmask(ident), hostmask(host),
+		identpattern(ident, ascii_case_insensitive_map), hostpattern(host, ascii_case_insensitive_map)
 	{
 		matchtext = this->identmask;
 		matchtext.append("@").append(this->hostmask);
+		textpattern.compile(matchtext);
 	}
 
 	/** Destructor
@@ -191,6 +197,10 @@ class CoreExport KLine : public XLine
 	std::string hostmask;
 
 	std::string matchtext;
+
+	/** identmask, hostmask and matchtext compiled for matching
+	 */
+	irc::wildcard_mask identpattern, hostpattern, textpattern;
 };
 
 /** GLine class
@@ -207,10 +217,12 @@ class CoreExport GLine : public XLine
 	 * @param host Host to match
 	 */
 	GLine(time_t s_time, long d, std::string src, std::string re, std::string ident, std::string host)
-		: XLine(s_time, d, src, re, "G"), identmask(ident), hostmask(host)
+		: XLine(s_time, d, src, re, "G"), identmask(ident), hostmask(host),
+		identpattern(ident, ascii_case_insensitive_map), hostpattern(host, ascii_case_insensitive_map)
 	{
 		matchtext = this->identmask;
 		matchtext.append("@").append(this->hostmask);
+		textpattern.compile(matchtext);
 	}
 
 	/** Destructor
@@ -237,6 +249,10 @@ class CoreExport GLine : public XLine
 	std::string hostmask;
 
 	std::string matchtext;
+
+	/** identmask, hostmask and matchtext compiled for matching
+	 */
+	irc::wildcard_mask identpattern, hostpattern, textpattern;
 };
 
 /** ELine class
@@ -253,10 +269,12 @@ class CoreExport ELine : public XLine
 	 * @param host Host to match
 	 */
 	ELine(time_t s_time, long d, std::string src, std::string re, std::string ident, std::string host)
-		: XLine(s_time, d, src, re, "E"), identmask(ident), hostmask(host)
+		: XLine(s_time, d, src, re, "E"), identmask(ident), hostmask(host),
+		identpattern(ident, ascii_case_insensitive_map), hostpattern(host, ascii_case_insensitive_map)
 	{
 		matchtext = this->identmask;
 		matchtext.append("@").append(this->hostmask);
+		textpattern.compile(matchtext);
 	}
 
 	~ELine()
@@ -283,6 +301,10 @@ class CoreExport ELine : public XLine
 	std::string hostmask;
 
 	std::string matchtext;
+
+	/** identmask, hostmask and matchtext compiled for matching
+	 */
+	irc::wildcard_mask identpattern, hostpattern, textpattern;
 };
 
 /** ZLine class
@@ -298,7 +320,7 @@ class CoreExport ZLine : public XLine
 	 * @param ip IP to match
 	 */
 	ZLine(time_t s_time, long d, std::string src, std::string re, std::string ip)
-		: XLine(s_time, d, src, re, "Z"), ipaddr(ip)
+		: XLine(s_time, d, src, re, "Z"), ipaddr(ip), ippattern(ip)
 	{
 	}
 
@@ -321,6 +343,10 @@ class CoreExport ZLine : public XLine
 	/** IP mask (no ident part)
 	 */
 	std::string ipaddr;
+
+	/** ipaddr compiled for matching
+	 */
+	irc::wildcard_mask ippattern;
 };
 
 /** QLine class
@@ -336,7 +362,7 @@ class CoreExport QLine : public XLine
 	 * @param nickname Nickname to match
 	 */
 	QLine(time_t s_time, long d, std::string src, std::string re, std::string nickname)
-		: XLine(s_time, d, src, re, "Q"), nick(nickname)
+		: XLine(s_time, d, src, re, "Q"), nick(nickname), nickpattern(nickname)
 	{
 	}
 
@@ -358,6 +384,10 @@ class CoreExport QLine : public XLine
 	/** Nickname mask
 	 */
 	std::string nick;
+
+	/** nick compiled for matching
+	 */
+	irc::wildcard_mask nickpattern;
 };
 
 /** XLineFactory is used to generate an XLine pointer, given just the
@@ -424,8 +454,11 @@ class CoreExport XLineManager
 	 */
 	XLineContainer lookup_lines;
 
- public:
+	/** Matches counted by lines of each type which have since been removed
+	 */
+	std::map<std::string, unsigned long> removed_hits;
 
+ public:
 	/** Constructor
 	 */
 	XLineManager();
@@ -460,6 +493,13 @@ class CoreExport XLineManager
 	 */
 	std::vector<std::string> GetAllTypes();
 
+	/** Get the number of times lines of a type have matched a user or mask,
+	 * including lines which have been removed
+	 * @param type The type of line
+	 * @return The number of matches
+	 */
+	unsigned long GetHits(const std::string& type);
+
 	/** Add a new XLine
 	 * @param line The line to be added
 	 * @param user The user adding the line or NULL for the local server
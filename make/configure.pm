@@ -277,6 +277,10 @@ InspIRCd 1.0.x, are also allowed.
   --disable-kqueue             Do not enable kqueue(), fall back
                                to select() [not set]
   --disable-ipv6               Do not build IPv6 native InspIRCd [not set]
+  --enable-allocation-counting Count the heap allocations made by each
+                               command, shown in /STATS x; this replaces
+                               operator new and slows every allocation
+                               [not set]
   --with-cc=[filename]         Use an alternative compiler to
                                build InspIRCd [g++]
   --with-maxbuf=[n]            Change the per message buffer size [512]
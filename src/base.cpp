@@ -89,46 +89,74 @@ ServiceProvider::~ServiceProvider()
 {
 }
 
-ExtensionItem::ExtensionItem(const std::string& Key, Module* mod) : ServiceProvider(mod, Key, SERVICE_METADATA)
+/** The item using each slot, or NULL for a free slot. This is not part of the
+ * ExtensionManager, as items may be created before the server instance.
+ */
+static std::vector<ExtensionItem*>& ExtensionSlots()
+{
+	static std::vector<ExtensionItem*> slots;
+	return slots;
+}
+
+static unsigned int AllocateSlot(ExtensionItem* item)
+{
+	std::vector<ExtensionItem*>& slots = ExtensionSlots();
+	for (unsigned int i = 0; i < slots.size(); i++)
+	{
+		if (!slots[i])
+		{
+			slots[i] = item;
+			return i;
+		}
+	}
+	slots.push_back(item);
+	return slots.size() - 1;
+}
+
+ExtensionItem::ExtensionItem(const std::string& Key, Module* mod) : ServiceProvider(mod, Key, SERVICE_METADATA),
+	slot(AllocateSlot(this))
 {
 }
 
 ExtensionItem::~ExtensionItem()
 {
+	ExtensionSlots()[slot] = NULL;
 }
 
-void* ExtensionItem::get_raw(const Extensible* container) const
+ExtensionItem* ExtensionItem::FromSlot(unsigned int Slot)
 {
-	Extensible::ExtensibleStore::const_iterator i =
-		container->extensions.find(const_cast<ExtensionItem*>(this));
-	if (i == container->extensions.end())
-		return NULL;
-	return i->second;
+	std::vector<ExtensionItem*>& slots = ExtensionSlots();
+	return Slot < slots.size() ? slots[Slot] : NULL;
+}
+
+size_t ExtensionItem::GetSize(void*) const
+{
+	return 0;
 }
 
 void* ExtensionItem::set_raw(Extensible* container, void* value)
 {
-	std::pair<Extensible::ExtensibleStore::iterator,bool> rv =
-		container->extensions.insert(std::make_pair(this, value));
-	if (rv.second)
-	{
-		return NULL;
-	}
-	else
-	{
-		void* old = rv.first->second;
-		rv.first->second = value;
-		return old;
-	}
+	if (!value)
+		return unset_raw(container);
+
+	Extensible::ExtensibleStore& store = container->extensions;
+	if (slot >= store.size())
+		store.resize(slot + 1);
+	void* old = store[slot];
+	store[slot] = value;
+	return old;
 }
 
 void* ExtensionItem::unset_raw(Extensible* container)
 {
-	Extensible::ExtensibleStore::iterator i = container->extensions.find(this);
-	if (i == container->extensions.end())
+	Extensible::ExtensibleStore& store = container->extensions;
+	if (slot >= store.size())
 		return NULL;
-	void* rv = i->second;
-	container->extensions.erase(i);
+	void* rv = store[slot];
+	store[slot] = NULL;
+	// Keep the vector no longer than the highest slot in use
+	while (!store.empty() && !store.back())
+		store.pop_back();
 	return rv;
 }
 
@@ -165,33 +193,27 @@ void Extensible::doUnhookExtensions(const std::vector<reference<ExtensionItem> >
 	for(std::vector<reference<ExtensionItem> >::const_iterator i = toRemove.begin(); i != toRemove.end(); ++i)
 	{
 		ExtensionItem* item = *i;
-		ExtensibleStore::iterator e = extensions.find(item);
-		if (e != extensions.end())
+		if (item->slot < extensions.size() && extensions[item->slot])
 		{
-			item->free(e->second);
-			extensions.erase(e);
+			item->free(extensions[item->slot]);
+			extensions[item->slot] = NULL;
 		}
 	}
 }
 
-static struct DummyExtensionItem : LocalExtItem
-{
-	DummyExtensionItem() : LocalExtItem("", NULL) {}
-	void free(void*) {}
-} dummy;
-
 Extensible::Extensible()
 {
-	extensions[&dummy] = NULL;
 }
 
 CullResult Extensible::cull()
 {
-	for(ExtensibleStore::iterator i = extensions.begin(); i != extensions.end(); ++i)
+	for (unsigned int slot = 0; slot < extensions.size(); slot++)
 	{
-		i->first->free(i->second);
+		ExtensionItem* item = ExtensionItem::FromSlot(slot);
+		if (item && extensions[slot])
+			item->free(extensions[slot]);
 	}
-	extensions.clear();
+	ExtensibleStore().swap(extensions);
 	return classbase::cull();
 }
 
@@ -233,6 +255,11 @@ std::string LocalStringExt::serialize(SerializeFormat format, const Extensible*
 	return "";
 }
 
+size_t LocalStringExt::GetSize(void* item) const
+{
+	return sizeof(std::string) + static_cast<std::string*>(item)->length();
+}
+
 LocalIntExt::LocalIntExt(const std::string& Key, Module* mod) : LocalExtItem(Key, mod)
 {
 }
@@ -308,6 +335,11 @@ void StringExtItem::free(void* item)
 	delete static_cast<std::string*>(item);
 }
 
+size_t StringExtItem::GetSize(void* item) const
+{
+	return sizeof(std::string) + static_cast<std::string*>(item)->length();
+}
+
 ModuleException::ModuleException(const std::string &message, Module* who)
 	: CoreException(message, who ? who->ModuleSourceFile : "A Module")
 {
@@ -30,6 +30,7 @@
 #include "mode.h"
 
 Channel::Channel(const std::string &cname, time_t ts)
+	: names(this)
 {
 	if (!ServerInstance->chanlist->insert(std::make_pair(cname, this)).second)
 		throw CoreException("Cannot create duplicate channel " + cname);
@@ -143,6 +144,7 @@ Membership* Channel::AddUser(User* user)
 {
 	Membership* memb = new Membership(user, this);
 	userlist[user] = memb;
+	names.Update(user);
 	return memb;
 }
 
@@ -155,6 +157,7 @@ void Channel::DelUser(User* user)
 		a->second->cull();
 		delete a->second;
 		userlist.erase(a);
+		names.Update(user);
 	}
 
 	if (userlist.empty())
@@ -699,6 +702,16 @@ void Channel::RawWriteAllExcept(User* user, bool serversource, char status, CULi
 	}
 }
 
+void Channel::WriteVariants(MessageVariants& msg, const CUList& except_list)
+{
+	for (UserMembIter i = userlist.begin(); i != userlist.end(); i++)
+	{
+		LocalUser* u = IS_LOCAL(i->first);
+		if (u && (except_list.find(u) == except_list.end()))
+			msg.SendTo(u);
+	}
+}
+
 void Channel::WriteAllExceptSender(User* user, bool serversource, char status, const std::string& text)
 {
 	CUList except_list;
@@ -761,6 +774,27 @@ char* Channel::ChanModes(bool showkey)
 	return scratch;
 }
 
+/** Check whether a member may be sent the cached NAMES list, and in which format.
+ * Modules which change NAMES items but do not say how the cache should be used
+ * see every list built the old way.
+ */
+static bool CanCacheNames(User* user, Channel* chan, unsigned int& format)
+{
+	ModResult res;
+	FIRST_MOD_RESULT(OnNamesListCache, res, (user, chan, format));
+	if (res == MOD_RES_DENY)
+		return false;
+
+	const IntModuleList& items = ServerInstance->Modules->EventHandlers[I_OnNamesListItem];
+	const IntModuleList& cachers = ServerInstance->Modules->EventHandlers[I_OnNamesListCache];
+	for (IntModuleList::const_iterator i = items.begin(); i != items.end(); ++i)
+	{
+		if (std::find(cachers.begin(), cachers.end(), *i) == cachers.end())
+			return false;
+	}
+	return (format < NAMES_FORMATS);
+}
+
 /* compile a userlist of a channel into a string, each nick seperated by
  * spaces and op, voice etc status shown as @ and +, and send it to 'user'
  */
@@ -788,6 +822,19 @@ void Channel::UserList(User *user)
 	 */
 	bool has_user = this->HasUser(user);
 
+	unsigned int format = 0;
+	if (has_user && CanCacheNames(user, this, format))
+	{
+		const std::vector<std::string>& lines = names.Get(format);
+		for (std::vector<std::string>::const_iterator i = lines.begin(); i != lines.end(); ++i)
+		{
+			if (!i->empty())
+				user->WriteNumeric(RPL_NAMREPLY, std::string(list, dlen) + *i);
+		}
+		user->WriteNumeric(RPL_ENDOFNAMES, "%s %s :End of /NAMES list.", user->nick.c_str(), this->name.c_str());
+		return;
+	}
+
 	for (UserMembIter i = userlist.begin(); i != userlist.end(); i++)
 	{
 		if (i->first->quitting)
@@ -841,6 +888,122 @@ void Channel::UserList(User *user)
 	user->WriteNumeric(RPL_ENDOFNAMES, "%s %s :End of /NAMES list.", user->nick.c_str(), this->name.c_str());
 }
 
+NamesCache::NamesCache(Channel* c) : chan(c)
+{
+	for (unsigned int i = 0; i < NAMES_FORMATS; i++)
+		formats[i] = NULL;
+}
+
+NamesCache::~NamesCache()
+{
+	for (unsigned int i = 0; i < NAMES_FORMATS; i++)
+		delete formats[i];
+}
+
+std::string NamesCache::Render(Membership* memb, unsigned int format)
+{
+	std::string item = (format & NAMES_ALLPREFIXES) ? chan->GetAllPrefixChars(memb->user) : chan->GetPrefixChar(memb->user);
+	item.append((format & NAMES_USERHOST) ? memb->user->GetFullHost() : memb->user->nick);
+	item.push_back(' ');
+	return item;
+}
+
+void NamesCache::Insert(Format* fmt, User* user, const std::string& item)
+{
+	if (fmt->lines.empty() || fmt->lines.back().length() + item.length() > fmt->maxlen)
+		fmt->lines.push_back(std::string());
+	fmt->lines.back().append(item);
+	fmt->length += item.length();
+
+	Entry& entry = fmt->entries[user];
+	entry.line = fmt->lines.size() - 1;
+	entry.item = item;
+}
+
+void NamesCache::Remove(Format* fmt, std::map<User*, Entry>::iterator entry)
+{
+	std::string& line = fmt->lines[entry->second.line];
+	const std::string& item = entry->second.item;
+
+	/* Items are separated by spaces, so one only matches where it starts a line or follows a space */
+	std::string::size_type pos = line.find(item);
+	while (pos != std::string::npos && pos != 0 && line[pos - 1] != ' ')
+		pos = line.find(item, pos + 1);
+	if (pos != std::string::npos)
+		line.erase(pos, item.length());
+
+	fmt->length -= item.length();
+	fmt->entries.erase(entry);
+
+	while (!fmt->lines.empty() && fmt->lines.back().empty())
+		fmt->lines.pop_back();
+}
+
+void NamesCache::Build(Format* fmt, unsigned int format)
+{
+	fmt->lines.clear();
+	fmt->entries.clear();
+	fmt->length = 0;
+
+	/* Leave room for the longest nick the reply could be sent to, as "<nick> = <channel> :" */
+	size_t header = ServerInstance->Config->Limits.NickMax + chan->name.length() + 5;
+	fmt->maxlen = header < 480 ? 480 - header : 1;
+
+	const UserMembList* users = chan->GetUsers();
+	for (UserMembCIter i = users->begin(); i != users->end(); ++i)
+	{
+		if (!i->first->quitting)
+			Insert(fmt, i->first, Render(i->second, format));
+	}
+}
+
+const std::vector<std::string>& NamesCache::Get(unsigned int format)
+{
+	Format* fmt = formats[format];
+	if (!fmt)
+	{
+		fmt = formats[format] = new Format;
+		Build(fmt, format);
+	}
+	else
+	{
+		size_t header = ServerInstance->Config->Limits.NickMax + chan->name.length() + 5;
+		size_t maxlen = header < 480 ? 480 - header : 1;
+		/* Rebuild if the nick length limit was changed, or if parts have left too many short lines */
+		if (maxlen != fmt->maxlen || fmt->lines.size() > 2 * (fmt->length / maxlen + 1))
+			Build(fmt, format);
+	}
+	return fmt->lines;
+}
+
+void NamesCache::Update(User* user)
+{
+	Membership* memb = user->quitting ? NULL : chan->GetUser(user);
+	for (unsigned int format = 0; format < NAMES_FORMATS; format++)
+	{
+		Format* fmt = formats[format];
+		if (!fmt)
+			continue;
+
+		std::map<User*, Entry>::iterator entry = fmt->entries.find(user);
+		if (!memb)
+		{
+			if (entry != fmt->entries.end())
+				Remove(fmt, entry);
+			continue;
+		}
+
+		std::string item = Render(memb, format);
+		if (entry != fmt->entries.end())
+		{
+			if (entry->second.item == item)
+				continue;
+			Remove(fmt, entry);
+		}
+		Insert(fmt, user, item);
+	}
+}
+
 long Channel::GetMaxBans()
 {
 	/* Return the cached value if there is one */
@@ -944,6 +1107,8 @@ bool Channel::SetPrefix(User* user, char prefix, bool adding)
 	UserMembIter m = userlist.find(user);
 	if (m == userlist.end())
 		return false;
+	bool changed = adding;
+	bool found = false;
 	for(unsigned int i=0; i < m->second->modes.length(); i++)
 	{
 		char mchar = m->second->modes[i];
@@ -954,12 +1119,16 @@ bool Channel::SetPrefix(User* user, char prefix, bool adding)
 				m->second->modes.substr(0,i) +
 				(adding ? std::string(1, prefix) : "") +
 				m->second->modes.substr(mchar == prefix ? i+1 : i);
-			return adding != (mchar == prefix);
+			changed = adding != (mchar == prefix);
+			found = true;
+			break;
 		}
 	}
-	if (adding)
+	if (adding && !found)
 		m->second->modes += std::string(1, prefix);
-	return adding;
+	if (changed)
+		names.Update(user);
+	return changed;
 }
 
 void Channel::RemoveAllPrefixes(User* user)
@@ -968,6 +1137,7 @@ void Channel::RemoveAllPrefixes(User* user)
 	if (m != userlist.end())
 	{
 		m->second->modes.clear();
+		names.Update(user);
 	}
 }
 
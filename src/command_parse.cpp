@@ -274,6 +274,8 @@ bool CommandParser::ProcessCommand(LocalUser *user, std::string &cmd)
 		command_p.push_back(lparam);
 	}
 
+	CommandTimer timer(cm->second, false);
+
 	/*
 	 * We call OnPreCommand here seperately if the command exists, so the magic above can
 	 * truncate to max_params if necessary. -- w00t
@@ -347,7 +349,12 @@ bool CommandParser::ProcessCommand(LocalUser *user, std::string &cmd)
 		/*
 		 * WARNING: be careful, the user may be deleted soon
 		 */
-		CmdResult result = cm->second->Handle(command_p, user);
+		CmdResult result;
+		{
+			TraceTimer trace(LoopTimings::TRACE_COMMAND, cm->second->name.c_str(), user->nick);
+			timer.Ran();
+			result = cm->second->Handle(command_p, user);
+		}
 
 		FOREACH_MOD(I_OnPostCommand,OnPostCommand(command, command_p, user, result,cmd));
 		return do_more;
@@ -364,6 +371,24 @@ void CommandParser::RemoveCommand(Command* x)
 Command::~Command()
 {
 	ServerInstance->Parser->RemoveCommand(this);
+	delete local_timings;
+	delete remote_timings;
+}
+
+CommandTimer::~CommandTimer()
+{
+	if (!ran)
+		return;
+
+	/* Read these first, so that allocating the timings is not counted */
+	uint64_t usecs = LoopTimings::Now() - start;
+	unsigned long allocated = HeapAllocations - allocations;
+
+	Command::Timings*& timings = remote ? cmd->remote_timings : cmd->local_timings;
+	if (!timings)
+		timings = new Command::Timings;
+	timings->latency.Add(usecs);
+	timings->allocations += allocated;
 }
 
 bool CommandParser::ProcessBuffer(std::string &buffer,LocalUser *user)
@@ -20,6 +20,62 @@
 
 #include "inspircd.h"
 
+/** Seconds a channel snapshot is reused for before LIST builds a new one */
+static const time_t SnapshotLifetime = 30;
+
+/** A channel as it was when a snapshot was taken */
+struct ListEntry
+{
+	std::string name;
+	long users;
+	time_t created;
+};
+
+/** All channels at one point in time, by user count (largest first). Shared by every
+ * LIST started while it is current, and kept alive by the LISTs still sending from it.
+ */
+class ListSnapshot : public refcountbase
+{
+ public:
+	std::vector<ListEntry> entries;
+	time_t taken;
+
+	ListSnapshot() : taken(ServerInstance->Time())
+	{
+		entries.reserve(ServerInstance->chanlist->size());
+		for (chan_hash::const_iterator i = ServerInstance->chanlist->begin(); i != ServerInstance->chanlist->end(); ++i)
+		{
+			ListEntry entry;
+			entry.name = i->second->name;
+			entry.users = i->second->GetUserCounter();
+			entry.created = i->second->age;
+			entries.push_back(entry);
+		}
+		std::sort(entries.begin(), entries.end(), ListSnapshot::MoreUsers);
+	}
+
+	static bool MoreUsers(const ListEntry& a, const ListEntry& b)
+	{
+		return a.users > b.users;
+	}
+};
+
+/** A LIST being sent to a user */
+struct ListState
+{
+	reference<ListSnapshot> snapshot;
+	/** Next and end positions in the snapshot, already narrowed by the user count limits */
+	size_t pos, end;
+	/** Glob patterns to match against the name or topic, if any */
+	std::vector<std::string> masks;
+	/** Glob patterns, given as "!mask", which the name must not match */
+	std::vector<std::string> negmasks;
+	/** Creation and topic time limits (0 for none) */
+	time_t createdafter, createdbefore, topicafter, topicbefore;
+
+	ListState() : pos(0), end(0), createdafter(0), createdbefore(0), topicafter(0), topicbefore(0) { }
+};
+
 /** Handle /LIST. These command handlers can be reloaded by the core,
  * and handle basic RFC1459 commands. Commands within modules work
  * the same way, however, they can be fully unloaded, where these
@@ -27,10 +83,22 @@
  */
 class CommandList : public Command
 {
+	reference<ListSnapshot> current;
+
+	/** Parse one ELIST condition into state, returning false if it is a mask
+	 * @param cond The condition, e.g. ">5" or "C<60"
+	 * @param state The LIST to add the condition to
+	 * @param minusers Set by ">n"
+	 * @param maxusers Set by "<n"
+	 */
+	bool ParseCondition(const std::string& cond, ListState& state, long& minusers, long& maxusers);
+
  public:
+	SimpleExtItem<ListState> listing;
+
 	/** Constructor for list.
 	 */
-	CommandList ( Module* parent) : Command(parent,"LIST", 0, 0) { Penalty = 5; }
+	CommandList(Module* parent) : Command(parent,"LIST", 0, 0), listing("list_state", parent) { Penalty = 5; }
 	/** Handle command.
 	 * @param parameters The parameters to the comamnd
 	 * @param pcnt The number of parameters passed to teh command
@@ -38,68 +106,181 @@ class CommandList : public Command
 	 * @return A value from CmdResult to indicate command success or failure.
 	 */
 	CmdResult Handle(const std::vector<std::string>& parameters, User *user);
+
+	/** Send the next part of a user's LIST: until their sendq is half full, or to the end
+	 * @param user The user to send to
+	 */
+	void SendList(User* user);
 };
 
+bool CommandList::ParseCondition(const std::string& cond, ListState& state, long& minusers, long& maxusers)
+{
+	if (cond.empty())
+		return false;
+
+	/* Work around mIRC suckyness. YOU SUCK, KHALED! */
+	if (cond[0] == '<')
+	{
+		maxusers = atol(cond.c_str() + 1);
+		return true;
+	}
+	if (cond[0] == '>')
+	{
+		minusers = atol(cond.c_str() + 1);
+		return true;
+	}
+
+	/* Creation time (C) and topic time (T), in minutes ago */
+	if ((cond.length() > 2) && (cond[0] == 'C' || cond[0] == 'T') && (cond[1] == '<' || cond[1] == '>'))
+	{
+		time_t when = ServerInstance->Time() - atol(cond.c_str() + 2) * 60;
+		if (cond[0] == 'C')
+			(cond[1] == '<' ? state.createdafter : state.createdbefore) = when;
+		else
+			(cond[1] == '<' ? state.topicafter : state.topicbefore) = when;
+		return true;
+	}
+	return false;
+}
 
 /** Handle /LIST
  */
 CmdResult CommandList::Handle (const std::vector<std::string>& parameters, User *user)
 {
-	int minusers = 0, maxusers = 0;
+	long minusers = 0, maxusers = 0;
 
 	user->WriteNumeric(321, "%s Channel :Users Name",user->nick.c_str());
 
-	/* Work around mIRC suckyness. YOU SUCK, KHALED! */
-	if (parameters.size() == 1)
+	if (!current || (current->taken + SnapshotLifetime < ServerInstance->Time()))
+		current = new ListSnapshot;
+
+	ListState* state = new ListState;
+	state->snapshot = current;
+	if (parameters.size())
 	{
-		if (parameters[0][0] == '<')
+		irc::commasepstream conds(parameters[0]);
+		std::string cond;
+		while (conds.GetToken(cond))
 		{
-			maxusers = atoi((parameters[0].c_str())+1);
-		}
-		else if (parameters[0][0] == '>')
-		{
-			minusers = atoi((parameters[0].c_str())+1);
+			if (ParseCondition(cond, *state, minusers, maxusers))
+				continue;
+			if (cond.length() > 1 && cond[0] == '!')
+				state->negmasks.push_back(cond.substr(1));
+			else if (!cond.empty())
+				state->masks.push_back(cond);
 		}
 	}
 
-	for (chan_hash::const_iterator i = ServerInstance->chanlist->begin(); i != ServerInstance->chanlist->end(); i++)
+	/* The snapshot is ordered by user count, so the count limits are a range of it */
+	const std::vector<ListEntry>& entries = current->entries;
+	state->end = entries.size();
+	while (state->pos < state->end && maxusers && entries[state->pos].users >= maxusers)
+		state->pos++;
+	while (state->end > state->pos && minusers && entries[state->end - 1].users <= minusers)
+		state->end--;
+
+	/* A new LIST replaces one still being sent */
+	listing.set(user, state);
+	SendList(user);
+	return CMD_SUCCESS;
+}
+
+void CommandList::SendList(User* user)
+{
+	ListState* state = listing.get(user);
+	if (!state)
+		return;
+
+	/* Stop at half of the soft sendq and carry on when it has been written out */
+	LocalUser* luser = IS_LOCAL(user);
+	unsigned long limit = luser ? luser->MyClass->GetSendqSoftMax() / 2 : ULONG_MAX;
+	const std::vector<ListEntry>& entries = state->snapshot->entries;
+	bool auspex = user->HasPrivPermission("channels/auspex");
+
+	for (; state->pos < state->end; state->pos++)
 	{
-		// attempt to match a glob pattern
-		long users = i->second->GetUserCounter();
+		if (luser && luser->eh.getSendQSize() >= limit)
+			return;
+
+		const ListEntry& entry = entries[state->pos];
+		if ((state->createdafter && entry.created <= state->createdafter) || (state->createdbefore && entry.created >= state->createdbefore))
+			continue;
 
-		bool too_few = (minusers && (users <= minusers));
-		bool too_many = (maxusers && (users >= maxusers));
+		/* The channel may have gone since the snapshot; its details are sent as they are now */
+		Channel* chan = ServerInstance->FindChan(entry.name);
+		if (!chan)
+			continue;
 
-		if (too_many || too_few)
+		if ((state->topicafter && chan->topicset <= state->topicafter) || (state->topicbefore && chan->topicset >= state->topicbefore))
 			continue;
 
-		if (parameters.size() && !parameters[0].empty() && (parameters[0][0] != '<' && parameters[0][0] != '>'))
+		// attempt to match a glob pattern
+		if (!state->masks.empty())
 		{
-			if (!InspIRCd::Match(i->second->name, parameters[0]) && !InspIRCd::Match(i->second->topic, parameters[0]))
+			std::vector<std::string>::const_iterator mask = state->masks.begin();
+			while (mask != state->masks.end() && !InspIRCd::Match(chan->name, *mask) && !InspIRCd::Match(chan->topic, *mask))
+				++mask;
+			if (mask == state->masks.end())
+				continue;
+		}
+
+		if (!state->negmasks.empty())
+		{
+			std::vector<std::string>::const_iterator mask = state->negmasks.begin();
+			while (mask != state->negmasks.end() && !InspIRCd::Match(chan->name, *mask))
+				++mask;
+			if (mask != state->negmasks.end())
 				continue;
 		}
 
 		// if the channel is not private/secret, OR the user is on the channel anyway
-		bool n = (i->second->HasUser(user) || user->HasPrivPermission("channels/auspex"));
+		bool n = (auspex || chan->HasUser(user));
+		long users = chan->GetUserCounter();
 
-		if (!n && i->second->IsModeSet('p'))
+		if (!n && chan->IsModeSet('p'))
 		{
 			/* Channel is +p and user is outside/not privileged */
 			user->WriteNumeric(322, "%s * %ld :",user->nick.c_str(), users);
 		}
 		else
 		{
-			if (n || !i->second->IsModeSet('s'))
+			if (n || !chan->IsModeSet('s'))
 			{
 				/* User is in the channel/privileged, channel is not +s */
-				user->WriteNumeric(322, "%s %s %ld :[+%s] %s",user->nick.c_str(),i->second->name.c_str(),users,i->second->ChanModes(n),i->second->topic.c_str());
+				user->WriteNumeric(322, "%s %s %ld :[+%s] %s",user->nick.c_str(),chan->name.c_str(),users,chan->ChanModes(n),chan->topic.c_str());
 			}
 		}
 	}
-	user->WriteNumeric(323, "%s :End of channel list.",user->nick.c_str());
 
-	return CMD_SUCCESS;
+	listing.unset(user);
+	user->WriteNumeric(323, "%s :End of channel list.",user->nick.c_str());
 }
 
+class ModuleList : public Module
+{
+	CommandList cmd;
+
+ public:
+	ModuleList() : cmd(this)
+	{
+	}
+
+	void init()
+	{
+		ServerInstance->Modules->AddService(cmd);
+		ServerInstance->Modules->AddService(cmd.listing);
+		ServerInstance->Modules->Attach(I_OnBufferFlushed, this);
+	}
+
+	void OnBufferFlushed(LocalUser* user)
+	{
+		cmd.SendList(user);
+	}
+
+	Version GetVersion()
+	{
+		return Version("LIST", VF_VENDOR | VF_CORE);
+	}
+};
 
-COMMAND_INIT(CommandList)
+MODULE_INIT(ModuleList)
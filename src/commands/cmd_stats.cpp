@@ -210,12 +210,54 @@ void CommandStats::DoStats(char statschar, User* user, string_list &results)
 			}
 		break;
 
+		/* stats x (time taken and allocations made by each command) */
+		case 'x':
+			for (Commandtable::iterator i = ServerInstance->Parser->cmdlist.begin(); i != ServerInstance->Parser->cmdlist.end(); i++)
+			{
+				for (int remote = 0; remote < 2; remote++)
+				{
+					const Command::Timings* timings = remote ? i->second->remote_timings : i->second->local_timings;
+					if (!timings)
+						continue;
+					std::string line = sn+" 249 "+user->nick+" :"+i->second->name+(remote ? " remote: " : " local: ")+timings->latency.Summary();
+#ifdef COUNT_ALLOCATIONS
+					line.append(", "+ConvToStr(timings->allocations)+" allocations");
+#endif
+					results.push_back(line);
+				}
+			}
+		break;
+
+		/* stats M (memory used by each part of the server) */
+		case 'M':
+		{
+			MemoryReport report;
+			report.Collect();
+			for (std::vector<MemoryReport::Entry>::const_iterator i = report.entries.begin(); i != report.entries.end(); ++i)
+				results.push_back(sn+" 249 "+user->nick+" :"+i->name+": "+ConvToStr(i->count)+" using "+ConvToStr(i->bytes)+" bytes");
+			results.push_back(sn+" 249 "+user->nick+" :Total: "+ConvToStr(report.Total())+" bytes");
+		}
+		break;
+
+		/* stats j (main loop timings) */
+		case 'j':
+		{
+			const LoopTimings& times = ServerInstance->LoopTimes;
+			for (int i = 0; i < LoopTimings::PHASE_COUNT; i++)
+				results.push_back(sn+" 249 "+user->nick+" :"+LoopTimings::PhaseNames[i]+": "+times.phases[i].Summary());
+			if (ServerInstance->Config->SlowLoop)
+				results.push_back(sn+" 249 "+user->nick+" :slow iterations (over "+ConvToStr(ServerInstance->Config->SlowLoop)+"ms): "+ConvToStr(times.slow));
+		}
+		break;
+
 		/* stats z (debug and memory info) */
 		case 'z':
 		{
 			results.push_back(sn+" 249 "+user->nick+" :Users: "+ConvToStr(ServerInstance->Users->clientlist->size()));
 			results.push_back(sn+" 249 "+user->nick+" :Channels: "+ConvToStr(ServerInstance->chanlist->size()));
 			results.push_back(sn+" 249 "+user->nick+" :Commands: "+ConvToStr(ServerInstance->Parser->cmdlist.size()));
+			results.push_back(sn+" 249 "+user->nick+" :Cull list: "+ConvToStr(ServerInstance->GlobalCulls.Pending())+" waiting (peak "+
+				ConvToStr(ServerInstance->GlobalCulls.peak)+"), "+ConvToStr(ServerInstance->GlobalCulls.culled)+" deleted");
 
 			if (!ServerInstance->Config->WhoWasGroupSize == 0 && !ServerInstance->Config->WhoWasMaxGroups == 0)
 			{
@@ -39,6 +39,8 @@ class CommandWho : public Command
 	bool opt_local;
 	bool opt_far;
 	bool opt_time;
+	/** Lines sent for the current query */
+	size_t results;
 
  public:
 	/** Constructor for who.
@@ -46,7 +48,8 @@ class CommandWho : public Command
 	CommandWho ( Module* parent) : Command(parent,"WHO", 1) {
 		syntax = "<server>|<nickname>|<channel>|<realname>|<host>|0 [ohurmMiaplf]";
 	}
-	void SendWhoLine(User* user, const std::vector<std::string>& parms, const std::string &initial, Channel* ch, User* u, std::vector<std::string> &whoresults);
+	void SendWhoLine(User* user, const std::vector<std::string>& parms, const std::string &initial, Channel* ch, User* u);
+	void CheckWhoUser(User* user, User* u, const std::vector<std::string>& parms, const std::string &initial, const char* matchtext, bool usingwildcards);
 	/** Handle command.
 	 * @param parameters The parameters to the comamnd
 	 * @param pcnt The number of parameters passed to teh command
@@ -113,9 +116,12 @@ bool CommandWho::whomatch(User* cuser, User* user, const char* matchtext)
 		{
 			match = false;
 			const Extensible::ExtensibleStore& list = user->GetExtList();
-			for(Extensible::ExtensibleStore::const_iterator i = list.begin(); i != list.end(); ++i)
-				if (InspIRCd::Match(i->first->name, matchtext))
+			for (unsigned int slot = 0; slot < list.size() && !match; slot++)
+			{
+				ExtensionItem* item = ExtensionItem::FromSlot(slot);
+				if (item && list[slot] && InspIRCd::Match(item->name, matchtext))
 					match = true;
+			}
 		}
 		else if (opt_realname)
 			match = InspIRCd::Match(user->fullname, matchtext);
@@ -186,7 +192,7 @@ bool CommandWho::CanView(Channel* chan, User* user)
 	return false;
 }
 
-void CommandWho::SendWhoLine(User* user, const std::vector<std::string>& parms, const std::string &initial, Channel* ch, User* u, std::vector<std::string> &whoresults)
+void CommandWho::SendWhoLine(User* user, const std::vector<std::string>& parms, const std::string &initial, Channel* ch, User* u)
 {
 	if (!ch)
 		ch = get_first_visible_channel(u);
@@ -224,7 +230,24 @@ void CommandWho::SendWhoLine(User* user, const std::vector<std::string>& parms,
 	FOREACH_MOD(I_OnSendWhoLine, OnSendWhoLine(user, parms, u, wholine));
 
 	if (!wholine.empty())
-		whoresults.push_back(wholine);
+	{
+		user->WriteServ(wholine);
+		results++;
+	}
+}
+
+void CommandWho::CheckWhoUser(User* user, User* u, const std::vector<std::string>& parms, const std::string &initial, const char* matchtext, bool usingwildcards)
+{
+	if (whomatch(user, u, matchtext))
+	{
+		if (!user->SharesChannelWith(u))
+		{
+			if (usingwildcards && (u->IsModeSet('i')) && (!user->HasPrivPermission("users/auspex")))
+				return;
+		}
+
+		SendWhoLine(user, parms, initial, NULL, u);
+	}
 }
 
 CmdResult CommandWho::Handle (const std::vector<std::string>& parameters, User *user)
@@ -248,9 +271,9 @@ CmdResult CommandWho::Handle (const std::vector<std::string>& parameters, User *
 	opt_local = false;
 	opt_far = false;
 	opt_time = false;
+	results = 0;
 
 	Channel *ch = NULL;
-	std::vector<std::string> whoresults;
 	std::string initial = "352 " + user->nick + " ";
 
 	char matchtext[MAXBUF];
@@ -350,7 +373,7 @@ CmdResult CommandWho::Handle (const std::vector<std::string>& parameters, User *
 						continue;
 				}
 
-				SendWhoLine(user, parameters, initial, ch, i->first, whoresults);
+				SendWhoLine(user, parameters, initial, ch, i->first);
 			}
 		}
 	}
@@ -372,36 +395,37 @@ CmdResult CommandWho::Handle (const std::vector<std::string>& parameters, User *
 							continue;
 					}
 
-					SendWhoLine(user, parameters, initial, NULL, oper, whoresults);
+					SendWhoLine(user, parameters, initial, NULL, oper);
 				}
 			}
 		}
 		else
 		{
-			for (user_hash::iterator i = ServerInstance->Users->clientlist->begin(); i != ServerInstance->Users->clientlist->end(); i++)
+			/* Plain nick, host and server masks can be looked up in the user index,
+			 * everything else has to be checked against every user.
+			 */
+			std::vector<User*> candidates;
+			bool indexed = !opt_mode && !opt_metadata && !opt_realname && !opt_ident && !opt_port && !opt_away && !opt_time;
+			bool servers = ServerInstance->Config->HideWhoisServer.empty() || user->HasPrivPermission("users/auspex");
+
+			if (indexed && ServerInstance->Users->index.Search(matchtext, opt_showrealhost, servers, candidates))
 			{
-				if (whomatch(user, i->second, matchtext))
-				{
-					if (!user->SharesChannelWith(i->second))
-					{
-						if (usingwildcards && (i->second->IsModeSet('i')) && (!user->HasPrivPermission("users/auspex")))
-							continue;
-					}
-
-					SendWhoLine(user, parameters, initial, NULL, i->second, whoresults);
-				}
+				for (std::vector<User*>::const_iterator i = candidates.begin(); i != candidates.end(); ++i)
+					CheckWhoUser(user, *i, parameters, initial, matchtext, usingwildcards);
+			}
+			else
+			{
+				for (user_hash::iterator i = ServerInstance->Users->clientlist->begin(); i != ServerInstance->Users->clientlist->end(); i++)
+					CheckWhoUser(user, i->second, parameters, initial, matchtext, usingwildcards);
 			}
 		}
 	}
-	/* Send the results out */
-	for (std::vector<std::string>::const_iterator n = whoresults.begin(); n != whoresults.end(); n++)
-		user->WriteServ(*n);
 	user->WriteNumeric(315, "%s %s :End of /WHO list.",user->nick.c_str(), *parameters[0].c_str() ? parameters[0].c_str() : "*");
 
 	// Penalize the user a bit for large queries
 	// (add one unit of penalty per 200 results)
 	if (IS_LOCAL(user))
-		IS_LOCAL(user)->CommandFloodPenalty += whoresults.size() * 5;
+		IS_LOCAL(user)->CommandFloodPenalty += results * 5;
 	return CMD_SUCCESS;
 }
 
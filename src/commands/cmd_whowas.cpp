@@ -25,7 +25,10 @@
 
 WhoWasMaintainTimer * timer;
 
-CommandWhowas::CommandWhowas( Module* parent) : Command(parent, "WHOWAS", 1)
+/** Estimated bookkeeping cost of one hash map node, on top of the key and value */
+static const size_t NodeOverhead = 4 * sizeof(void*);
+
+CommandWhowas::CommandWhowas( Module* parent) : Command(parent, "WHOWAS", 1), lru(NULL), mru(NULL), entries(0), memory(0)
 {
 	syntax = "<nick>{,<nick>}";
 	Penalty = 2;
@@ -42,7 +45,7 @@ CmdResult CommandWhowas::Handle (const std::vector<std::string>& parameters, Use
 		return CMD_FAILURE;
 	}
 
-	whowas_users::iterator i = whowas.find(assign(parameters[0]));
+	whowas_users::iterator i = whowas.find(parameters[0]);
 
 	if (i == whowas.end())
 	{
@@ -52,32 +55,22 @@ CmdResult CommandWhowas::Handle (const std::vector<std::string>& parameters, Use
 	}
 	else
 	{
-		whowas_set* grp = i->second;
-		if (grp->size())
-		{
-			for (whowas_set::iterator ux = grp->begin(); ux != grp->end(); ux++)
-			{
-				WhoWasGroup* u = *ux;
-
-				user->WriteNumeric(314, "%s %s %s %s * :%s",user->nick.c_str(),parameters[0].c_str(),
-					u->ident.c_str(),u->dhost.c_str(),u->gecos.c_str());
-
-				if (user->HasPrivPermission("users/auspex"))
-					user->WriteNumeric(379, "%s %s :was connecting from *@%s",
-						user->nick.c_str(), parameters[0].c_str(), u->host.c_str());
-
-				std::string signon = ServerInstance->TimeString(u->signon);
-				if (!ServerInstance->Config->HideWhoisServer.empty() && !user->HasPrivPermission("servers/auspex"))
-					user->WriteNumeric(312, "%s %s %s :%s",user->nick.c_str(),parameters[0].c_str(), ServerInstance->Config->HideWhoisServer.c_str(), signon.c_str());
-				else
-					user->WriteNumeric(312, "%s %s %s :%s",user->nick.c_str(),parameters[0].c_str(), u->server.c_str(), signon.c_str());
-			}
-		}
-		else
+		WhoWasNick* n = i->second;
+		Touch(n);
+		for (WhoWasGroup* u = n->oldest; u; u = u->next)
 		{
-			user->WriteNumeric(406, "%s %s :There was no such nickname",user->nick.c_str(),parameters[0].c_str());
-			user->WriteNumeric(369, "%s %s :End of WHOWAS",user->nick.c_str(),parameters[0].c_str());
-			return CMD_FAILURE;
+			user->WriteNumeric(314, "%s %s %s %s * :%s",user->nick.c_str(),parameters[0].c_str(),
+				u->ident(),u->dhost->c_str(),u->gecos());
+
+			if (user->HasPrivPermission("users/auspex"))
+				user->WriteNumeric(379, "%s %s :was connecting from *@%s",
+					user->nick.c_str(), parameters[0].c_str(), u->host->c_str());
+
+			std::string signon = ServerInstance->TimeString(u->signon);
+			if (!ServerInstance->Config->HideWhoisServer.empty() && !user->HasPrivPermission("servers/auspex"))
+				user->WriteNumeric(312, "%s %s %s :%s",user->nick.c_str(),parameters[0].c_str(), ServerInstance->Config->HideWhoisServer.c_str(), signon.c_str());
+			else
+				user->WriteNumeric(312, "%s %s %s :%s",user->nick.c_str(),parameters[0].c_str(), u->server->c_str(), signon.c_str());
 		}
 	}
 
@@ -85,21 +78,94 @@ CmdResult CommandWhowas::Handle (const std::vector<std::string>& parameters, Use
 	return CMD_SUCCESS;
 }
 
+void CommandWhowas::GetMemory(MemoryReport& report)
+{
+	report.Add("Whowas", entries, memory);
+	report.Add("Whowas shared strings", shared.size(), shared.memory);
+}
+
 std::string CommandWhowas::GetStats()
 {
-	int whowas_size = 0;
-	int whowas_bytes = 0;
-	whowas_users_fifo::iterator iter;
-	for (iter = whowas_fifo.begin(); iter != whowas_fifo.end(); iter++)
+	return "Whowas entries: " + ConvToStr(entries) + " for " + ConvToStr(whowas.size()) + " nicks (" +
+		ConvToStr(memory + shared.memory) + " bytes of " + ConvToStr(ServerInstance->Config->WhoWasMaxMemory) +
+		", " + ConvToStr(shared.size()) + " shared hosts and servers)";
+}
+
+size_t CommandWhowas::NickBytes(const WhoWasNick* n)
+{
+	/* The nick is held both as the map key and in the WhoWasNick */
+	return sizeof(WhoWasNick) + sizeof(std::string) + 2 * n->nick.length() + NodeOverhead;
+}
+
+void CommandWhowas::Touch(WhoWasNick* n)
+{
+	if (n == mru)
+		return;
+
+	/* unlink */
+	if (n->older)
+		n->older->newer = n->newer;
+	else if (lru == n)
+		lru = n->newer;
+	if (n->newer)
+		n->newer->older = n->older;
+
+	/* and put at the most recently used end */
+	n->older = mru;
+	n->newer = NULL;
+	if (mru)
+		mru->newer = n;
+	mru = n;
+	if (!lru)
+		lru = n;
+}
+
+void CommandWhowas::PopOldest(WhoWasNick* n)
+{
+	WhoWasGroup* a = n->oldest;
+	n->oldest = a->next;
+	if (!n->oldest)
+		n->newest = NULL;
+	n->count--;
+	entries--;
+	memory -= a->bytes;
+	a->Destroy(shared);
+
+	if (!n->count)
+		Remove(n);
+}
+
+void CommandWhowas::Remove(WhoWasNick* n)
+{
+	while (n->oldest)
 	{
-		whowas_set* n = (whowas_set*)whowas.find(iter->second)->second;
-		if (n->size())
-		{
-			whowas_size += n->size();
-			whowas_bytes += (sizeof(whowas_set) + ( sizeof(WhoWasGroup) * n->size() ) );
-		}
+		WhoWasGroup* a = n->oldest;
+		n->oldest = a->next;
+		entries--;
+		memory -= a->bytes;
+		a->Destroy(shared);
 	}
-	return "Whowas entries: " +ConvToStr(whowas_size)+" ("+ConvToStr(whowas_bytes)+" bytes)";
+
+	if (n->older)
+		n->older->newer = n->newer;
+	else
+		lru = n->newer;
+	if (n->newer)
+		n->newer->older = n->older;
+	else
+		mru = n->older;
+
+	memory -= NickBytes(n);
+	whowas.erase(n->nick);
+	delete n;
+}
+
+void CommandWhowas::Shrink()
+{
+	size_t maxgroups = ServerInstance->Config->WhoWasMaxGroups;
+	size_t maxmemory = ServerInstance->Config->WhoWasMaxMemory;
+	while (lru && (whowas.size() > maxgroups || memory + shared.memory > maxmemory))
+		Remove(lru);
 }
 
 void CommandWhowas::AddToWhoWas(User* user)
@@ -110,141 +176,65 @@ void CommandWhowas::AddToWhoWas(User* user)
 		return;
 	}
 
-	whowas_users::iterator iter = whowas.find(irc::string(user->nick.c_str()));
+	WhoWasNick* n;
+	whowas_users::iterator iter = whowas.find(user->nick);
 
 	if (iter == whowas.end())
 	{
-		whowas_set* n = new whowas_set;
-		WhoWasGroup *a = new WhoWasGroup(user);
-		n->push_back(a);
-		whowas[user->nick.c_str()] = n;
-		whowas_fifo.push_back(std::make_pair(ServerInstance->Time(),user->nick.c_str()));
-
-		if ((int)(whowas.size()) > ServerInstance->Config->WhoWasMaxGroups)
-		{
-			whowas_users::iterator iter2 = whowas.find(whowas_fifo[0].second);
-			if (iter2 != whowas.end())
-			{
-				whowas_set* n2 = (whowas_set*)iter2->second;
-
-				if (n2->size())
-				{
-					while (n2->begin() != n2->end())
-					{
-						WhoWasGroup *a2 = *(n2->begin());
-						delete a2;
-						n2->pop_front();
-					}
-				}
-
-				delete n2;
-				whowas.erase(iter2);
-			}
-			whowas_fifo.pop_front();
-		}
+		n = new WhoWasNick;
+		n->nick = user->nick;
+		n->oldest = n->newest = NULL;
+		n->count = 0;
+		n->older = n->newer = NULL;
+		whowas[user->nick] = n;
+		memory += NickBytes(n);
 	}
 	else
-	{
-		whowas_set* group = (whowas_set*)iter->second;
-		WhoWasGroup *a = new WhoWasGroup(user);
-		group->push_back(a);
+		n = iter->second;
 
-		if ((int)(group->size()) > ServerInstance->Config->WhoWasGroupSize)
-		{
-			WhoWasGroup *a2 = (WhoWasGroup*)*(group->begin());
-			delete a2;
-			group->pop_front();
-		}
-	}
+	WhoWasGroup* a = WhoWasGroup::Create(user, shared);
+	if (n->newest)
+		n->newest->next = a;
+	else
+		n->oldest = a;
+	n->newest = a;
+	n->count++;
+	entries++;
+	memory += a->bytes;
+	Touch(n);
+
+	if ((int)n->count > ServerInstance->Config->WhoWasGroupSize)
+		PopOldest(n);
+
+	Shrink();
 }
 
 /* on rehash, refactor maps according to new conf values */
 void CommandWhowas::PruneWhoWas(time_t t)
 {
-	/* config values */
-	int groupsize = ServerInstance->Config->WhoWasGroupSize;
-	int maxgroups = ServerInstance->Config->WhoWasMaxGroups;
-	int maxkeep =   ServerInstance->Config->WhoWasMaxKeep;
-
-	/* first cut the list to new size (maxgroups) and also prune entries that are timed out. */
-	whowas_users::iterator iter;
-	int fifosize;
-	while ((fifosize = (int)whowas_fifo.size()) > 0)
-	{
-		if (fifosize > maxgroups || whowas_fifo[0].first < t - maxkeep)
-		{
-			iter = whowas.find(whowas_fifo[0].second);
-
-			/* hopefully redundant integrity check, but added while debugging r6216 */
-			if (iter == whowas.end())
-			{
-				/* this should never happen, if it does maps are corrupt */
-				ServerInstance->Logs->Log("WHOWAS",DEFAULT, "BUG: Whowas maps got corrupted! (1)");
-				return;
-			}
-
-			whowas_set* n = (whowas_set*)iter->second;
-
-			if (n->size())
-			{
-				while (n->begin() != n->end())
-				{
-					WhoWasGroup *a = *(n->begin());
-					delete a;
-					n->pop_front();
-				}
-			}
-
-			delete n;
-			whowas.erase(iter);
-			whowas_fifo.pop_front();
-		}
-		else
-			break;
-	}
-
-	/* Then cut the whowas sets to new size (groupsize) */
-	fifosize = (int)whowas_fifo.size();
-	for (int i = 0; i < fifosize; i++)
-	{
-		iter = whowas.find(whowas_fifo[0].second);
-		/* hopefully redundant integrity check, but added while debugging r6216 */
-		if (iter == whowas.end())
-		{
-			/* this should never happen, if it does maps are corrupt */
-			ServerInstance->Logs->Log("WHOWAS",DEFAULT, "BUG: Whowas maps got corrupted! (2)");
-			return;
-		}
-		whowas_set* n = (whowas_set*)iter->second;
-		if (n->size())
-		{
-			int nickcount = n->size();
-			while (n->begin() != n->end() && nickcount > groupsize)
-			{
-				WhoWasGroup *a = *(n->begin());
-				delete a;
-				n->pop_front();
-				nickcount--;
-			}
-		}
-	}
+	/* cut the list to the new limits, then trim each nick to the new group size */
+	Shrink();
+	MaintainWhoWas(t);
 }
 
 /* call maintain once an hour to remove expired nicks */
 void CommandWhowas::MaintainWhoWas(time_t t)
 {
-	for (whowas_users::iterator iter = whowas.begin(); iter != whowas.end(); iter++)
+	int groupsize = ServerInstance->Config->WhoWasGroupSize;
+	time_t cutoff = t - ServerInstance->Config->WhoWasMaxKeep;
+
+	WhoWasNick* n = lru;
+	while (n)
 	{
-		whowas_set* n = (whowas_set*)iter->second;
-		if (n->size())
+		WhoWasNick* next = n->newer;
+		/* PopOldest removes the nick along with its last entry */
+		unsigned int count = n->count;
+		while (count && ((int)count > groupsize || n->oldest->added < cutoff))
 		{
-			while ((n->begin() != n->end()) && ((*n->begin())->signon < t - ServerInstance->Config->WhoWasMaxKeep))
-			{
-				WhoWasGroup *a = *(n->begin());
-				delete a;
-				n->erase(n->begin());
-			}
+			count--;
+			PopOldest(n);
 		}
+		n = next;
 	}
 }
 
@@ -255,45 +245,55 @@ CommandWhowas::~CommandWhowas()
 		ServerInstance->Timers->DelTimer(timer);
 	}
 
-	whowas_users::iterator iter;
-	int fifosize;
-	while ((fifosize = (int)whowas_fifo.size()) > 0)
-	{
-		iter = whowas.find(whowas_fifo[0].second);
-
-		/* hopefully redundant integrity check, but added while debugging r6216 */
-		if (iter == whowas.end())
-		{
-			/* this should never happen, if it does maps are corrupt */
-			ServerInstance->Logs->Log("WHOWAS",DEFAULT, "BUG: Whowas maps got corrupted! (3)");
-			return;
-		}
-
-		whowas_set* n = (whowas_set*)iter->second;
+	while (lru)
+		Remove(lru);
+}
 
-		if (n->size())
-		{
-			while (n->begin() != n->end())
-			{
-				WhoWasGroup *a = *(n->begin());
-				delete a;
-				n->pop_front();
-			}
-		}
+const std::string* WhoWasStrings::Intern(const std::string& str)
+{
+	std::pair<StringMap::iterator, bool> res = strings.insert(std::make_pair(str, 0UL));
+	if (res.second)
+		memory += sizeof(StringMap::value_type) + str.length() + NodeOverhead;
+	res.first->second++;
+	return &res.first->first;
+}
 
-		delete n;
-		whowas.erase(iter);
-		whowas_fifo.pop_front();
-	}
+void WhoWasStrings::Release(const std::string* str)
+{
+	StringMap::iterator i = strings.find(*str);
+	if (i == strings.end() || --i->second)
+		return;
+	memory -= sizeof(StringMap::value_type) + i->first.length() + NodeOverhead;
+	strings.erase(i);
 }
 
-WhoWasGroup::WhoWasGroup(User* user) : host(user->host), dhost(user->dhost), ident(user->ident),
-	server(user->server), gecos(user->fullname), signon(user->signon)
+WhoWasGroup* WhoWasGroup::Create(User* user, WhoWasStrings& shared)
 {
+	size_t bytes = sizeof(WhoWasGroup) + user->ident.length() + user->fullname.length() + 2;
+	char* mem = new char[bytes];
+	WhoWasGroup* a = new (mem) WhoWasGroup;
+
+	a->next = NULL;
+	a->host = shared.Intern(user->host);
+	a->dhost = shared.Intern(user->dhost);
+	a->server = shared.Intern(user->server);
+	a->signon = user->signon;
+	a->added = ServerInstance->Time();
+	a->bytes = bytes;
+
+	char* text = mem + sizeof(WhoWasGroup);
+	memcpy(text, user->ident.c_str(), user->ident.length() + 1);
+	memcpy(text + user->ident.length() + 1, user->fullname.c_str(), user->fullname.length() + 1);
+	return a;
 }
 
-WhoWasGroup::~WhoWasGroup()
+void WhoWasGroup::Destroy(WhoWasStrings& shared)
 {
+	shared.Release(host);
+	shared.Release(dhost);
+	shared.Release(server);
+	this->~WhoWasGroup();
+	delete[] reinterpret_cast<char*>(this);
 }
 
 /* every hour, run this function which removes all entries older than Config->WhoWasMaxKeep */
@@ -317,6 +317,12 @@ class ModuleWhoWas : public Module
 	void init()
 	{
 		ServerInstance->Modules->AddService(cmd);
+		ServerInstance->Modules->Attach(I_OnMemoryReport, this);
+	}
+
+	void OnMemoryReport(MemoryReport& report)
+	{
+		cmd.GetMemory(report);
 	}
 
 	void OnRequest(Request& request)
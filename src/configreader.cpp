@@ -32,11 +32,13 @@
 #ifdef _WIN32
 #include <Iphlpapi.h>
 #pragma comment(lib, "Iphlpapi.lib")
+#else
+#include <sys/time.h>
 #endif
 
 ServerConfig::ServerConfig()
 {
-	WhoWasGroupSize = WhoWasMaxGroups = WhoWasMaxKeep = 0;
+	WhoWasGroupSize = WhoWasMaxGroups = WhoWasMaxKeep = WhoWasMaxMemory = 0;
 	RawLog = NoUserDns = HideBans = HideSplits = UndernetMsgPrefix = false;
 	WildcardIPv6 = CycleHosts = InvBypassModes = true;
 	dns_timeout = 5;
@@ -50,6 +52,21 @@ ServerConfig::ServerConfig()
 	c_ipv6_range = 128;
 }
 
+ServerConfig::~ServerConfig()
+{
+	// Jobs left over from a rehash with an invalid configuration
+	for (std::vector<ConfigPrepareJob*>::iterator i = PrepareJobs.begin(); i != PrepareJobs.end(); ++i)
+		delete *i;
+}
+
+/** Monotonic time in milliseconds, for reporting how long each phase of a rehash took,
+ * which unlike the wall clock does not jump if the system time is changed meanwhile
+ */
+static unsigned long RehashClock()
+{
+	return LoopTimings::Now() / 1000;
+}
+
 void ServerConfig::Update005()
 {
 	std::stringstream out(data005);
@@ -432,6 +449,114 @@ void ServerConfig::CrossCheckConnectBlocks(ServerConfig* current)
 			Classes[i] = me;
 		}
 	}
+
+	ClassIndex.Build(Classes);
+}
+
+/** Lookups remembered by a ConnectClassIndex before it starts over */
+static const size_t MaxClassMemo = 4096;
+
+static std::string LowerHost(const std::string& str)
+{
+	std::string lower(str);
+	for (std::string::iterator i = lower.begin(); i != lower.end(); ++i)
+		*i = tolower(*i);
+	return lower;
+}
+
+void ConnectClassIndex::Build(const ClassVector& classes)
+{
+	ranges.clear();
+	lengths.clear();
+	exact.clear();
+	wildcards.clear();
+	memo.clear();
+	ports.assign(classes.size(), 0);
+	hosts.assign(classes.size(), std::string());
+
+	for (size_t i = 0; i < classes.size(); i++)
+	{
+		ConnectClass* c = classes[i];
+		if (c->type == CC_NAMED)
+			continue;
+
+		ports[i] = c->config->getInt("port");
+		const std::string& mask = hosts[i] = c->GetHost();
+
+		/* A mask is matched by InspIRCd::MatchCIDR against both the IP and the host: as a CIDR
+		 * range (any user@ part is ignored), then as a wildcard. Without wildcards, the latter
+		 * is an exact match, and neither an IP nor a host contains '/' or '@'.
+		 */
+		std::string::size_type at = mask.rfind('@');
+		std::string range = (at == std::string::npos) ? mask : mask.substr(at + 1);
+		std::string::size_type slash = range.find('/');
+		irc::sockets::sockaddrs sa;
+		if ((slash != std::string::npos) && (range.find_first_of("*?") == std::string::npos) && (irc::sockets::aptosa(range.substr(0, slash), 0, sa)) &&
+			((at != std::string::npos) || (mask.find_first_of("*?") == std::string::npos)))
+		{
+			irc::sockets::cidr_mask cidr(range);
+			ranges[cidr].push_back(i);
+			lengths.insert(cidr.length);
+			continue;
+		}
+
+		bool literal = (at == std::string::npos) && (slash == std::string::npos) && (!mask.empty());
+		for (std::string::const_iterator ch = mask.begin(); literal && ch != mask.end(); ++ch)
+		{
+			// Only these compare the same under every case mapping
+			if (!isalnum(*ch) && *ch != '.' && *ch != ':' && *ch != '-' && *ch != '_')
+				literal = false;
+		}
+
+		if (literal)
+			exact[LowerHost(mask)].push_back(i);
+		else
+			wildcards.push_back(i);
+	}
+}
+
+const std::vector<size_t>& ConnectClassIndex::Find(const irc::sockets::sockaddrs& sa, const std::string& ip, int port, const std::string& host)
+{
+	std::string key = ip + " " + ConvToStr(port) + " " + host;
+	std::map<std::string, PosList>::iterator cached = memo.find(key);
+	if (cached != memo.end())
+		return cached->second;
+
+	if (memo.size() >= MaxClassMemo)
+		memo.clear();
+	PosList& found = memo[key];
+
+	for (std::set<int>::const_iterator len = lengths.begin(); len != lengths.end(); ++len)
+	{
+		std::map<irc::sockets::cidr_mask, PosList>::const_iterator r = ranges.find(irc::sockets::cidr_mask(sa, *len));
+		if (r != ranges.end())
+			found.insert(found.end(), r->second.begin(), r->second.end());
+	}
+
+	std::map<std::string, PosList>::const_iterator e = exact.find(LowerHost(ip));
+	if (e != exact.end())
+		found.insert(found.end(), e->second.begin(), e->second.end());
+	e = exact.find(LowerHost(host));
+	if (e != exact.end())
+		found.insert(found.end(), e->second.begin(), e->second.end());
+
+	for (PosList::const_iterator w = wildcards.begin(); w != wildcards.end(); ++w)
+	{
+		if (InspIRCd::MatchCIDR(ip, hosts[*w], NULL) || InspIRCd::MatchCIDR(host, hosts[*w], NULL))
+			found.push_back(*w);
+	}
+
+	std::sort(found.begin(), found.end());
+	found.erase(std::unique(found.begin(), found.end()), found.end());
+
+	PosList::iterator keep = found.begin();
+	for (PosList::const_iterator i = found.begin(); i != found.end(); ++i)
+	{
+		if ((!ports[*i]) || (ports[*i] == port))
+			*keep++ = *i;
+	}
+	found.erase(keep, found.end());
+	return found;
 }
 
 /** Represents a deprecated configuration tag.
@@ -513,6 +638,8 @@ void ServerConfig::Fill()
 	AdminNick = ConfValue("admin")->getString("nick", "admin");
 	ModPath = ConfValue("path")->getString("moduledir", MOD_PATH);
 	NetBufferSize = ConfValue("performance")->getInt("netbuffersize", 10240);
+	MaxCull = ConfValue("performance")->getInt("maxcull", 5000);
+	SlowLoop = ConfValue("performance")->getInt("slowloop", 0);
 	dns_timeout = ConfValue("dns")->getInt("timeout", 5);
 	DisabledCommands = ConfValue("disabled")->getString("commands", "");
 	DisabledDontExist = ConfValue("disabled")->getBool("fakenonexistant");
@@ -536,6 +663,7 @@ void ServerConfig::Fill()
 	WhoWasGroupSize = ConfValue("whowas")->getInt("groupsize");
 	WhoWasMaxGroups = ConfValue("whowas")->getInt("maxgroups");
 	WhoWasMaxKeep = ServerInstance->Duration(ConfValue("whowas")->getString("maxkeep"));
+	WhoWasMaxMemory = ConfValue("whowas")->getInt("maxmemory", 16 * 1024 * 1024);
 	MaxChans = ConfValue("channels")->getInt("users", 20);
 	OperMaxChans = ConfValue("channels")->getInt("opers", 60);
 	c_ipv4_range = ConfValue("cidr")->getInt("ipv4clone", 32);
@@ -561,6 +689,7 @@ void ServerConfig::Fill()
 	range(WhoWasGroupSize, 0, 10000, 10, "<whowas:groupsize>");
 	range(WhoWasMaxGroups, 0, 1000000, 10240, "<whowas:maxgroups>");
 	range(WhoWasMaxKeep, 3600, INT_MAX, 3600, "<whowas:maxkeep>");
+	range(WhoWasMaxMemory, 65536, INT_MAX, 16 * 1024 * 1024, "<whowas:maxmemory>");
 
 	ValidIP(DNSServer, "<dns:server>");
 
@@ -671,6 +800,24 @@ void ServerConfig::Read()
 	{
 		DNSServer = ConfValue("dns")->getString("server");
 		FindDNS(DNSServer);
+
+		// Re-parse our MOTD and RULES files for colors -- Justasic
+		ConfigTagList tags = ConfTags("connect");
+		for (ConfigIter i = tags.first; i != tags.second; ++i)
+		{
+			ConfigTag* tag = i->second;
+			// Make sure our connection class allows motd colors
+			if (!tag->getBool("allowmotdcolors"))
+				continue;
+
+			ConfigFileCache::iterator file = this->Files.find(tag->getString("motd", "motd"));
+			if (file != this->Files.end())
+				InspIRCd::ProcessColors(file->second);
+
+			file = this->Files.find(tag->getString("rules", "rules"));
+			if (file != this->Files.end())
+				InspIRCd::ProcessColors(file->second);
+		}
 	}
 }
 
@@ -764,23 +911,6 @@ void ServerConfig::Apply(ServerConfig* old, const std::string &useruid)
 	errstr.clear();
 	errstr.str(std::string());
 
-	// Re-parse our MOTD and RULES files for colors -- Justasic
-	for (ClassVector::const_iterator it = this->Classes.begin(), it_end = this->Classes.end(); it != it_end; ++it)
-	{
-		ConfigTag *tag = (*it)->config;
-		// Make sure our connection class allows motd colors
-		if(!tag->getBool("allowmotdcolors"))
-		      continue;
-
-		ConfigFileCache::iterator file = this->Files.find(tag->getString("motd", "motd"));
-		if (file != this->Files.end())
-		      InspIRCd::ProcessColors(file->second);
-
-		file = this->Files.find(tag->getString("rules", "rules"));
-		if (file != this->Files.end())
-		      InspIRCd::ProcessColors(file->second);
-	}
-
 	/* No old configuration -> initial boot, nothing more to do here */
 	if (!old)
 	{
@@ -797,6 +927,15 @@ void ServerConfig::Apply(ServerConfig* old, const std::string &useruid)
 	if (!valid)
 		return;
 
+	// Swap in what modules prepared on the config reader thread. This is done before
+	// any modules are unloaded, as that is not allowed while jobs are pending.
+	for (std::vector<ConfigPrepareJob*>::iterator i = PrepareJobs.begin(); i != PrepareJobs.end(); ++i)
+	{
+		(*i)->Commit();
+		delete *i;
+	}
+	PrepareJobs.clear();
+
 	ApplyModules(user);
 
 	if (user)
@@ -930,9 +1069,37 @@ const std::string& ServerConfig::GetSID()
 	return sid;
 }
 
+ConfigReaderThread::ConfigReaderThread(const std::string &useruid)
+	: Config(new ServerConfig), done(false), ReadTime(0), PrepareTime(0), TheUserUID(useruid)
+{
+	FOREACH_MOD(I_OnPrepareConfig, OnPrepareConfig(Config->PrepareJobs));
+
+	// A module which is being unloaded must not have work done for it on the thread
+	for (std::vector<ConfigPrepareJob*>::iterator i = Config->PrepareJobs.begin(); i != Config->PrepareJobs.end(); )
+	{
+		if ((*i)->creator->dying)
+		{
+			delete *i;
+			i = Config->PrepareJobs.erase(i);
+		}
+		else
+			++i;
+	}
+}
+
 void ConfigReaderThread::Run()
 {
+	unsigned long start = RehashClock();
 	Config->Read();
+	unsigned long read = RehashClock();
+	ReadTime = read - start;
+
+	if (Config->valid)
+	{
+		for (std::vector<ConfigPrepareJob*>::iterator i = Config->PrepareJobs.begin(); i != Config->PrepareJobs.end(); ++i)
+			(*i)->Prepare(Config);
+	}
+	PrepareTime = RehashClock() - read;
 	done = true;
 }
 
@@ -941,7 +1108,9 @@ void ConfigReaderThread::Finish()
 	ServerConfig* old = ServerInstance->Config;
 	ServerInstance->Logs->Log("CONFIG",DEBUG,"Switching to new configuration...");
 	ServerInstance->Config = this->Config;
+	unsigned long start = RehashClock();
 	Config->Apply(old, TheUserUID);
+	unsigned long applied = RehashClock();
 
 	if (Config->valid)
 	{
@@ -957,7 +1126,36 @@ void ConfigReaderThread::Finish()
 		ServerInstance->ResetMaxBans();
 		Config->ApplyDisabledCommands(Config->DisabledCommands);
 		User* user = ServerInstance->FindNick(TheUserUID);
-		FOREACH_MOD(I_OnRehash, OnRehash(user));
+		unsigned long xlines = RehashClock();
+
+		// This is FOREACH_MOD(I_OnRehash, OnRehash(user)), timing each module
+		std::string slowest;
+		unsigned long slowesttime = 0;
+		EventHandlerIter safei;
+		for (EventHandlerIter i = ServerInstance->Modules->EventHandlers[I_OnRehash].begin(); i != ServerInstance->Modules->EventHandlers[I_OnRehash].end(); )
+		{
+			safei = i;
+			++safei;
+			Module* mod = *i;
+			unsigned long modstart = RehashClock();
+			try
+			{
+				mod->OnRehash(user);
+			}
+			catch (CoreException& modexcept)
+			{
+				ServerInstance->Logs->Log("MODULE",DEFAULT,"Exception caught: %s",modexcept.GetReason());
+			}
+			unsigned long modtime = RehashClock() - modstart;
+			if (slowest.empty() || modtime > slowesttime)
+			{
+				slowest = mod->ModuleSourceFile;
+				slowesttime = modtime;
+			}
+			i = safei;
+		}
+		unsigned long modules = RehashClock();
+
 		ServerInstance->BuildISupport();
 
 		ServerInstance->Logs->CloseLogs();
@@ -966,6 +1164,16 @@ void ConfigReaderThread::Finish()
 		if (Config->RawLog && !old->RawLog)
 			ServerInstance->Users->ServerNoticeAll("*** Raw I/O logging is enabled on this server. All messages, passwords, and commands are being recorded.");
 
+		unsigned long end = RehashClock();
+		std::string timings = "*** Rehash timings: read " + ConvToStr(ReadTime) + "ms, prepare " + ConvToStr(PrepareTime) +
+			"ms (in the background); apply " + ConvToStr(applied - start) + "ms, xlines " + ConvToStr(xlines - applied) +
+			"ms, modules " + ConvToStr(modules - xlines) + "ms" +
+			(slowest.empty() ? "" : " (slowest " + slowest + " " + ConvToStr(slowesttime) + "ms)") +
+			", other " + ConvToStr(end - modules) + "ms; main loop blocked for " + ConvToStr(end - start) + "ms";
+		if (user)
+			user->SendText(":%s NOTICE %s :%s", Config->ServerName.c_str(), user->nick.c_str(), timings.c_str());
+		ServerInstance->SNO->WriteGlobalSno('a', timings);
+
 		Config = old;
 	}
 	else
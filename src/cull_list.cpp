@@ -23,7 +23,15 @@
 #include "inspircd.h"
 #include <typeinfo>
 
-void CullList::Apply()
+void CullList::AddItem(classbase* item)
+{
+	if (queued.insert(item).second)
+		list.push_back(item);
+	else
+		ServerInstance->Logs->Log("CULLLIST",DEBUG, "WARNING: Object @%p culled twice!", (void*)item);
+}
+
+void CullList::Apply(size_t limit)
 {
 	std::vector<LocalUser *> working;
 	while (!SQlist.empty())
@@ -38,36 +46,41 @@ void CullList::Apply()
 		}
 		working.clear();
 	}
-	std::set<classbase*> gone;
-	std::vector<classbase*> queue;
-	queue.reserve(list.size() + 32);
-	for(unsigned int i=0; i < list.size(); i++)
+
+	if (Pending() > peak)
+		peak = Pending();
+
+	do
 	{
-		classbase* c = list[i];
-		if (gone.insert(c).second)
+		size_t last = list.size();
+		if (limit && last - first > limit)
+			last = first + limit;
+
+		/* Objects culled here may add more to the list, which can move it */
+		std::vector<classbase*> queue(list.begin() + first, list.begin() + last);
+		first = last;
+		for(unsigned int i=0; i < queue.size(); i++)
 		{
+			classbase* c = queue[i];
 			ServerInstance->Logs->Log("CULLLIST", DEBUG, "Deleting %s @%p", typeid(*c).name(),
 				(void*)c);
 			c->cull();
-			queue.push_back(c);
 		}
-		else
+		for(unsigned int i=0; i < queue.size(); i++)
 		{
-			ServerInstance->Logs->Log("CULLLIST",DEBUG, "WARNING: Object @%p culled twice!",
-				(void*)c);
+			classbase* c = queue[i];
+			queued.erase(c);
+			delete c;
 		}
-	}
-	list.clear();
-	for(unsigned int i=0; i < queue.size(); i++)
-	{
-		classbase* c = queue[i];
-		delete c;
-	}
-	if (list.size())
-	{
-		ServerInstance->Logs->Log("CULLLIST",DEBUG, "WARNING: Objects added to cull list in a destructor");
-		Apply();
-	}
+		culled += queue.size();
+
+		/* Drop the culled objects from the front once they are at least half of the list */
+		if (first >= list.size() - first)
+		{
+			list.erase(list.begin(), list.begin() + first);
+			first = 0;
+		}
+	} while (!limit && Pending());
 }
 
 void ActionList::Run()
@@ -108,6 +108,7 @@ class DNSRequest
 	DNS*            dnsobj;		/* DNS caller (where we get our FD from) */
 	unsigned long	ttl;		/* Time to live */
 	std::string     orig;		/* Original requested name/ip */
+	uint64_t        started;	/* When the request was made, from LoopTimings::Now */
 
 	DNSRequest(DNS* dns, int id, const std::string &original);
 	~DNSRequest();
@@ -180,6 +181,7 @@ DNSRequest::DNSRequest(DNS* dns, int rid, const std::string &original) : dnsobj(
 	res = new unsigned char[sizeof(DNSHeader) * 2];
 	*res = 0;
 	orig = original;
+	started = LoopTimings::Now();
 	RequestTimeout* RT = new RequestTimeout(ServerInstance->Config->dns_timeout ? ServerInstance->Config->dns_timeout : 5, this, rid);
 	ServerInstance->Timers->AddTimer(RT); /* The timer manager frees this */
 }
@@ -327,6 +329,14 @@ int DNS::PruneCache()
 	return n;
 }
 
+void DNS::GetMemory(MemoryReport& report)
+{
+	size_t bytes = 0;
+	for (dnscache::const_iterator i = this->cache->begin(); i != this->cache->end(); ++i)
+		bytes += sizeof(dnscache::value_type) + i->first.length() + i->second.data.length();
+	report.Add("DNS cache", this->cache->size(), bytes);
+}
+
 void DNS::Rehash()
 {
 	if (this->GetFd() > -1)
@@ -648,6 +658,7 @@ DNSResult DNS::GetResult()
 	 */
 	DNSInfo data = req->ResultIsReady(header, length);
 	std::string resultstr;
+	latency.Add(LoopTimings::Now() - req->started);
 
 	/* Check if we got a result, if we didnt, its an error */
 	if (data.first == NULL)
@@ -25,6 +25,9 @@
 #include "inspircd.h"
 #include "hashcomp.h"
 #include "hash_map.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /******************************************************
  *
@@ -109,6 +112,111 @@ unsigned const char rfc_case_sensitive_map[256] = {
         241, 242, 243, 244, 245, 246, 247, 248, 249, 250, 251, 252, 253, 254, 255
 };
 
+/* The two built in case maps only fold a run of ASCII upper case letters onto
+ * the same run 0x20 higher: 'A'-'Z' for ASCII, and 'A'-']' for RFC 1459. When
+ * one of them is in use, strings are folded and compared a word (SWAR) or a
+ * vector (SSE2) at a time. Other maps, such as those built by m_nationalchars,
+ * take the byte by byte path through the table. Both paths fold identically,
+ * so hashes do not change when a module swaps in a copy of a built in map.
+ */
+static inline unsigned char FoldHighest(const unsigned char* map)
+{
+	if (map == rfc_case_insensitive_map)
+		return ']';
+	if (map == ascii_case_insensitive_map)
+		return 'Z';
+	return 0;
+}
+
+static const uint64_t SWAR_ONES = (((uint64_t)0x01010101 << 32) | 0x01010101);
+static const uint64_t SWAR_HIGH = (((uint64_t)0x80808080 << 32) | 0x80808080);
+
+/** Fold eight bytes at once, setting 0x20 on every byte between 'A' and highest */
+static inline uint64_t FoldWord(uint64_t w, unsigned char highest)
+{
+	uint64_t low7 = w & ~SWAR_HIGH;
+	uint64_t atleast = low7 + SWAR_ONES * (0x80 - 'A');
+	uint64_t above = low7 + SWAR_ONES * (0x7F - highest);
+	return w | ((atleast & ~above & ~w & SWAR_HIGH) >> 2);
+}
+
+/** Load up to eight bytes, zero padded */
+static inline uint64_t LoadWord(const char* str, size_t len)
+{
+	uint64_t w = 0;
+	memcpy(&w, str, len < 8 ? len : 8);
+	return w;
+}
+
+#ifdef __SSE2__
+static inline __m128i FoldVector(__m128i v, unsigned char highest)
+{
+	/* Bytes above 0x7F are negative to the signed compares, and never fold */
+	__m128i inrange = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8(highest + 1)));
+	return _mm_or_si128(v, _mm_and_si128(inrange, _mm_set1_epi8(0x20)));
+}
+#endif
+
+size_t irc::CaseFoldHash(const char* str, size_t len)
+{
+	/* Multiply-xorshift mixing of the folded string, eight bytes at a time */
+	const uint64_t mul = (((uint64_t)0x9E3779B9 << 32) | 0x7F4A7C15);
+	uint64_t h = (((uint64_t)0xA0761D64 << 32) | 0x78BD642F) ^ (len * mul);
+	unsigned char highest = FoldHighest(national_case_insensitive_map);
+
+	for (; len; str += 8, len -= (len < 8 ? len : 8))
+	{
+		uint64_t w;
+		if (highest)
+		{
+			w = FoldWord(LoadWord(str, len), highest);
+		}
+		else
+		{
+			unsigned char folded[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+			for (size_t i = 0; i < 8 && i < len; i++)
+				folded[i] = national_case_insensitive_map[(unsigned char)str[i]];
+			memcpy(&w, folded, 8);
+		}
+		h = (h ^ w) * mul;
+		h ^= h >> 29;
+	}
+
+	h ^= h >> 32;
+	h *= (((uint64_t)0xE7037ED1 << 32) | 0xA0B428DB);
+	h ^= h >> 29;
+	return (size_t)h;
+}
+
+bool irc::CaseFoldEqual(const char* s1, const char* s2, size_t len)
+{
+	unsigned char highest = FoldHighest(national_case_insensitive_map);
+	if (!highest)
+	{
+		for (size_t i = 0; i < len; i++)
+			if (national_case_insensitive_map[(unsigned char)s1[i]] != national_case_insensitive_map[(unsigned char)s2[i]])
+				return false;
+		return true;
+	}
+
+#ifdef __SSE2__
+	for (; len >= 16; s1 += 16, s2 += 16, len -= 16)
+	{
+		__m128i v1 = FoldVector(_mm_loadu_si128((const __m128i*)s1), highest);
+		__m128i v2 = FoldVector(_mm_loadu_si128((const __m128i*)s2), highest);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(v1, v2)) != 0xFFFF)
+			return false;
+	}
+#endif
+
+	for (; len; s1 += 8, s2 += 8, len -= (len < 8 ? len : 8))
+	{
+		if (FoldWord(LoadWord(s1, len), highest) != FoldWord(LoadWord(s2, len), highest))
+			return false;
+	}
+	return true;
+}
+
 /* convert a string to lowercase. Note following special circumstances
  * taken from RFC 1459. Many "official" server branches still hold to this
  * rule so i will too;
@@ -120,11 +228,20 @@ unsigned const char rfc_case_sensitive_map[256] = {
  */
 void nspace::strlower(char *n)
 {
-	if (n)
+	if (!n)
+		return;
+
+	char* t = n;
+#ifdef __SSE2__
+	unsigned char highest = FoldHighest(national_case_insensitive_map);
+	if (highest)
 	{
-		for (char* t = n; *t; t++)
-			*t = national_case_insensitive_map[(unsigned char)*t];
+		for (size_t len = strlen(n); len >= 16; t += 16, len -= 16)
+			_mm_storeu_si128((__m128i*)t, FoldVector(_mm_loadu_si128((const __m128i*)t), highest));
 	}
+#endif
+	for (; *t; t++)
+		*t = national_case_insensitive_map[(unsigned char)*t];
 }
 
 #ifdef HASHMAP_DEPRECATED
@@ -132,37 +249,19 @@ void nspace::strlower(char *n)
 #else
 	size_t nspace::hash<std::string>::operator()(const std::string &s) const
 #endif
-
 {
-	/* XXX: NO DATA COPIES! :)
-	 * The hash function here is practically
-	 * a copy of the one in STL's hash_fun.h,
-	 * only with *x replaced with national_case_insensitive_map[*x].
-	 * This avoids a copy to use hash<const char*>
-	 */
-	register size_t t = 0;
-	for (std::string::const_iterator x = s.begin(); x != s.end(); ++x) /* ++x not x++, as its faster */
-		t = 5 * t + national_case_insensitive_map[(unsigned char)*x];
-	return t;
+	return irc::CaseFoldHash(s.data(), s.length());
 }
 
 
 size_t CoreExport irc::hash::operator()(const irc::string &s) const
 {
-	register size_t t = 0;
-	for (irc::string::const_iterator x = s.begin(); x != s.end(); ++x) /* ++x not x++, as its faster */
-		t = 5 * t + national_case_insensitive_map[(unsigned char)*x];
-	return t;
+	return irc::CaseFoldHash(s.data(), s.length());
 }
 
 bool irc::StrHashComp::operator()(const std::string& s1, const std::string& s2) const
 {
-	const unsigned char* n1 = (const unsigned char*)s1.c_str();
-	const unsigned char* n2 = (const unsigned char*)s2.c_str();
-	for (; *n1 && *n2; n1++, n2++)
-		if (national_case_insensitive_map[*n1] != national_case_insensitive_map[*n2])
-			return false;
-	return (national_case_insensitive_map[*n1] == national_case_insensitive_map[*n2]);
+	return (s1.length() == s2.length()) && irc::CaseFoldEqual(s1.data(), s2.data(), s1.length());
 }
 
 /******************************************************
@@ -193,6 +292,18 @@ bool irc::irc_char_traits::lt(char c1st, char c2nd)
 
 int irc::irc_char_traits::compare(const char* str1, const char* str2, size_t n)
 {
+	/* Skip over equal words without NULs, then find the difference byte by byte */
+	unsigned char highest = FoldHighest(national_case_insensitive_map);
+	if (highest)
+	{
+		for (; n >= 8; str1 += 8, str2 += 8, n -= 8)
+		{
+			uint64_t w1 = LoadWord(str1, 8);
+			if (((w1 - SWAR_ONES) & ~w1 & SWAR_HIGH) || (FoldWord(w1, highest) != FoldWord(LoadWord(str2, 8), highest)))
+				break;
+		}
+	}
+
 	for(unsigned int i = 0; i < n; i++)
 	{
 		if(national_case_insensitive_map[(unsigned char)*str1] > national_case_insensitive_map[(unsigned char)*str2])
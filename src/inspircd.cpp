@@ -118,8 +118,8 @@ void InspIRCd::Cleanup()
 	ports.clear();
 
 	/* Close all client sockets, or the new process inherits them */
-	LocalUserList::reverse_iterator i = Users->local_users.rbegin();
-	while (i != this->Users->local_users.rend())
+	LocalUserList::iterator i = Users->local_users.begin();
+	while (i != this->Users->local_users.end())
 	{
 		User* u = *i++;
 		Users->QuitUser(u, "Server shutdown");
@@ -216,13 +216,8 @@ void InspIRCd::RehashUsersAndChans()
 		chanlist->insert(*n);
 	delete old_chans;
 
-	// Reset the already_sent IDs so we don't wrap it around and drop a message
-	LocalUser::already_sent_id = 0;
 	for (LocalUserList::const_iterator i = Users->local_users.begin(); i != Users->local_users.end(); i++)
-	{
-		(**i).already_sent = 0;
 		(**i).RemoveExpiredInvites();
-	}
 }
 
 void InspIRCd::SetSignals()
@@ -751,6 +746,7 @@ void InspIRCd::UpdateTime()
 		TIME.tv_nsec = tv.tv_usec * 1000;
 	#endif
 #endif
+	LoopTimes.wake = LoopTimings::Now();
 }
 
 int InspIRCd::Run()
@@ -786,6 +782,7 @@ int InspIRCd::Run()
 		}
 
 		UpdateTime();
+		LoopTimings::tracing = (Config->SlowLoop != 0);
 
 		/* Run background module timers every few seconds
 		 * (the docs say modules shouldnt rely on accurate
@@ -823,6 +820,7 @@ int InspIRCd::Run()
 
 			OLDTIME = TIME.tv_sec;
 
+			uint64_t started = LoopTimings::Now();
 			if ((TIME.tv_sec % 3600) == 0)
 			{
 				this->RehashUsersAndChans();
@@ -830,6 +828,9 @@ int InspIRCd::Run()
 			}
 
 			Timers->TickTimers(TIME.tv_sec);
+			uint64_t ticked = LoopTimings::Now();
+			LoopTimes.Record(LoopTimings::PHASE_TIMERS, ticked - started);
+
 			this->DoBackgroundUserStuff();
 
 			if ((TIME.tv_sec % 5) == 0)
@@ -837,6 +838,7 @@ int InspIRCd::Run()
 				FOREACH_MOD(I_OnBackgroundTimer,OnBackgroundTimer(TIME.tv_sec));
 				SNO->FlushSnotices();
 			}
+			LoopTimes.Record(LoopTimings::PHASE_BACKGROUND, LoopTimings::Now() - ticked);
 		}
 
 		/* Call the socket engine to wait on the active
@@ -846,12 +848,23 @@ int InspIRCd::Run()
 		 * This will cause any read or write events to be
 		 * dispatched to their handlers.
 		 */
+		uint64_t writing = LoopTimings::Now();
 		this->SE->DispatchTrialWrites();
+		uint64_t waiting = LoopTimings::Now();
 		this->SE->DispatchEvents();
 
+		/* UpdateTime is called when the socket engine stops waiting, so the wait is not counted */
+		uint64_t dispatched = LoopTimings::Now();
+		LoopTimes.Record(LoopTimings::PHASE_EVENTS, (waiting - writing) + (dispatched - LoopTimes.wake));
+
 		/* if any users were quit, take them out */
-		GlobalCulls.Apply();
+		GlobalCulls.Apply(Config->MaxCull);
 		AtomicActions.Run();
+		LoopTimes.Record(LoopTimings::PHASE_CULL, LoopTimings::Now() - dispatched);
+		LoopTimes.EndIteration(Config->SlowLoop);
+
+		/* Don't wait for events if there are objects left to cull */
+		SE->DispatchTimeout = GlobalCulls.Pending() ? 0 : 1000;
 
 		if (s_signal)
 		{
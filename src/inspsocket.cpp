@@ -23,6 +23,7 @@
 
 
 #include "inspircd.h"
+#include <typeinfo>
 #include "socket.h"
 #include "inspstring.h"
 #include "socketengine.h"
@@ -487,6 +488,7 @@ void StreamSocket::HandleEvent(EventType et, int errornum)
 {
 	if (!error.empty())
 		return;
+	TraceTimer trace(LoopTimings::TRACE_SOCKET, typeid(*this).name());
 	BufferedSocketError errcode = I_ERR_OTHER;
 	try {
 		switch (et)
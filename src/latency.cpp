@@ -0,0 +1,246 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+#include <new>
+
+const char* const LoopTimings::PhaseNames[LoopTimings::PHASE_COUNT] = { "events", "timers", "background", "cull", "iteration" };
+const char* const LoopTimings::TraceNames[LoopTimings::TRACE_COUNT] = { "socket", "command", "hook", "timer" };
+bool LoopTimings::tracing = false;
+bool LoopTimings::timehooks = false;
+#ifdef _WIN32
+unsigned long HeapAllocations = 0;
+#else
+__thread unsigned long HeapAllocations = 0;
+#endif
+
+#if defined COUNT_ALLOCATIONS && !defined _WIN32
+/* Replace the global operator new so that allocations can be counted; modules use
+ * these too, as they are resolved from the executable. Each thread only touches its
+ * own count, so no locking is needed.
+ */
+#if __cplusplus >= 201103L
+# define NEW_THROWS
+# define DELETE_THROWS noexcept
+#else
+# define NEW_THROWS throw (std::bad_alloc)
+# define DELETE_THROWS throw ()
+#endif
+
+static void* Allocate(size_t size)
+{
+	HeapAllocations++;
+	if (!size)
+		size = 1;
+
+	/* As the standard operator new does, call the new handler until it frees enough memory or gives up */
+	for (;;)
+	{
+		void* ptr = malloc(size);
+		if (ptr)
+			return ptr;
+
+#if __cplusplus >= 201103L
+		std::new_handler handler = std::get_new_handler();
+#else
+		std::new_handler handler = std::set_new_handler(NULL);
+		std::set_new_handler(handler);
+#endif
+		if (!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+}
+
+void* operator new(size_t size) NEW_THROWS
+{
+	return Allocate(size);
+}
+
+void* operator new[](size_t size) NEW_THROWS
+{
+	return Allocate(size);
+}
+
+void operator delete(void* ptr) DELETE_THROWS
+{
+	free(ptr);
+}
+
+void operator delete[](void* ptr) DELETE_THROWS
+{
+	free(ptr);
+}
+#endif
+
+unsigned int LatencyHistogram::Bucket(uint64_t usecs)
+{
+	/* the first four values each have their own bucket */
+	if (usecs < 4)
+		return usecs;
+
+	unsigned int bit = 2;
+	while (bit < 63 && (usecs >> (bit + 1)))
+		bit++;
+
+	unsigned int bucket = (bit - 1) * 4 + ((usecs >> (bit - 2)) & 3);
+	return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+uint64_t LatencyHistogram::BucketLimit(unsigned int bucket)
+{
+	if (bucket < 4)
+		return bucket;
+
+	unsigned int bit = bucket / 4 + 1;
+	uint64_t width = (uint64_t)1 << (bit - 2);
+	return (4 + bucket % 4) * width + width - 1;
+}
+
+void LatencyHistogram::Add(uint64_t usecs)
+{
+	buckets[Bucket(usecs)]++;
+	count++;
+	total += usecs;
+	if (usecs > max)
+		max = usecs;
+}
+
+void LatencyHistogram::Clear()
+{
+	memset(buckets, 0, sizeof(buckets));
+	count = 0;
+	total = 0;
+	max = 0;
+}
+
+uint64_t LatencyHistogram::Percentile(double pct) const
+{
+	if (!count)
+		return 0;
+
+	unsigned long wanted = (unsigned long)ceil(count * pct / 100);
+	if (wanted < 1)
+		wanted = 1;
+
+	unsigned long seen = 0;
+	for (unsigned int i = 0; i < BUCKETS; i++)
+	{
+		seen += buckets[i];
+		if (seen >= wanted)
+			return std::min(BucketLimit(i), max);
+	}
+	return max;
+}
+
+std::string LatencyHistogram::Summary() const
+{
+	return ConvToStr(count) + " times, mean " + ConvToStr(count ? total / count : 0) + "us, median " + ConvToStr(Percentile(50)) +
+		"us, 90% " + ConvToStr(Percentile(90)) + "us, 99% " + ConvToStr(Percentile(99)) + "us, max " + ConvToStr(max) + "us";
+}
+
+LoopTimings::LoopTimings() : slow(0), wake(0)
+{
+	for (int i = 0; i < PHASE_COUNT; i++)
+		current[i] = 0;
+	for (int i = 0; i < TRACE_COUNT; i++)
+		slowest[i].usecs = 0;
+}
+
+void LoopTimings::Note(TraceKind kind, uint64_t usecs, const char* name, const std::string& detail)
+{
+	Slowest& s = slowest[kind];
+	if (!s.name.empty() && usecs <= s.usecs)
+		return;
+	s.usecs = usecs;
+	s.name = name;
+	s.detail = detail;
+}
+
+void LoopTimings::EndIteration(unsigned int limit)
+{
+	uint64_t busy = 0;
+	for (int i = 0; i < PHASE_ITERATION; i++)
+		busy += current[i];
+	phases[PHASE_ITERATION].Add(busy);
+
+	if (limit && busy >= (uint64_t)limit * 1000)
+	{
+		slow++;
+		std::string line = "Slow main loop iteration took " + ConvToStr(busy / 1000) + "ms:";
+		for (int i = 0; i < PHASE_ITERATION; i++)
+			line.append(" ").append(PhaseNames[i]).append(" ").append(ConvToStr(current[i] / 1000)).append("ms");
+
+		for (int i = 0; i < TRACE_COUNT; i++)
+		{
+			if (slowest[i].name.empty())
+				continue;
+			line.append(", slowest ").append(TraceNames[i]).append(" ").append(slowest[i].name);
+			if (!slowest[i].detail.empty())
+				line.append(" (").append(slowest[i].detail).append(")");
+			line.append(" ").append(ConvToStr(slowest[i].usecs / 1000)).append("ms");
+		}
+		ServerInstance->Logs->Log("PERFORMANCE", DEFAULT, "%s", line.c_str());
+	}
+
+	for (int i = 0; i < PHASE_COUNT; i++)
+		current[i] = 0;
+	for (int i = 0; i < TRACE_COUNT; i++)
+	{
+		slowest[i].usecs = 0;
+		slowest[i].name.clear();
+	}
+}
+
+uint64_t LoopTimings::Now()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	if (!frequency.QuadPart)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (counter.QuadPart / frequency.QuadPart) * 1000000 + (counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+#else
+	#ifdef HAS_CLOCK_GETTIME
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	#else
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	#endif
+#endif
+}
+
+void TraceTimer::Finish()
+{
+	uint64_t usecs = LoopTimings::Now() - start;
+	if (module && LoopTimings::timehooks)
+	{
+		module->hook_usecs += usecs;
+		module->hook_calls++;
+	}
+
+	if (!LoopTimings::tracing)
+		return;
+	if (module)
+		ServerInstance->LoopTimes.Note(kind, usecs, name, module->ModuleSourceFile);
+	else
+		ServerInstance->LoopTimes.Note(kind, usecs, name, detail ? *detail : "");
+}
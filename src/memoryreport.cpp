@@ -0,0 +1,162 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+#include "xline.h"
+#include "inspsocket.h"
+
+/** Estimated bookkeeping cost of one node of a map, set or hash map, on top of the key and value */
+static const size_t NodeOverhead = 4 * sizeof(void*);
+
+namespace {
+	/** Counts and sizes of the values of every extension item, by slot */
+	struct ExtensionTotals
+	{
+		std::vector<size_t> count;
+		std::vector<size_t> bytes;
+
+		void Add(const Extensible* ext)
+		{
+			const Extensible::ExtensibleStore& list = ext->GetExtList();
+			if (list.size() > count.size())
+			{
+				count.resize(list.size());
+				bytes.resize(list.size());
+			}
+			for (unsigned int slot = 0; slot < list.size(); slot++)
+			{
+				ExtensionItem* item = ExtensionItem::FromSlot(slot);
+				if (!item || !list[slot])
+					continue;
+				count[slot]++;
+				bytes[slot] += item->GetSize(list[slot]);
+			}
+		}
+	};
+
+	size_t UserBytes(User* u)
+	{
+		size_t bytes = (IS_LOCAL(u) ? sizeof(LocalUser) : sizeof(RemoteUser)) + u->GetExtList().size() * sizeof(void*);
+		bytes += u->nick.length() + u->uuid.length() + u->ident.length() + u->host.length() + u->dhost.length();
+		bytes += u->fullname.length() + u->server.length() + u->awaymsg.length();
+		/* Entries in the nick and UUID hashes */
+		bytes += 2 * NodeOverhead + u->nick.length() + u->uuid.length();
+		return bytes;
+	}
+}
+
+void MemoryReport::Add(const std::string& name, size_t count, size_t bytes)
+{
+	Entry entry;
+	entry.name = name;
+	entry.count = count;
+	entry.bytes = bytes;
+	entries.push_back(entry);
+}
+
+size_t MemoryReport::Total() const
+{
+	size_t total = 0;
+	for (std::vector<Entry>::const_iterator i = entries.begin(); i != entries.end(); ++i)
+		total += i->bytes;
+	return total;
+}
+
+void MemoryReport::Collect()
+{
+	ExtensionTotals ext;
+
+	size_t userbytes = 0;
+	for (user_hash::const_iterator i = ServerInstance->Users->clientlist->begin(); i != ServerInstance->Users->clientlist->end(); ++i)
+	{
+		userbytes += UserBytes(i->second);
+		ext.Add(i->second);
+	}
+	Add("Users", ServerInstance->Users->clientlist->size(), userbytes);
+
+	size_t chanbytes = 0;
+	size_t members = 0;
+	size_t memberbytes = 0;
+	size_t bans = 0;
+	size_t banbytes = 0;
+	for (chan_hash::const_iterator i = ServerInstance->chanlist->begin(); i != ServerInstance->chanlist->end(); ++i)
+	{
+		Channel* c = i->second;
+		chanbytes += sizeof(Channel) + c->GetExtList().size() * sizeof(void*) + NodeOverhead;
+		chanbytes += 2 * c->name.length() + c->topic.length() + c->setby.length();
+		ext.Add(c);
+
+		for (BanList::const_iterator b = c->bans.begin(); b != c->bans.end(); ++b)
+			banbytes += sizeof(BanItem) + b->set_by.length() + b->data.length();
+		bans += c->bans.size();
+
+		const UserMembList* ulist = c->GetUsers();
+		for (UserMembCIter m = ulist->begin(); m != ulist->end(); ++m)
+		{
+			/* One node in the channel's member list and one in the user's channel list */
+			memberbytes += sizeof(Membership) + m->second->GetExtList().size() * sizeof(void*) + 2 * NodeOverhead;
+			memberbytes += m->second->modes.length();
+			ext.Add(m->second);
+		}
+		members += ulist->size();
+	}
+	Add("Channels", ServerInstance->chanlist->size(), chanbytes);
+	Add("Memberships", members, memberbytes);
+	Add("Channel bans", bans, banbytes);
+
+	size_t sockets = 0;
+	size_t sendq = 0;
+	size_t recvq = 0;
+	for (int fd = 0; fd < ServerInstance->SE->GetMaxFds(); fd++)
+	{
+		StreamSocket* sock = dynamic_cast<StreamSocket*>(ServerInstance->SE->GetRef(fd));
+		if (!sock)
+			continue;
+		sockets++;
+		sendq += sock->getSendQSize();
+		recvq += sock->getRecvQSize();
+	}
+	Add("Send queues", sockets, sendq);
+	Add("Receive queues", sockets, recvq);
+
+	for (unsigned int slot = 0; slot < ext.count.size(); slot++)
+	{
+		ExtensionItem* item = ExtensionItem::FromSlot(slot);
+		if (item && ext.count[slot])
+			Add("Extension " + item->name, ext.count[slot], ext.bytes[slot]);
+	}
+
+	std::vector<std::string> xltypes = ServerInstance->XLines->GetAllTypes();
+	for (std::vector<std::string>::iterator t = xltypes.begin(); t != xltypes.end(); ++t)
+	{
+		XLineLookup* lookup = ServerInstance->XLines->GetAll(*t);
+		if (!lookup || lookup->empty())
+			continue;
+		size_t bytes = 0;
+		for (LookupIter i = lookup->begin(); i != lookup->end(); ++i)
+		{
+			XLine* x = i->second;
+			bytes += sizeof(XLine) + NodeOverhead + i->first.length() + strlen(x->Displayable());
+			bytes += x->source.length() + x->reason.length();
+		}
+		Add(*t + "-lines", lookup->size(), bytes);
+	}
+
+	ServerInstance->Res->GetMemory(*this);
+
+	FOREACH_MOD(I_OnMemoryReport, OnMemoryReport(*this));
+}
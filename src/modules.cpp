@@ -76,7 +76,7 @@ void Event::Send()
 
 // These declarations define the behavours of the base class Module (which does nothing at all)
 
-Module::Module() { }
+Module::Module() : hook_usecs(0), hook_calls(0) { }
 CullResult Module::cull()
 {
 	return classbase::cull();
@@ -94,6 +94,7 @@ void		Module::OnPostJoin(Membership*) { }
 void		Module::OnUserPart(Membership*, std::string&, CUList&) { }
 void		Module::OnPreRehash(User*, const std::string&) { }
 void		Module::OnModuleRehash(User*, const std::string&) { }
+void		Module::OnPrepareConfig(std::vector<ConfigPrepareJob*>&) { }
 void		Module::OnRehash(User*) { }
 ModResult	Module::OnUserPreJoin(User*, Channel*, const char*, std::string&, const std::string&) { return MOD_RES_PASSTHRU; }
 void		Module::OnMode(User*, void*, int, const std::vector<std::string>&, const std::vector<TranslateType>&) { }
@@ -169,9 +170,12 @@ ModResult	Module::OnWhoisLine(User*, User*, int&, std::string&) { return MOD_RES
 void		Module::OnBuildNeighborList(User*, UserChanList&, std::map<User*,bool>&) { }
 void		Module::OnGarbageCollect() { }
 ModResult	Module::OnSetConnectClass(LocalUser* user, ConnectClass* myclass) { return MOD_RES_PASSTHRU; }
+void		Module::OnBufferFlushed(LocalUser*) { }
 void 		Module::OnText(User*, void*, int, const std::string&, char, CUList&) { }
 void		Module::OnRunTestSuite() { }
 void		Module::OnNamesListItem(User*, Membership*, std::string&, std::string&) { }
+ModResult	Module::OnNamesListCache(User*, Channel*, unsigned int&) { return MOD_RES_PASSTHRU; }
+void		Module::OnMemoryReport(MemoryReport&) { }
 ModResult	Module::OnNumeric(User*, unsigned int, const std::string&) { return MOD_RES_PASSTHRU; }
 void		Module::OnHookIO(StreamSocket*, ListenSocket*) { }
 ModResult   Module::OnAcceptConnection(int, ListenSocket*, irc::sockets::sockaddrs*, irc::sockets::sockaddrs*) { return MOD_RES_PASSTHRU; }
@@ -340,6 +344,12 @@ bool ModuleManager::CanUnload(Module* mod)
 		ServerInstance->Logs->Log("MODULE", DEFAULT, LastModuleError);
 		return false;
 	}
+	if (ServerInstance->ConfigThread && ServerInstance->ConfigThread->IsPreparing())
+	{
+		LastModuleError = "Module " + mod->ModuleSourceFile + " cannot be unloaded while a rehash is in progress, try again shortly";
+		ServerInstance->Logs->Log("MODULE", DEFAULT, LastModuleError);
+		return false;
+	}
 
 	mod->dying = true;
 	return true;
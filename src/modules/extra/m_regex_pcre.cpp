@@ -52,10 +52,7 @@ public:
 		int erroffset;
 		regex = pcre_compile(rx.c_str(), 0, &error, &erroffset, NULL);
 		if (!regex)
-		{
-			ServerInstance->Logs->Log("REGEX", DEBUG, "pcre_compile failed: /%s/ [%d] %s", rx.c_str(), erroffset, error);
 			throw PCREException(rx, error, erroffset);
-		}
 	}
 
 	virtual ~PCRERegex()
@@ -79,6 +76,20 @@ class PCREFactory : public RegexFactory
  public:
 	PCREFactory(Module* m) : RegexFactory(m, "regex/pcre") {}
 	Regex* Create(const std::string& expr)
+	{
+		try
+		{
+			return new PCRERegex(expr);
+		}
+		catch (PCREException& e)
+		{
+			ServerInstance->Logs->Log("REGEX", DEBUG, "pcre_compile failed: %s", e.GetReason());
+			throw;
+		}
+	}
+
+	/* pcre_compile() is thread safe and the exception carries the error */
+	Regex* CreateThreaded(const std::string& expr)
 	{
 		return new PCRERegex(expr);
 	}
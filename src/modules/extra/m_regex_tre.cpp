@@ -87,6 +87,11 @@ class TREFactory : public RegexFactory {
 	{
 		return new TRERegex(expr);
 	}
+
+	Regex* CreateThreaded(const std::string& expr)
+	{
+		return new TRERegex(expr);
+	}
 };
 
 class ModuleRegexTRE : public Module
@@ -28,22 +28,65 @@
 
 #include <string>
 #include <sstream>
-#include <map>
+#include <vector>
 
-/** A modifyable list of HTTP header fields
+/** A modifyable list of HTTP header fields. Field names are matched without regard to case.
  */
 class HTTPHeaders
 {
  protected:
-	std::map<std::string,std::string> headers;
+	typedef std::vector<std::pair<std::string, std::string> > FieldList;
+
+	/** The fields, in the order they were set. Only the first count are in use; the
+	 * rest are kept after Clear() so that later requests can reuse their buffers.
+	 */
+	FieldList fields;
+	size_t count;
+
+	/** Find a field by name
+	 * @return The index of the field, or count if it is not set
+	 */
+	size_t Find(const char* name, size_t len) const
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			const std::string& field = fields[i].first;
+			if (field.length() != len)
+				continue;
+			size_t j = 0;
+			while (j < len && tolower((unsigned char)field[j]) == tolower((unsigned char)name[j]))
+				j++;
+			if (j == len)
+				return i;
+		}
+		return count;
+	}
+
  public:
+	HTTPHeaders() : count(0) { }
+
+	/** Set the value of a header from unterminated strings, such as parts of a request buffer
+	 * Sets the value of the named header. If the header is already present, it will be replaced
+	 */
+	void SetHeader(const char* name, size_t namelen, const char* data, size_t datalen)
+	{
+		size_t i = Find(name, namelen);
+		if (i == count)
+		{
+			if (count == fields.size())
+				fields.resize(count + 1);
+			fields[i].first.assign(name, namelen);
+			count++;
+		}
+		fields[i].second.assign(data, datalen);
+	}
 
 	/** Set the value of a header
 	 * Sets the value of the named header. If the header is already present, it will be replaced
 	 */
 	void SetHeader(const std::string &name, const std::string &data)
 	{
-		headers[name] = data;
+		SetHeader(name.data(), name.length(), data.data(), data.length());
 	}
 
 	/** Set the value of a header, only if it doesn't exist already
@@ -59,14 +102,23 @@ class HTTPHeaders
 	 */
 	void RemoveHeader(const std::string &name)
 	{
-		headers.erase(name);
+		size_t i = Find(name.data(), name.length());
+		if (i == count)
+			return;
+
+		// Keep the order of the remaining fields, and the removed slot for reuse
+		for (count--; i < count; i++)
+		{
+			fields[i].first.swap(fields[i + 1].first);
+			fields[i].second.swap(fields[i + 1].second);
+		}
 	}
 
 	/** Remove all headers
 	 */
 	void Clear()
 	{
-		headers.clear();
+		count = 0;
 	}
 
 	/** Get the value of a header
@@ -74,11 +126,11 @@ class HTTPHeaders
 	 */
 	std::string GetHeader(const std::string &name)
 	{
-		std::map<std::string,std::string>::iterator it = headers.find(name);
-		if (it == headers.end())
+		size_t i = Find(name.data(), name.length());
+		if (i == count)
 			return std::string();
 
-		return it->second;
+		return fields[i].second;
 	}
 
 	/** Check if the given header is specified
@@ -86,8 +138,7 @@ class HTTPHeaders
 	 */
 	bool IsSet(const std::string &name)
 	{
-		std::map<std::string,std::string>::iterator it = headers.find(name);
-		return (it != headers.end());
+		return (Find(name.data(), name.length()) != count);
 	}
 
 	/** Get all headers, formatted by the HTTP protocol
@@ -97,8 +148,8 @@ class HTTPHeaders
 	{
 		std::string re;
 
-		for (std::map<std::string,std::string>::iterator i = headers.begin(); i != headers.end(); i++)
-			re += i->first + ": " + i->second + "\r\n";
+		for (size_t i = 0; i < count; i++)
+			re.append(fields[i].first).append(": ").append(fields[i].second).append("\r\n");
 
 		return re;
 	}
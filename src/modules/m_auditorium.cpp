@@ -61,7 +61,7 @@ class ModuleAuditorium : public Module
 
 		Implementation eventlist[] = {
 			I_OnUserJoin, I_OnUserPart, I_OnUserKick,
-			I_OnBuildNeighborList, I_OnNamesListItem, I_OnSendWhoLine,
+			I_OnBuildNeighborList, I_OnNamesListItem, I_OnNamesListCache, I_OnSendWhoLine,
 			I_OnRehash };
 		ServerInstance->Modules->Attach(eventlist, this, sizeof(eventlist)/sizeof(Implementation));
 	}
@@ -127,6 +127,14 @@ class ModuleAuditorium : public Module
 		nick.clear();
 	}
 
+	ModResult OnNamesListCache(User* issuer, Channel* chan, unsigned int& format)
+	{
+		// Members of an auditorium are filtered one by one
+		if (chan->IsModeSet(&aum))
+			return MOD_RES_DENY;
+		return MOD_RES_PASSTHRU;
+	}
+
 	/** Build CUList for showing this join/part/kick */
 	void BuildExcept(Membership* memb, CUList& excepts)
 	{
@@ -42,11 +42,35 @@ class CapEvent : public Event
 class GenericCap
 {
  public:
-	LocalIntExt ext;
+	/** The bit for this capability in LocalUser::caps
+	 */
+	const CapMask bit;
 	const std::string cap;
-	GenericCap(Module* parent, const std::string &Cap) : ext("cap_" + Cap, parent), cap(Cap)
+	GenericCap(Module* parent, const std::string &Cap) : bit(ServerInstance->Users->Caps.Register(Cap)), cap(Cap)
 	{
-		ServerInstance->Modules->AddService(ext);
+	}
+
+	~GenericCap()
+	{
+		ServerInstance->Users->Caps.Unregister(bit);
+	}
+
+	/** Check if a user has enabled this capability; remote users never have */
+	bool get(User* user) const
+	{
+		LocalUser* localuser = IS_LOCAL(user);
+		return (localuser && (localuser->caps & bit));
+	}
+
+	void set(User* user, bool enable)
+	{
+		LocalUser* localuser = IS_LOCAL(user);
+		if (!localuser)
+			return;
+		if (enable)
+			localuser->caps |= bit;
+		else
+			localuser->caps &= ~bit;
 	}
 
 	void HandleEvent(Event& ev)
@@ -67,7 +91,7 @@ class GenericCap
 					// we can handle this, so ACK it, and remove it from the wanted list
 					data->ack.push_back(*it);
 					data->wanted.erase(it);
-					ext.set(data->user, enablecap ? 1 : 0);
+					set(data->user, enablecap);
 					break;
 				}
 			}
@@ -78,13 +102,13 @@ class GenericCap
 		}
 		else if (data->type == CapEvent::CAPEVENT_LIST)
 		{
-			if (ext.get(data->user))
+			if (get(data->user))
 				data->wanted.push_back(cap);
 		}
 		else if (data->type == CapEvent::CAPEVENT_CLEAR)
 		{
 			data->ack.push_back("-" + cap);
-			ext.set(data->user, 0);
+			set(data->user, false);
 		}
 	}
 };
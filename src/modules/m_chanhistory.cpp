@@ -19,22 +19,535 @@
 
 #include "inspircd.h"
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
 /* $ModDesc: Provides channel history for a given number of lines */
 
-struct HistoryItem
+/** The history of one channel
+ */
+struct HistoryList
+{
+	unsigned int maxlen, maxtime;
+	HistoryList(unsigned int len, unsigned int time) : maxlen(len), maxtime(time) {}
+	virtual ~HistoryList() {}
+
+	/** Store a line sent to the channel */
+	virtual void Add(const std::string& line) = 0;
+	/** Change the number of lines kept */
+	virtual void Resize(unsigned int len) = 0;
+	/** Send the stored lines no older than mintime to a user, in one write */
+	virtual void Replay(LocalUser* user, time_t mintime) = 0;
+	/** Remove history kept outside of memory, called when the mode is unset or the channel is deleted */
+	virtual void Erase() {}
+};
+
+struct HistoryRing;
+
+/** One stored line. Lines belong to the ring of the channel they were sent to,
+ * and are also linked into a list of every stored line, oldest first, which
+ * is used to enforce the memory limit across all channels.
+ */
+struct HistoryLine : public refcountbase
 {
 	time_t ts;
 	std::string line;
-	HistoryItem(const std::string& Line) : ts(ServerInstance->Time()), line(Line) {}
+	HistoryRing* owner;
+	HistoryLine* older;
+	HistoryLine* newer;
+	HistoryLine(const std::string& Line, HistoryRing* Owner)
+		: ts(ServerInstance->Time()), line(Line), owner(Owner), older(NULL), newer(NULL) {}
 };
 
-struct HistoryList
+/** Every line stored by the module, in the order they were added
+ */
+struct HistoryPool
 {
-	std::deque<HistoryItem> lines;
-	unsigned int maxlen, maxtime;
-	HistoryList(unsigned int len, unsigned int time) : maxlen(len), maxtime(time) {}
+	HistoryLine* oldest;
+	HistoryLine* newest;
+	/** Bytes used by stored lines and ring slots */
+	size_t memory;
+	size_t maxmemory;
+	/** Number of stored lines */
+	size_t lines;
+	HistoryPool() : oldest(NULL), newest(NULL), memory(0), maxmemory(0), lines(0) {}
+
+	void Link(HistoryLine* line)
+	{
+		line->older = newest;
+		line->newer = NULL;
+		if (newest)
+			newest->newer = line;
+		else
+			oldest = line;
+		newest = line;
+		memory += Bytes(line);
+		lines++;
+	}
+
+	void Unlink(HistoryLine* line)
+	{
+		if (line->older)
+			line->older->newer = line->newer;
+		else
+			oldest = line->newer;
+		if (line->newer)
+			line->newer->older = line->older;
+		else
+			newest = line->older;
+		memory -= Bytes(line);
+		lines--;
+	}
+
+	/** Drop the oldest lines, whichever channel they are in, until within the limit */
+	void Shrink();
+
+	static size_t Bytes(HistoryLine* line)
+	{
+		return sizeof(HistoryLine) + line->line.length();
+	}
+};
+
+/** History kept in memory, in a ring with room for exactly maxlen lines
+ */
+struct HistoryRing : public HistoryList
+{
+	typedef std::vector<reference<HistoryLine> > Ring;
+	HistoryPool& pool;
+	Ring ring;
+	/** Position of the oldest line in the ring */
+	unsigned int head;
+	/** Number of lines held */
+	unsigned int count;
+
+	HistoryRing(HistoryPool& Pool, unsigned int len, unsigned int time)
+		: HistoryList(len, time), pool(Pool), ring(len), head(0), count(0)
+	{
+		pool.memory += SlotBytes();
+	}
+
+	~HistoryRing()
+	{
+		while (count)
+			PopFront();
+		pool.memory -= SlotBytes();
+	}
+
+	size_t SlotBytes() const { return ring.size() * sizeof(Ring::value_type); }
+
+	/** Get a line by age, 0 being the oldest */
+	HistoryLine* at(unsigned int n) const { return ring[(head + n) % maxlen]; }
+
+	void PopFront()
+	{
+		reference<HistoryLine>& slot = ring[head];
+		pool.Unlink(slot);
+		slot = NULL;
+		head = (head + 1) % maxlen;
+		count--;
+	}
+
+	void Add(const std::string& text)
+	{
+		if (count == maxlen)
+			PopFront();
+		HistoryLine* line = new HistoryLine(text, this);
+		ring[(head + count) % maxlen] = line;
+		count++;
+		pool.Link(line);
+		pool.Shrink();
+	}
+
+	/** Change the capacity, keeping the newest lines that still fit */
+	void Resize(unsigned int len)
+	{
+		while (count > len)
+			PopFront();
+
+		Ring newring(len);
+		for (unsigned int i = 0; i < count; i++)
+			newring[i] = at(i);
+
+		pool.memory -= SlotBytes();
+		ring.swap(newring);
+		pool.memory += SlotBytes();
+		head = 0;
+		maxlen = len;
+	}
+
+	void Replay(LocalUser* user, time_t mintime)
+	{
+		// Skip lines that have expired, then send the rest in one buffer
+		unsigned int first = 0;
+		while (first < count && at(first)->ts < mintime)
+			first++;
+
+		size_t length = 0;
+		for (unsigned int i = first; i < count; i++)
+			length += at(i)->line.length() + 2;
+
+		std::string block;
+		block.reserve(length);
+		for (unsigned int i = first; i < count; i++)
+			block.append(at(i)->line).append("\r\n");
+
+		user->WriteBlock(block, count - first);
+	}
+};
+
+void HistoryPool::Shrink()
+{
+	while (oldest && memory > maxmemory)
+		oldest->owner->PopFront();
+}
+
+
+#ifndef _WIN32
+class HistoryLog;
+
+/** The on-disk logs which have their files open, most recently used first.
+ * Each open log holds four descriptors that the socket engine does not
+ * count, so only maxopen logs are kept open and the others are reopened
+ * when they are next written to or replayed.
+ */
+struct OpenLogs
+{
+	typedef std::list<HistoryLog*> List;
+	List logs;
+	/** Number of logs in the list */
+	unsigned int count;
+	unsigned int maxopen;
+	OpenLogs() : count(0), maxopen(100) {}
+
+	/** Mark a log as just used, closing the least recently used ones over the limit */
+	void Use(HistoryLog* log);
+	/** Forget a log which has been closed */
+	void Forget(HistoryLog* log);
+	/** Close logs until within the limit */
+	void Shrink();
+};
+
+/** History kept on disk, so that it survives a restart. Lines are appended
+ * to one of two segments, each a log of the raw lines and an index of their
+ * timestamps and end offsets. Once the current segment holds maxlen lines
+ * the other one is emptied and becomes current, so the files never hold
+ * much more than the lines that can be replayed. Replay sends the lines
+ * straight from the segments, which are mapped into memory.
+ *
+ * Writes are synchronous, so every line sent to the channel costs two
+ * write() calls on the main loop.
+ */
+class HistoryLog : public HistoryList
+{
+	struct IndexEntry
+	{
+		unsigned int ts;
+		unsigned int end;
+	};
+
+	struct Segment
+	{
+		std::string path;
+		int fd;
+		int idxfd;
+		std::vector<IndexEntry> index;
+		char* map;
+		size_t mapped;
+
+		Segment() : fd(-1), idxfd(-1), map(NULL), mapped(0) {}
+		~Segment() { Close(); }
+
+		size_t lines() const { return index.size(); }
+		size_t size() const { return index.empty() ? 0 : index.back().end; }
+		/** Offset of a line in the log */
+		size_t start(size_t n) const { return n ? index[n - 1].end : 0; }
+		time_t newest() const { return index.empty() ? 0 : index.back().ts; }
+
+		/** Open the files, keeping only complete lines which are no older than the channel
+		 * @param age The creation time of the channel; older lines are left from a previous
+		 * channel of the same name, whose history must not be shown to the new one
+		 */
+		bool Open(time_t age)
+		{
+			fd = open((path + ".log").c_str(), O_RDWR | O_CREAT | O_APPEND, 0600);
+			idxfd = open((path + ".idx").c_str(), O_RDWR | O_CREAT | O_APPEND, 0600);
+			if (fd < 0 || idxfd < 0)
+				return false;
+
+			struct stat logst, idxst;
+			if (fstat(fd, &logst) || fstat(idxfd, &idxst))
+				return false;
+
+			index.resize(idxst.st_size / sizeof(IndexEntry));
+			if (!index.empty() && pread(idxfd, &index[0], index.size() * sizeof(IndexEntry), 0) != (ssize_t)(index.size() * sizeof(IndexEntry)))
+				index.clear();
+
+			// Keep the entries that describe complete lines, and drop anything written after them
+			size_t valid = 0;
+			while (valid < index.size() && index[valid].end > start(valid) && index[valid].end <= (size_t)logst.st_size)
+				valid++;
+			index.resize(valid);
+			if (!index.empty() && (time_t)index[0].ts < age)
+				return Clear();
+			if ((size_t)idxst.st_size != valid * sizeof(IndexEntry) && ftruncate(idxfd, valid * sizeof(IndexEntry)))
+				return false;
+			if ((size_t)logst.st_size != size() && ftruncate(fd, size()))
+				return false;
+			return true;
+		}
+
+		void Unmap()
+		{
+			if (map)
+				munmap(map, mapped);
+			map = NULL;
+			mapped = 0;
+		}
+
+		void Close()
+		{
+			Unmap();
+			index.clear();
+			if (fd >= 0)
+				close(fd);
+			if (idxfd >= 0)
+				close(idxfd);
+			fd = idxfd = -1;
+		}
+
+		/** Empty the log and index. If this fails they may no longer match, and the segment must not be used. */
+		bool Clear()
+		{
+			Unmap();
+			index.clear();
+			return !ftruncate(fd, 0) && !ftruncate(idxfd, 0);
+		}
+
+		bool Append(const std::string& line, time_t ts)
+		{
+			std::string data = line + "\r\n";
+			IndexEntry entry;
+			entry.ts = ts;
+			entry.end = size() + data.length();
+			if (write(fd, data.data(), data.length()) != (ssize_t)data.length())
+				return false;
+			if (write(idxfd, &entry, sizeof(entry)) != sizeof(entry))
+				return false;
+			index.push_back(entry);
+			return true;
+		}
+
+		/** Get the contents of the log, mapping it if needed. The mapping is made
+		 * larger than the log, so it does not have to be redone for every line.
+		 */
+		const char* Map()
+		{
+			if (size() <= mapped)
+				return map;
+
+			Unmap();
+			size_t len = std::max<size_t>(size() * 2, 65536);
+			void* ptr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+			if (ptr == MAP_FAILED)
+				return NULL;
+			map = static_cast<char*>(ptr);
+			mapped = len;
+			return map;
+		}
+
+		void Unlink()
+		{
+			unlink((path + ".log").c_str());
+			unlink((path + ".idx").c_str());
+		}
+	};
+
+	OpenLogs& openlogs;
+	const time_t age;
+	Segment segs[2];
+	unsigned int current;
+	/** False once the files have failed, after which the history is not used */
+	bool ok;
+	/** True while the files are open */
+	bool isopen;
+
+	/** Stop using the files after an error which may have left a log and its index out of step */
+	void Fail(const char* what, const Segment& seg)
+	{
+		ServerInstance->Logs->Log("m_chanhistory", DEFAULT, "Cannot %s history %s: %s; history for this channel is disabled",
+			what, seg.path.c_str(), strerror(errno));
+		openlogs.Forget(this);
+		Close();
+		ok = false;
+	}
+
+	/** Open the files if they are not open already */
+	bool Load()
+	{
+		if (isopen)
+		{
+			openlogs.Use(this);
+			return true;
+		}
+		if (!ok)
+			return false;
+
+		for (unsigned int i = 0; i < 2; i++)
+		{
+			if (!segs[i].Open(age))
+			{
+				Fail("open", segs[i]);
+				return false;
+			}
+		}
+		current = (segs[1].newest() > segs[0].newest()) ? 1 : 0;
+		isopen = true;
+		openlogs.Use(this);
+		return true;
+	}
+
+ public:
+	/** Position in OpenLogs::logs, valid if listed is set */
+	OpenLogs::List::iterator lru;
+	bool listed;
+
+	HistoryLog(OpenLogs& Open, const std::string& path, time_t Age, unsigned int len, unsigned int time)
+		: HistoryList(len, time), openlogs(Open), age(Age), current(0), ok(true), isopen(false), listed(false)
+	{
+		for (unsigned int i = 0; i < 2; i++)
+			segs[i].path = path + "." + ConvToStr(i);
+		Load();
+	}
+
+	~HistoryLog()
+	{
+		openlogs.Forget(this);
+	}
+
+	/** Close the files, which are opened again when next needed */
+	void Close()
+	{
+		segs[0].Close();
+		segs[1].Close();
+		isopen = false;
+	}
+
+	void Add(const std::string& line)
+	{
+		if (!Load())
+			return;
+
+		if (segs[current].lines() >= maxlen)
+		{
+			current ^= 1;
+			if (!segs[current].Clear())
+			{
+				Fail("empty", segs[current]);
+				return;
+			}
+		}
+
+		if (!segs[current].Append(line, ServerInstance->Time()))
+		{
+			// Part of the line may have been written, so the segment is emptied to keep the log and index in step
+			ServerInstance->Logs->Log("m_chanhistory", DEFAULT, "Cannot write history %s: %s", segs[current].path.c_str(), strerror(errno));
+			if (!segs[current].Clear())
+				Fail("empty", segs[current]);
+		}
+	}
+
+	void Resize(unsigned int len)
+	{
+		maxlen = len;
+	}
+
+	void Replay(LocalUser* user, time_t mintime)
+	{
+		if (!Load())
+			return;
+
+		// Take up to maxlen of the newest lines, from the end of the older segment and then the current one
+		Segment& older = segs[current ^ 1];
+		Segment& newer = segs[current];
+		size_t fromnewer = std::min<size_t>(maxlen, newer.lines());
+		size_t fromolder = std::min<size_t>(maxlen - fromnewer, older.lines());
+		size_t firstolder = older.lines() - fromolder;
+		size_t firstnewer = newer.lines() - fromnewer;
+
+		while (firstolder < older.lines() && (time_t)older.index[firstolder].ts < mintime)
+			firstolder++;
+		if (firstolder == older.lines())
+		{
+			while (firstnewer < newer.lines() && (time_t)newer.index[firstnewer].ts < mintime)
+				firstnewer++;
+		}
+
+		std::string block;
+		unsigned int count = 0;
+		Segment* parts[2] = { &older, &newer };
+		size_t first[2] = { firstolder, firstnewer };
+		for (unsigned int i = 0; i < 2; i++)
+		{
+			Segment& seg = *parts[i];
+			if (first[i] == seg.lines())
+				continue;
+			const char* data = seg.Map();
+			if (!data)
+				continue;
+			size_t from = seg.start(first[i]);
+			block.append(data + from, seg.size() - from);
+			count += seg.lines() - first[i];
+		}
+
+		user->WriteBlock(block, count);
+	}
+
+	void Erase()
+	{
+		openlogs.Forget(this);
+		Close();
+		segs[0].Unlink();
+		segs[1].Unlink();
+		ok = false;
+	}
 };
 
+void OpenLogs::Use(HistoryLog* log)
+{
+	if (log->listed)
+	{
+		logs.splice(logs.begin(), logs, log->lru);
+		return;
+	}
+
+	log->lru = logs.insert(logs.begin(), log);
+	log->listed = true;
+	count++;
+	Shrink();
+}
+
+void OpenLogs::Forget(HistoryLog* log)
+{
+	if (!log->listed)
+		return;
+	logs.erase(log->lru);
+	log->listed = false;
+	count--;
+}
+
+void OpenLogs::Shrink()
+{
+	// The newest log is never closed here, as maxopen is at least 1
+	while (count > maxopen)
+	{
+		HistoryLog* log = logs.back();
+		Forget(log);
+		log->Close();
+	}
+}
+#endif
+
 class HistoryMode : public ModeHandler
 {
 	bool IsValidDuration(const std::string& duration)
@@ -52,8 +565,28 @@ class HistoryMode : public ModeHandler
 	}
 
  public:
+	HistoryList* Create(Channel* channel, unsigned int len, unsigned int time)
+	{
+#ifndef _WIN32
+		if (!logdir.empty())
+		{
+			std::string folded;
+			for (std::string::const_iterator i = channel->name.begin(); i != channel->name.end(); ++i)
+				folded.push_back(national_case_insensitive_map[(unsigned char)*i]);
+			return new HistoryLog(openlogs, logdir + "/" + BinToHex(folded), channel->age, len, time);
+		}
+#endif
+		return new HistoryRing(pool, len, time);
+	}
+
+	HistoryPool pool;
+#ifndef _WIN32
+	OpenLogs openlogs;
+#endif
 	SimpleExtItem<HistoryList> ext;
 	unsigned int maxlines;
+	/** Directory for history kept on disk, empty to keep it in memory */
+	std::string logdir;
 	HistoryMode(Module* Creator) : ModeHandler(Creator, "history", 'H', PARAM_SETONLY, MODETYPE_CHANNEL),
 		ext("history", Creator) { }
 
@@ -83,16 +616,13 @@ class HistoryMode : public ModeHandler
 			HistoryList* history = ext.get(channel);
 			if (history)
 			{
-				// Shrink the list if the new line number limit is lower than the old one
-				if (len < history->lines.size())
-					history->lines.erase(history->lines.begin(), history->lines.begin() + (history->lines.size() - len));
-
-				history->maxlen = len;
+				if (len != history->maxlen)
+					history->Resize(len);
 				history->maxtime = time;
 			}
 			else
 			{
-				ext.set(channel, new HistoryList(len, time));
+				ext.set(channel, Create(channel, len, time));
 			}
 			channel->SetModeParam('H', parameter);
 		}
@@ -100,6 +630,10 @@ class HistoryMode : public ModeHandler
 		{
 			if (!channel->IsModeSet('H'))
 				return MODEACTION_DENY;
+			// When the module is being unloaded, or the server shut down, the files are kept for next time
+			HistoryList* history = ext.get(channel);
+			if (history && !creator->dying)
+				history->Erase();
 			ext.unset(channel);
 			channel->SetModeParam('H', "");
 		}
@@ -121,18 +655,40 @@ class ModuleChanHistory : public Module
 		ServerInstance->Modules->AddService(m);
 		ServerInstance->Modules->AddService(m.ext);
 
-		Implementation eventlist[] = { I_OnPostJoin, I_OnUserMessage, I_OnRehash };
+		Implementation eventlist[] = { I_OnPostJoin, I_OnUserMessage, I_OnRehash, I_OnMemoryReport, I_OnChannelDelete };
 		ServerInstance->Modules->Attach(eventlist, this, sizeof(eventlist)/sizeof(Implementation));
 		OnRehash(NULL);
 	}
 
+	void OnMemoryReport(MemoryReport& report)
+	{
+		report.Add("Channel history", m.pool.lines, m.pool.memory);
+	}
+
 	void OnRehash(User*)
 	{
 		ConfigTag* tag = ServerInstance->Config->ConfValue("chanhistory");
 		m.maxlines = tag->getInt("maxlines", 50);
+		m.pool.maxmemory = tag->getInt("maxmemory", 16*1024*1024);
+		m.pool.Shrink();
+		m.logdir = tag->getString("logdir");
+#ifndef _WIN32
+		if (!m.logdir.empty() && mkdir(m.logdir.c_str(), 0700) && errno != EEXIST)
+			ServerInstance->Logs->Log("m_chanhistory", DEFAULT, "Cannot create %s: %s", m.logdir.c_str(), strerror(errno));
+		m.openlogs.maxopen = std::max<int>(tag->getInt("maxopen", 100), 1);
+		m.openlogs.Shrink();
+#endif
 		sendnotice = tag->getBool("notice", true);
 	}
 
+	void OnChannelDelete(Channel* chan)
+	{
+		// A new channel of the same name must not be shown this one's history
+		HistoryList* list = m.ext.get(chan);
+		if (list)
+			list->Erase();
+	}
+
 	void OnUserMessage(User* user,void* dest,int target_type, const std::string &text, char status, const CUList&)
 	{
 		if (target_type == TYPE_CHANNEL && status == 0)
@@ -144,16 +700,15 @@ class ModuleChanHistory : public Module
 				char buf[MAXBUF];
 				snprintf(buf, MAXBUF, ":%s PRIVMSG %s :%s",
 					user->GetFullHost().c_str(), c->name.c_str(), text.c_str());
-				list->lines.push_back(HistoryItem(buf));
-				if (list->lines.size() > list->maxlen)
-					list->lines.pop_front();
+				list->Add(buf);
 			}
 		}
 	}
 
 	void OnPostJoin(Membership* memb)
 	{
-		if (IS_REMOTE(memb->user))
+		LocalUser* user = IS_LOCAL(memb->user);
+		if (!user)
 			return;
 
 		HistoryList* list = m.ext.get(memb->chan);
@@ -165,15 +720,11 @@ class ModuleChanHistory : public Module
 
 		if (sendnotice)
 		{
-			memb->user->WriteServ("NOTICE %s :Replaying up to %d lines of pre-join history spanning up to %d seconds",
+			user->WriteServ("NOTICE %s :Replaying up to %d lines of pre-join history spanning up to %d seconds",
 				memb->chan->name.c_str(), list->maxlen, list->maxtime);
 		}
 
-		for(std::deque<HistoryItem>::iterator i = list->lines.begin(); i != list->lines.end(); ++i)
-		{
-			if (i->ts >= mintime)
-				memb->user->Write(i->line);
-		}
+		list->Replay(user, mintime);
 	}
 
 	Version GetVersion()
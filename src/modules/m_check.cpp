@@ -45,10 +45,13 @@ class CommandCheck : public Command
 	void dumpExt(User* user, const std::string& checkstr, Extensible* ext)
 	{
 		std::stringstream dumpkeys;
-		for(Extensible::ExtensibleStore::const_iterator i = ext->GetExtList().begin(); i != ext->GetExtList().end(); i++)
+		const Extensible::ExtensibleStore& list = ext->GetExtList();
+		for (unsigned int slot = 0; slot < list.size(); slot++)
 		{
-			ExtensionItem* item = i->first;
-			std::string value = item->serialize(FORMAT_USER, ext, i->second);
+			ExtensionItem* item = ExtensionItem::FromSlot(slot);
+			if (!item || !list[slot])
+				continue;
+			std::string value = item->serialize(FORMAT_USER, ext, list[slot]);
 			if (!value.empty())
 				user->SendText(checkstr + " meta:" + item->name + " " + value);
 			else if (!item->name.empty())
@@ -51,12 +51,13 @@ class ModuleDelayJoin : public Module
 	{
 		ServerInstance->Modules->AddService(djm);
 		ServerInstance->Modules->AddService(unjoined);
-		Implementation eventlist[] = { I_OnUserJoin, I_OnUserPart, I_OnUserKick, I_OnBuildNeighborList, I_OnNamesListItem, I_OnText, I_OnRawMode };
+		Implementation eventlist[] = { I_OnUserJoin, I_OnUserPart, I_OnUserKick, I_OnBuildNeighborList, I_OnNamesListItem, I_OnNamesListCache, I_OnText, I_OnRawMode };
 		ServerInstance->Modules->Attach(eventlist, this, sizeof(eventlist)/sizeof(Implementation));
 	}
 	~ModuleDelayJoin();
 	Version GetVersion();
 	void OnNamesListItem(User* issuer, Membership*, std::string &prefixes, std::string &nick);
+	ModResult OnNamesListCache(User* issuer, Channel* chan, unsigned int& format);
 	void OnUserJoin(Membership*, bool, bool, CUList&);
 	void CleanUser(User* user);
 	void OnUserPart(Membership*, std::string &partmessage, CUList&);
@@ -106,6 +107,14 @@ void ModuleDelayJoin::OnNamesListItem(User* issuer, Membership* memb, std::strin
 		nick.clear();
 }
 
+ModResult ModuleDelayJoin::OnNamesListCache(User* issuer, Channel* chan, unsigned int& format)
+{
+	/* Removing +D shows everyone, so only +D channels can have hidden members */
+	if (chan->IsModeSet('D'))
+		return MOD_RES_DENY;
+	return MOD_RES_PASSTHRU;
+}
+
 static void populate(CUList& except, Membership* memb)
 {
 	const UserMembList* users = memb->chan->GetUsers();
@@ -160,6 +160,31 @@ class ImplFilter : public FilterResult
 	Regex* regex;
 
 	ImplFilter(ModuleFilter* mymodule, const std::string &rea, FilterAction act, long glinetime, const std::string &pat, const std::string &flgs);
+	ImplFilter(Regex* rx, const std::string &rea, FilterAction act, long glinetime, const std::string &pat, const std::string &flgs)
+		: FilterResult(pat, rea, act, glinetime, flgs), regex(rx) { }
+};
+
+/** Patterns from <keyword> tags, compiled on the config reader thread during a rehash
+ */
+struct PrecompiledFilters
+{
+	/** The regex engine which compiled them */
+	RegexFactory* factory;
+	/** Compiled patterns, by pattern */
+	std::map<std::string, Regex*> regexes;
+	/** Errors from patterns which did not compile, by pattern */
+	std::map<std::string, std::string> errors;
+
+	PrecompiledFilters() : factory(NULL) { }
+
+	void Clear()
+	{
+		for (std::map<std::string, Regex*>::iterator i = regexes.begin(); i != regexes.end(); ++i)
+			delete i->second;
+		regexes.clear();
+		errors.clear();
+		factory = NULL;
+	}
 };
 
 
@@ -177,6 +202,7 @@ class ModuleFilter : public Module
 	int flags;
 
 	std::set<std::string> exemptfromfilter; // List of channel names excluded from filtering.
+	PrecompiledFilters precompiled; // Patterns compiled by FilterPrepareJob for the next ReadFilters()
 
 	ModuleFilter();
 	void init();
@@ -187,6 +213,7 @@ class ModuleFilter : public Module
 	std::pair<bool, std::string> AddFilter(const std::string &freeform, FilterAction type, const std::string &reason, long duration, const std::string &flags);
 	ModResult OnUserPreNotice(User* user,void* dest,int target_type, std::string &text, char status, CUList &exempt_list);
 	void OnRehash(User* user);
+	void OnPrepareConfig(std::vector<ConfigPrepareJob*>& jobs);
 	Version GetVersion();
 	std::string EncodeFilter(FilterResult* filter);
 	FilterResult DecodeFilter(const std::string &data);
@@ -201,6 +228,73 @@ class ModuleFilter : public Module
 	static std::string FilterActionToString(FilterAction fa);
 };
 
+/** Compiles the <keyword> patterns of the new configuration on the config reader thread,
+ * so that the main loop does not stall on it when there are many of them. Only
+ * providers which implement RegexFactory::CreateThreaded are used; the others
+ * compile in ReadFilters() as before. The provider cannot be unloaded while
+ * this job exists, as ModuleManager::CanUnload refuses to while a rehash is
+ * preparing, so the factory pointer stays valid until Commit().
+ */
+class FilterPrepareJob : public ConfigPrepareJob
+{
+	ModuleFilter* const mod;
+	const std::string provider;
+	PrecompiledFilters compiled;
+
+ public:
+	FilterPrepareJob(ModuleFilter* me)
+		: ConfigPrepareJob(me), mod(me), provider(me->RegexEngine.GetProvider())
+	{
+		// An engine whose unload is already queued will be gone by the time this is committed
+		RegexFactory* factory = me->RegexEngine.operator->();
+		if (!factory->creator->dying)
+			compiled.factory = factory;
+	}
+
+	~FilterPrepareJob()
+	{
+		compiled.Clear();
+	}
+
+	void Prepare(ServerConfig* conf)
+	{
+		// If the engine is being changed, OnRehash recompiles everything itself
+		std::string engine = conf->ConfValue("filteropts")->getString("engine");
+		if (!compiled.factory || provider != (engine.empty() ? "regex" : "regex/" + engine))
+			return;
+
+		ConfigTagList tags = conf->ConfTags("keyword");
+		for (ConfigIter i = tags.first; i != tags.second; ++i)
+		{
+			std::string pattern = i->second->getString("pattern");
+			if (compiled.regexes.count(pattern) || compiled.errors.count(pattern))
+				continue;
+
+			try
+			{
+				Regex* rx = compiled.factory->CreateThreaded(pattern);
+				if (!rx)
+					return;
+				compiled.regexes[pattern] = rx;
+			}
+			catch (ModuleException &e)
+			{
+				compiled.errors[pattern] = e.GetReason();
+			}
+		}
+	}
+
+	void Commit()
+	{
+		mod->precompiled.Clear();
+		if (!compiled.factory || !mod->RegexEngine || compiled.factory != mod->RegexEngine.operator->())
+			return;
+		mod->precompiled.factory = compiled.factory;
+		mod->precompiled.regexes.swap(compiled.regexes);
+		mod->precompiled.errors.swap(compiled.errors);
+	}
+};
+
 CmdResult CommandFilter::Handle(const std::vector<std::string> &parameters, User *user)
 {
 	if (parameters.size() == 1)
@@ -304,7 +398,7 @@ ModuleFilter::ModuleFilter()
 void ModuleFilter::init()
 {
 	ServerInstance->Modules->AddService(filtcommand);
-	Implementation eventlist[] = { I_OnPreCommand, I_OnStats, I_OnSyncNetwork, I_OnDecodeMetaData, I_OnUserPreMessage, I_OnUserPreNotice, I_OnRehash, I_OnUnloadModule };
+	Implementation eventlist[] = { I_OnPreCommand, I_OnStats, I_OnSyncNetwork, I_OnDecodeMetaData, I_OnUserPreMessage, I_OnUserPreNotice, I_OnRehash, I_OnUnloadModule, I_OnPrepareConfig };
 	ServerInstance->Modules->Attach(eventlist, this, sizeof(eventlist)/sizeof(Implementation));
 	OnRehash(NULL);
 }
@@ -312,6 +406,7 @@ void ModuleFilter::init()
 CullResult ModuleFilter::cull()
 {
 	FreeFilters();
+	precompiled.Clear();
 	return Module::cull();
 }
 
@@ -495,6 +590,7 @@ void ModuleFilter::OnRehash(User* user)
 
 		initing = false;
 		FreeFilters();
+		precompiled.Clear();
 		return;
 	}
 
@@ -508,6 +604,12 @@ void ModuleFilter::OnRehash(User* user)
 	ReadFilters();
 }
 
+void ModuleFilter::OnPrepareConfig(std::vector<ConfigPrepareJob*>& jobs)
+{
+	if (RegexEngine)
+		jobs.push_back(new FilterPrepareJob(this));
+}
+
 Version ModuleFilter::GetVersion()
 {
 	return Version("Text (spam) filtering", VF_VENDOR | VF_COMMON, RegexEngine ? RegexEngine->name : "");
@@ -703,6 +805,26 @@ void ModuleFilter::ReadFilters()
 		if (!StringToFilterAction(action, fa))
 			fa = FA_NONE;
 
+		// Use the pattern compiled during the rehash if it was compiled by the current engine
+		if (precompiled.factory == RegexEngine.operator->())
+		{
+			std::map<std::string, Regex*>::iterator rx = precompiled.regexes.find(pattern);
+			if (rx != precompiled.regexes.end())
+			{
+				filters.push_back(ImplFilter(rx->second, reason, fa, gline_time, pattern, flgs));
+				precompiled.regexes.erase(rx);
+				ServerInstance->Logs->Log("m_filter", DEFAULT, "Regular expression %s loaded.", pattern.c_str());
+				continue;
+			}
+
+			std::map<std::string, std::string>::iterator err = precompiled.errors.find(pattern);
+			if (err != precompiled.errors.end())
+			{
+				ServerInstance->Logs->Log("m_filter", DEFAULT, "Error in regular expression '%s': %s", pattern.c_str(), err->second.c_str());
+				continue;
+			}
+		}
+
 		try
 		{
 			filters.push_back(ImplFilter(this, reason, fa, gline_time, pattern, flgs));
@@ -713,6 +835,7 @@ void ModuleFilter::ReadFilters()
 			ServerInstance->Logs->Log("m_filter", DEFAULT, "Error in regular expression '%s': %s", pattern.c_str(), e.GetReason());
 		}
 	}
+	precompiled.Clear();
 }
 
 ModResult ModuleFilter::OnStats(char symbol, User* user, string_list &results)
@@ -733,6 +856,10 @@ ModResult ModuleFilter::OnStats(char symbol, User* user, string_list &results)
 
 void ModuleFilter::OnUnloadModule(Module* mod)
 {
+	// Patterns compiled by the module being unloaded can not outlive it
+	if (precompiled.factory && precompiled.factory->creator == mod)
+		precompiled.Clear();
+
 	// If the regex engine became unavailable or has changed, remove all filters
 	if (!RegexEngine)
 	{
@@ -40,28 +40,44 @@ enum HttpState
 {
 	HTTP_SERVE_WAIT_REQUEST = 0, /* Waiting for a full request */
 	HTTP_SERVE_RECV_POSTDATA = 1, /* Waiting to finish recieving POST data */
-	HTTP_SERVE_SEND_DATA = 2 /* Sending response */
+	HTTP_SERVE_SEND_DATA = 2, /* Sending response */
+	HTTP_SERVE_CLOSE = 3 /* Sending the last response, then closing */
 };
 
-/** A socket used for HTTP transport
+/** A socket used for HTTP transport. Connections are kept open between requests
+ * unless the client asks otherwise, and requests may be pipelined; they are
+ * answered in order as each one is read.
  */
 class HttpServerSocket : public BufferedSocket
 {
 	HttpState InternalState;
 	std::string ip;
 
+	/** Members describing the current request. They are reset, rather than
+	 * freed, between requests so their buffers are reused.
+	 */
 	HTTPHeaders headers;
-	std::string reqbuffer;
 	std::string postdata;
 	unsigned int postsize;
 	std::string request_type;
 	std::string uri;
 	std::string http_version;
 
+	/** Offset in recvq of the first byte of the current request not yet parsed */
+	std::string::size_type parsepos;
+
+	/** True if the connection stays open after the current request */
+	bool keepalive;
+
+	/** True once the socket has been queued for deletion */
+	bool closing;
+
  public:
+	/** Time of the last request or response, for the idle timeout */
+	time_t lastactivity;
 
 	HttpServerSocket(int newfd, const std::string& IP, ListenSocket* via, irc::sockets::sockaddrs* client, irc::sockets::sockaddrs* server)
-		: BufferedSocket(newfd), ip(IP), postsize(0)
+		: BufferedSocket(newfd), ip(IP), postsize(0), parsepos(0), keepalive(false), closing(false), lastactivity(ServerInstance->Time())
 	{
 		InternalState = HTTP_SERVE_WAIT_REQUEST;
 
@@ -75,11 +91,37 @@ class HttpServerSocket : public BufferedSocket
 		sockets.erase(this);
 	}
 
-	virtual void OnError(BufferedSocketError)
+	/** Queue the socket for deletion, if it is not already */
+	void Discard()
 	{
+		if (closing)
+			return;
+		closing = true;
 		ServerInstance->GlobalCulls.AddItem(this);
 	}
 
+	bool IsClosing() const { return closing; }
+
+	virtual void OnError(BufferedSocketError)
+	{
+		Discard();
+	}
+
+	/** Stop reading requests, and close the connection once everything queued is sent */
+	void Finish()
+	{
+		InternalState = HTTP_SERVE_CLOSE;
+		if (!getSendQSize())
+			Discard();
+	}
+
+	void DoWrite()
+	{
+		BufferedSocket::DoWrite();
+		if (InternalState == HTTP_SERVE_CLOSE && !getSendQSize())
+			Discard();
+	}
+
 	std::string Response(int response)
 	{
 		switch (response)
@@ -178,13 +220,24 @@ class HttpServerSocket : public BufferedSocket
 		                   "<small>Powered by <a href='http://www.inspircd.org'>InspIRCd</a></small></body></html>";
 
 		SendHeaders(data.length(), response, empty);
-		WriteData(data);
+		if (request_type != "HEAD")
+			WriteData(data);
+	}
+
+	/** Answer a request which could not be parsed, and close the connection, as
+	 * the start of the next request cannot be known
+	 */
+	void Fail(int response)
+	{
+		keepalive = false;
+		SendHTTPError(response);
+		Finish();
 	}
 
 	void SendHeaders(unsigned long size, int response, HTTPHeaders &rheaders)
 	{
 
-		WriteData(http_version + " "+ConvToStr(response)+" "+Response(response)+"\r\n");
+		WriteData((http_version.empty() ? "HTTP/1.0" : http_version) + " "+ConvToStr(response)+" "+Response(response)+"\r\n");
 
 		time_t local = ServerInstance->Time();
 		struct tm *timeinfo = gmtime(&local);
@@ -200,116 +253,174 @@ class HttpServerSocket : public BufferedSocket
 		else
 			rheaders.RemoveHeader("Content-Type");
 
-		/* Supporting Connection: keep-alive causes a whole world of hurt syncronizing timeouts,
-		 * so remove it, its not essential for what we need.
-		 */
-		rheaders.SetHeader("Connection", "Close");
+		rheaders.SetHeader("Connection", keepalive ? "Keep-Alive" : "Close");
 
 		WriteData(rheaders.GetFormattedHeaders());
 		WriteData("\r\n");
+		lastactivity = ServerInstance->Time();
 	}
 
 	void OnDataReady()
 	{
-		if (InternalState == HTTP_SERVE_RECV_POSTDATA)
+		if (InternalState == HTTP_SERVE_CLOSE)
 		{
-			postdata.append(recvq);
-			if (postdata.length() >= postsize)
-				ServeData();
+			recvq.clear();
+			return;
 		}
-		else
+
+		lastactivity = ServerInstance->Time();
+
+		// Answer every complete request that has arrived, in order
+		while (InternalState != HTTP_SERVE_CLOSE)
 		{
-			reqbuffer.append(recvq);
+			if (InternalState == HTTP_SERVE_WAIT_REQUEST && !ParseHeaders())
+				break;
 
-			if (reqbuffer.length() >= 8192)
+			if (InternalState == HTTP_SERVE_RECV_POSTDATA)
 			{
-				ServerInstance->Logs->Log("m_httpd",DEBUG, "m_httpd dropped connection due to an oversized request buffer");
-				reqbuffer.clear();
-				SetError("Buffer");
+				if (recvq.length() - parsepos < postsize)
+					break;
+				postdata.assign(recvq, parsepos, postsize);
+				parsepos += postsize;
 			}
 
-			if (InternalState == HTTP_SERVE_WAIT_REQUEST)
-				CheckRequestBuffer();
+			ServeData();
+
+			recvq.erase(0, parsepos);
+			parsepos = 0;
+			if (keepalive)
+				Reset();
+			else
+				Finish();
+		}
+
+		if (InternalState == HTTP_SERVE_WAIT_REQUEST && recvq.length() >= 8192)
+		{
+			ServerInstance->Logs->Log("m_httpd",DEBUG, "m_httpd dropped connection due to an oversized request buffer");
+			recvq.clear();
+			SetError("Buffer");
 		}
 	}
 
-	void CheckRequestBuffer()
+	/** Get ready for the next request on this connection */
+	void Reset()
 	{
-		std::string::size_type reqend = reqbuffer.find("\r\n\r\n");
-		if (reqend == std::string::npos)
-			return;
+		InternalState = HTTP_SERVE_WAIT_REQUEST;
+		headers.Clear();
+		postdata.clear();
+		postsize = 0;
+		request_type.clear();
+		uri.clear();
+		http_version.clear();
+	}
 
-		// We have the headers; parse them all
-		std::string::size_type hbegin = 0, hend;
-		while ((hend = reqbuffer.find("\r\n", hbegin)) != std::string::npos)
+	/** Parse the lines of the request head which have arrived since the last call.
+	 * Lines are read in place from recvq, so only the stored values are copied.
+	 * @return True once the whole head has been read and the request is valid
+	 */
+	bool ParseHeaders()
+	{
+		std::string::size_type eol;
+		while ((eol = recvq.find('\n', parsepos)) != std::string::npos)
 		{
-			if (hbegin == hend)
-				break;
+			const char* line = recvq.data() + parsepos;
+			const char* end = recvq.data() + eol;
+			if (end > line && end[-1] == '\r')
+				end--;
+			parsepos = eol + 1;
 
 			if (request_type.empty())
 			{
-				std::istringstream cheader(std::string(reqbuffer, hbegin, hend - hbegin));
-				cheader >> request_type;
-				cheader >> uri;
-				cheader >> http_version;
-
-				if (request_type.empty() || uri.empty() || http_version.empty())
+				// Empty lines before a request are allowed, and ignored
+				if (line == end)
+					continue;
+				if (!ParseRequestLine(line, end))
 				{
-					SendHTTPError(400);
-					return;
+					Fail(400);
+					return false;
 				}
-
-				hbegin = hend + 2;
 				continue;
 			}
 
-			std::string cheader = reqbuffer.substr(hbegin, hend - hbegin);
+			// An empty line ends the head
+			if (line == end)
+				return StartRequest();
 
-			std::string::size_type fieldsep = cheader.find(':');
-			if ((fieldsep == std::string::npos) || (fieldsep == 0) || (fieldsep == cheader.length() - 1))
+			const char* colon = static_cast<const char*>(memchr(line, ':', end - line));
+			if (!colon || colon == line)
 			{
-				SendHTTPError(400);
-				return;
+				Fail(400);
+				return false;
 			}
 
-			headers.SetHeader(cheader.substr(0, fieldsep), cheader.substr(fieldsep + 2));
-
-			hbegin = hend + 2;
+			const char* value = colon + 1;
+			while (value < end && (*value == ' ' || *value == '\t'))
+				value++;
+			while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+				end--;
+			headers.SetHeader(line, colon - line, value, end - value);
 		}
+		return false;
+	}
 
-		reqbuffer.erase(0, reqend + 4);
+	/** Split a request line into the request type, URI and HTTP version
+	 * @return False if the line does not have exactly those three parts
+	 */
+	bool ParseRequestLine(const char* line, const char* end)
+	{
+		std::string* parts[3] = { &request_type, &uri, &http_version };
+		unsigned int n = 0;
+		while (line < end && *line == ' ')
+			line++;
+		while (line < end)
+		{
+			const char* word = line;
+			while (line < end && *line != ' ')
+				line++;
+			if (n == 3)
+				return false;
+			parts[n++]->assign(word, line - word);
+			while (line < end && *line == ' ')
+				line++;
+		}
+		if (n != 3)
+			return false;
 
 		std::transform(request_type.begin(), request_type.end(), request_type.begin(), ::toupper);
 		std::transform(http_version.begin(), http_version.end(), http_version.begin(), ::toupper);
+		return true;
+	}
 
+	/** Check a request once its head has been read, and work out how the body and
+	 * the connection are to be handled
+	 * @return True if the request can be served
+	 */
+	bool StartRequest()
+	{
 		if ((http_version != "HTTP/1.1") && (http_version != "HTTP/1.0"))
 		{
-			SendHTTPError(505);
-			return;
+			Fail(505);
+			return false;
 		}
 
-		if (headers.IsSet("Content-Length") && (postsize = ConvToInt(headers.GetHeader("Content-Length"))) > 0)
-		{
-			InternalState = HTTP_SERVE_RECV_POSTDATA;
-
-			if (reqbuffer.length() >= postsize)
-			{
-				postdata = reqbuffer.substr(0, postsize);
-				reqbuffer.erase(0, postsize);
-			}
-			else if (!reqbuffer.empty())
-			{
-				postdata = reqbuffer;
-				reqbuffer.clear();
-			}
-
-			if (postdata.length() >= postsize)
-				ServeData();
+		// HTTP/1.1 connections persist unless closed; HTTP/1.0 ones only on request
+		std::string connection = headers.GetHeader("Connection");
+		std::transform(connection.begin(), connection.end(), connection.begin(), ::tolower);
+		if (http_version == "HTTP/1.1")
+			keepalive = (connection.find("close") == std::string::npos);
+		else
+			keepalive = (connection.find("keep-alive") != std::string::npos);
 
-			return;
+		// Only bodies with a known length are accepted
+		if (headers.IsSet("Transfer-Encoding"))
+		{
+			Fail(411);
+			return false;
 		}
 
-		ServeData();
+		if (headers.IsSet("Content-Length") && (postsize = ConvToInt(headers.GetHeader("Content-Length"))) > 0)
+			InternalState = HTTP_SERVE_RECV_POSTDATA;
+		return true;
 	}
 
 	void ServeData()
@@ -332,8 +443,10 @@ class HttpServerSocket : public BufferedSocket
 
 	void Page(std::stringstream* n, int response, HTTPHeaders *hheaders)
 	{
-		SendHeaders(n->str().length(), response, *hheaders);
-		WriteData(n->str());
+		std::string data = n->str();
+		SendHeaders(data.length(), response, *hheaders);
+		if (request_type != "HEAD")
+			WriteData(data);
 	}
 };
 
@@ -341,10 +454,30 @@ class ModuleHttpServer : public Module
 {
  public:
 
+	/** Seconds a connection may be idle before it is closed */
+	unsigned int timeout;
+
 	void init()
 	{
 		HttpModule = this;
-		ServerInstance->Modules->Attach(I_OnAcceptConnection, this);
+		Implementation eventlist[] = { I_OnAcceptConnection, I_OnBackgroundTimer, I_OnRehash };
+		ServerInstance->Modules->Attach(eventlist, this, sizeof(eventlist)/sizeof(Implementation));
+		OnRehash(NULL);
+	}
+
+	void OnRehash(User*)
+	{
+		timeout = ServerInstance->Config->ConfValue("httpd")->getInt("timeout", 10);
+	}
+
+	void OnBackgroundTimer(time_t curtime)
+	{
+		for (std::set<HttpServerSocket*>::const_iterator i = sockets.begin(); i != sockets.end(); ++i)
+		{
+			HttpServerSocket* sock = *i;
+			if (!sock->IsClosing() && sock->lastactivity + (time_t)timeout < curtime)
+				sock->Discard();
+		}
 	}
 
 	void OnRequest(Request& request)
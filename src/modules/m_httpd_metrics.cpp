@@ -0,0 +1,289 @@
+/*
+ * InspIRCd -- Internet Relay Chat Daemon
+ *
+ * This file is part of InspIRCd.  InspIRCd is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "inspircd.h"
+#include "httpd.h"
+#include "xline.h"
+
+/* $ModDesc: Provides counters and gauges in the OpenMetrics text format over HTTP via m_httpd.so */
+
+/** Builds an OpenMetrics document. Everything written comes from counters which
+ * the core keeps up to date as it goes, so no users or channels are looked at.
+ */
+class MetricsWriter
+{
+	std::string& out;
+
+	void Family(const char* name, const char* type, const char* help)
+	{
+		out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+		out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+	}
+
+	void Sample(const char* name, const char* suffix, const std::string& labels, const std::string& value)
+	{
+		out.append(name).append(suffix);
+		if (!labels.empty())
+			out.append("{").append(labels).append("}");
+		out.append(" ").append(value).append("\n");
+	}
+
+ public:
+	MetricsWriter(std::string& Out) : out(Out) { }
+
+	/** Quote a label value */
+	static std::string Label(const char* name, const std::string& value)
+	{
+		std::string ret = name;
+		ret.append("=\"");
+		for (std::string::const_iterator i = value.begin(); i != value.end(); ++i)
+		{
+			if (*i == '\\' || *i == '"')
+				ret.push_back('\\');
+			if (*i == '\n')
+				ret.append("\\n");
+			else
+				ret.push_back(*i);
+		}
+		ret.push_back('"');
+		return ret;
+	}
+
+	/** Format a number of microseconds as seconds */
+	static std::string Seconds(uint64_t usecs)
+	{
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%lu.%06lu", (unsigned long)(usecs / 1000000), (unsigned long)(usecs % 1000000));
+		return buf;
+	}
+
+	void Counter(const char* name, const char* help)
+	{
+		Family(name, "counter", help);
+	}
+
+	void Gauge(const char* name, const char* help)
+	{
+		Family(name, "gauge", help);
+	}
+
+	void Histogram(const char* name, const char* help)
+	{
+		Family(name, "histogram", help);
+	}
+
+	void CounterValue(const char* name, const std::string& labels, const std::string& value)
+	{
+		Sample(name, "_total", labels, value);
+	}
+
+	void GaugeValue(const char* name, const std::string& labels, const std::string& value)
+	{
+		Sample(name, "", labels, value);
+	}
+
+	/** Write a LatencyHistogram in seconds, with bucket bounds at each power of four microseconds up to about a minute */
+	void HistogramValue(const char* name, const std::string& labels, const LatencyHistogram& h)
+	{
+		std::string prefix = labels.empty() ? "" : labels + ",";
+		unsigned long seen = 0;
+		uint64_t bound = 4;
+		for (unsigned int i = 0; i < LatencyHistogram::BUCKETS && bound <= 67108864; i++)
+		{
+			seen += h.BucketCount(i);
+			if (LatencyHistogram::BucketLimit(i) + 1 == bound)
+			{
+				Sample(name, "_bucket", prefix + "le=\"" + Seconds(bound) + "\"", ConvToStr(seen));
+				bound *= 4;
+			}
+		}
+		Sample(name, "_bucket", prefix + "le=\"+Inf\"", ConvToStr(h.count));
+		Sample(name, "_count", labels, ConvToStr(h.count));
+		Sample(name, "_sum", labels, Seconds(h.total));
+	}
+
+	void End()
+	{
+		out.append("# EOF\n");
+	}
+};
+
+class ModuleHttpMetrics : public Module
+{
+	/** Size of the last document, to reserve space for the next */
+	size_t lastsize;
+
+ public:
+	ModuleHttpMetrics() : lastsize(0)
+	{
+	}
+
+	void init()
+	{
+		OnRehash(NULL);
+		Implementation eventlist[] = { I_OnEvent, I_OnRehash };
+		ServerInstance->Modules->Attach(eventlist, this, sizeof(eventlist)/sizeof(Implementation));
+	}
+
+	void OnRehash(User*)
+	{
+		LoopTimings::timehooks = ServerInstance->Config->ConfValue("httpdmetrics")->getBool("hooktimes");
+	}
+
+	void Build(std::string& data)
+	{
+		MetricsWriter m(data);
+		serverstats* stats = ServerInstance->stats;
+
+		m.Counter("inspircd_connections", "Inbound connections seen.");
+		m.CounterValue("inspircd_connections", "", ConvToStr(stats->statsConnects));
+		m.Counter("inspircd_accepts", "Connections accepted and refused by listeners.");
+		m.CounterValue("inspircd_accepts", "result=\"accepted\"", ConvToStr(stats->statsAccept));
+		m.CounterValue("inspircd_accepts", "result=\"refused\"", ConvToStr(stats->statsRefused));
+
+		m.Gauge("inspircd_users", "Users currently connected.");
+		m.GaugeValue("inspircd_users", "scope=\"global\"", ConvToStr(ServerInstance->Users->clientlist->size()));
+		m.GaugeValue("inspircd_users", "scope=\"local\"", ConvToStr(ServerInstance->Users->local_count));
+		m.GaugeValue("inspircd_users", "scope=\"unregistered\"", ConvToStr(ServerInstance->Users->unregistered_count));
+		m.Gauge("inspircd_opers", "Opers currently online.");
+		m.GaugeValue("inspircd_opers", "", ConvToStr(ServerInstance->Users->all_opers.size()));
+		m.Gauge("inspircd_channels", "Channels which currently exist.");
+		m.GaugeValue("inspircd_channels", "", ConvToStr(ServerInstance->chanlist->size()));
+		m.Gauge("inspircd_sockets", "File descriptors in use.");
+		m.GaugeValue("inspircd_sockets", "", ConvToStr(ServerInstance->SE->GetUsedFds()));
+
+		/* the samples of each family have to be written together */
+		const Commandtable& commands = ServerInstance->Parser->cmdlist;
+		m.Counter("inspircd_commands", "Commands run, by command.");
+		for (Commandtable::const_iterator i = commands.begin(); i != commands.end(); ++i)
+		{
+			if (i->second->use_count)
+				m.CounterValue("inspircd_commands", MetricsWriter::Label("command", i->first), ConvToStr(i->second->use_count));
+		}
+		m.Counter("inspircd_command_bytes", "Bytes of command lines received, by command.");
+		for (Commandtable::const_iterator i = commands.begin(); i != commands.end(); ++i)
+		{
+			if (i->second->use_count)
+				m.CounterValue("inspircd_command_bytes", MetricsWriter::Label("command", i->first), ConvToStr(i->second->total_bytes));
+		}
+		m.Histogram("inspircd_command_seconds", "Time taken to run commands, by command and by whether they came from a local user or a server.");
+		for (Commandtable::const_iterator i = commands.begin(); i != commands.end(); ++i)
+		{
+			std::string label = MetricsWriter::Label("command", i->first);
+			if (i->second->local_timings)
+				m.HistogramValue("inspircd_command_seconds", label + ",source=\"local\"", i->second->local_timings->latency);
+			if (i->second->remote_timings)
+				m.HistogramValue("inspircd_command_seconds", label + ",source=\"remote\"", i->second->remote_timings->latency);
+		}
+#ifdef COUNT_ALLOCATIONS
+		m.Counter("inspircd_command_allocations", "Heap allocations made while running commands, by command and source.");
+		for (Commandtable::const_iterator i = commands.begin(); i != commands.end(); ++i)
+		{
+			std::string label = MetricsWriter::Label("command", i->first);
+			if (i->second->local_timings)
+				m.CounterValue("inspircd_command_allocations", label + ",source=\"local\"", ConvToStr(i->second->local_timings->allocations));
+			if (i->second->remote_timings)
+				m.CounterValue("inspircd_command_allocations", label + ",source=\"remote\"", ConvToStr(i->second->remote_timings->allocations));
+		}
+#endif
+		m.Counter("inspircd_unknown_commands", "Unknown commands received.");
+		m.CounterValue("inspircd_unknown_commands", "", ConvToStr(stats->statsUnknown));
+
+		const ClassVector& classes = ServerInstance->Config->Classes;
+		m.Counter("inspircd_received_bytes", "Bytes received from local users, by connect class.");
+		for (ClassVector::const_iterator i = classes.begin(); i != classes.end(); ++i)
+			m.CounterValue("inspircd_received_bytes", MetricsWriter::Label("class", (*i)->name), ConvToStr((*i)->bytes_in));
+		m.Counter("inspircd_sent_bytes", "Bytes sent to local users, by connect class.");
+		for (ClassVector::const_iterator i = classes.begin(); i != classes.end(); ++i)
+			m.CounterValue("inspircd_sent_bytes", MetricsWriter::Label("class", (*i)->name), ConvToStr((*i)->bytes_out));
+
+		m.Gauge("inspircd_sendq_bytes", "Bytes waiting in the send queues of local users.");
+		m.GaugeValue("inspircd_sendq_bytes", "", ConvToStr(stats->statsSendQ));
+		m.Counter("inspircd_sendq_exceeded", "Local users disconnected for going over their hard sendq.");
+		m.CounterValue("inspircd_sendq_exceeded", "", ConvToStr(stats->statsSendQExceeded));
+
+		m.Counter("inspircd_dns_requests", "DNS requests answered, by result.");
+		m.CounterValue("inspircd_dns_requests", "result=\"good\"", ConvToStr(stats->statsDnsGood));
+		m.CounterValue("inspircd_dns_requests", "result=\"bad\"", ConvToStr(stats->statsDnsBad));
+		m.Histogram("inspircd_dns_latency_seconds", "Time taken by the nameserver to answer.");
+		m.HistogramValue("inspircd_dns_latency_seconds", "", ServerInstance->Res->latency);
+
+		m.Counter("inspircd_xline_hits", "Times an X-line matched, by type.");
+		std::vector<std::string> xltypes = ServerInstance->XLines->GetAllTypes();
+		for (std::vector<std::string>::const_iterator i = xltypes.begin(); i != xltypes.end(); ++i)
+			m.CounterValue("inspircd_xline_hits", MetricsWriter::Label("type", *i), ConvToStr(ServerInstance->XLines->GetHits(*i)));
+
+		m.Histogram("inspircd_mainloop_seconds", "Time spent in each phase of the main loop.");
+		for (int i = 0; i < LoopTimings::PHASE_COUNT; i++)
+			m.HistogramValue("inspircd_mainloop_seconds", MetricsWriter::Label("phase", LoopTimings::PhaseNames[i]), ServerInstance->LoopTimes.phases[i]);
+
+		if (LoopTimings::timehooks)
+		{
+			/* modules without hooks, such as most of the core commands, are left out */
+			std::vector<Module*> hooked;
+			std::vector<std::string> names = ServerInstance->Modules->GetAllModuleNames(0);
+			for (std::vector<std::string>::iterator i = names.begin(); i != names.end(); ++i)
+			{
+				Module* mod = ServerInstance->Modules->Find(*i);
+				if (mod->hook_calls)
+					hooked.push_back(mod);
+			}
+
+			m.Counter("inspircd_module_hook_seconds", "Time spent in module hooks, by module.");
+			for (std::vector<Module*>::iterator i = hooked.begin(); i != hooked.end(); ++i)
+				m.CounterValue("inspircd_module_hook_seconds", MetricsWriter::Label("module", (*i)->ModuleSourceFile), MetricsWriter::Seconds((*i)->hook_usecs));
+			m.Counter("inspircd_module_hook_calls", "Module hook calls, by module.");
+			for (std::vector<Module*>::iterator i = hooked.begin(); i != hooked.end(); ++i)
+				m.CounterValue("inspircd_module_hook_calls", MetricsWriter::Label("module", (*i)->ModuleSourceFile), ConvToStr((*i)->hook_calls));
+		}
+
+		m.End();
+	}
+
+	void OnEvent(Event& event)
+	{
+		if (event.id != "httpd_url")
+			return;
+
+		HTTPRequest* http = static_cast<HTTPRequest*>(&event);
+		if (http->GetURI() != "/metrics")
+			return;
+
+		std::string data;
+		data.reserve(lastsize + lastsize / 4);
+		Build(data);
+		lastsize = data.length();
+
+		std::stringstream doc(data);
+		HTTPDocumentResponse response(this, *http, &doc, 200);
+		response.headers.SetHeader("X-Powered-By", "m_httpd_metrics.so");
+		response.headers.SetHeader("Content-Type", "application/openmetrics-text; version=1.0.0; charset=utf-8");
+		response.Send();
+	}
+
+	~ModuleHttpMetrics()
+	{
+		LoopTimings::timehooks = false;
+	}
+
+	Version GetVersion()
+	{
+		return Version("Provides counters and gauges in the OpenMetrics text format over HTTP via m_httpd.so", VF_VENDOR);
+	}
+};
+
+MODULE_INIT(ModuleHttpMetrics)
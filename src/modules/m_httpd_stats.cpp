@@ -80,10 +80,13 @@ class ModuleHttpStats : public Module
 	void DumpMeta(std::stringstream& data, Extensible* ext)
 	{
 		data << "<metadata>";
-		for(Extensible::ExtensibleStore::const_iterator i = ext->GetExtList().begin(); i != ext->GetExtList().end(); i++)
+		const Extensible::ExtensibleStore& list = ext->GetExtList();
+		for (unsigned int slot = 0; slot < list.size(); slot++)
 		{
-			ExtensionItem* item = i->first;
-			std::string value = item->serialize(FORMAT_USER, ext, i->second);
+			ExtensionItem* item = ExtensionItem::FromSlot(slot);
+			if (!item || !list[slot])
+				continue;
+			std::string value = item->serialize(FORMAT_USER, ext, list[slot]);
 			if (!value.empty())
 				data << "<meta name=\"" << item->name << "\">" << Sanitize(value) << "</meta>";
 			else if (!item->name.empty())
@@ -120,7 +123,24 @@ class ModuleHttpStats : public Module
 				stime = gmtime(&server_uptime);
 				data << "<uptime><days>" << stime->tm_yday << "</days><hours>" << stime->tm_hour << "</hours><mins>" << stime->tm_min << "</mins><secs>" << stime->tm_sec << "</secs><boot_time_t>" << ServerInstance->startup_time << "</boot_time_t></uptime>";
 
-				data << "<isupport>" << Sanitize(ServerInstance->Config->data005) << "</isupport></general><xlines>";
+				data << "<isupport>" << Sanitize(ServerInstance->Config->data005) << "</isupport></general><memory>";
+				MemoryReport report;
+				report.Collect();
+				for (std::vector<MemoryReport::Entry>::const_iterator i = report.entries.begin(); i != report.entries.end(); ++i)
+				{
+					data << "<item><name>" << Sanitize(i->name) << "</name><count>" << i->count
+						<< "</count><bytes>" << i->bytes << "</bytes></item>";
+				}
+				data << "<total>" << report.Total() << "</total></memory><mainloop>";
+				const LoopTimings& times = ServerInstance->LoopTimes;
+				for (int i = 0; i < LoopTimings::PHASE_COUNT; i++)
+				{
+					const LatencyHistogram& h = times.phases[i];
+					data << "<phase><name>" << LoopTimings::PhaseNames[i] << "</name><count>" << h.count << "</count><total>" << h.total
+						<< "</total><p50>" << h.Percentile(50) << "</p50><p90>" << h.Percentile(90) << "</p90><p99>" << h.Percentile(99)
+						<< "</p99><max>" << h.max << "</max></phase>";
+				}
+				data << "<slow>" << times.slow << "</slow></mainloop><xlines>";
 				std::vector<std::string> xltypes = ServerInstance->XLines->GetAllTypes();
 				for (std::vector<std::string>::iterator it = xltypes.begin(); it != xltypes.end(); ++it)
 				{
@@ -16,7 +16,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-/* $ModDesc: Provides support for extended-join, away-notify and account-notify CAP capabilities */
+/* $ModDesc: Provides support for extended-join, away-notify, account-notify and batch CAP capabilities */
 
 #include "inspircd.h"
 #include "account.h"
@@ -27,54 +27,41 @@ class ModuleIRCv3 : public Module
 	GenericCap cap_accountnotify;
 	GenericCap cap_awaynotify;
 	GenericCap cap_extendedjoin;
+	GenericCap cap_batch;
 	bool accountnotify;
 	bool awaynotify;
 	bool extendedjoin;
+	bool batch;
 
 	CUList last_excepts;
 
-	void WriteNeighboursWithExt(User* user, const std::string& line, const LocalIntExt& ext)
+	/** A line sent only to users with a capability */
+	class CapMessage : public MessageVariants
 	{
-		UserChanList chans(user->chans);
-
-		std::map<User*, bool> exceptions;
-		FOREACH_MOD(I_OnBuildNeighborList, OnBuildNeighborList(user, chans, exceptions));
-
-		// Send it to all local users who were explicitly marked as neighbours by modules and have the required ext
-		for (std::map<User*, bool>::const_iterator i = exceptions.begin(); i != exceptions.end(); ++i)
+		const GenericCap& cap;
+	 public:
+		CapMessage(const std::string& line, const GenericCap& Cap) : cap(Cap)
 		{
-			LocalUser* u = IS_LOCAL(i->first);
-			if ((u) && (i->second) && (ext.get(u)))
-				u->Write(line);
+			lines.push_back(line);
 		}
 
-		// Now consider sending it to all other users who has at least a common channel with the user
-		std::set<User*> already_sent;
-		for (UCListIter i = chans.begin(); i != chans.end(); ++i)
+		int Select(LocalUser* user)
 		{
-			const UserMembList* userlist = (*i)->GetUsers();
-			for (UserMembList::const_iterator m = userlist->begin(); m != userlist->end(); ++m)
-			{
-				/*
-				 * Send the line if the channel member in question meets all of the following criteria:
-				 * - local
-				 * - not the user who is doing the action (i.e. whose channels we're iterating)
-				 * - has the given extension
-				 * - not on the except list built by modules
-				 * - we haven't sent the line to the member yet
-				 *
-				 */
-				LocalUser* member = IS_LOCAL(m->first);
-				if ((member) && (member != user) && (ext.get(member)) && (exceptions.find(member) == exceptions.end()) && (already_sent.insert(member).second))
-					member->Write(line);
-			}
+			return (user->caps & cap.bit) ? 0 : -1;
 		}
+	};
+
+	void WriteNeighboursWithCap(User* user, const std::string& line, const GenericCap& cap)
+	{
+		CapMessage msg(line, cap);
+		user->WriteCommonVariants(msg, false);
 	}
 
  public:
 	ModuleIRCv3() : cap_accountnotify(this, "account-notify"),
 					cap_awaynotify(this, "away-notify"),
-					cap_extendedjoin(this, "extended-join")
+					cap_extendedjoin(this, "extended-join"),
+					cap_batch(this, "batch")
 	{
 	}
 
@@ -91,6 +78,7 @@ class ModuleIRCv3 : public Module
 		accountnotify = conf->getBool("accountnotify", conf->getBool("accoutnotify", true));
 		awaynotify = conf->getBool("awaynotify", true);
 		extendedjoin = conf->getBool("extendedjoin", true);
+		batch = conf->getBool("batch", true);
 	}
 
 	void OnEvent(Event& ev)
@@ -99,6 +87,9 @@ class ModuleIRCv3 : public Module
 			cap_awaynotify.HandleEvent(ev);
 		if (extendedjoin)
 			cap_extendedjoin.HandleEvent(ev);
+		// The core frames netsplit QUITs in a batch for users with this
+		if (batch)
+			cap_batch.HandleEvent(ev);
 
 		if (accountnotify)
 		{
@@ -117,7 +108,7 @@ class ModuleIRCv3 : public Module
 				else
 					line += std::string(ae->account);
 
-				WriteNeighboursWithExt(ae->user, line, cap_accountnotify.ext);
+				WriteNeighboursWithCap(ae->user, line, cap_accountnotify);
 			}
 		}
 	}
@@ -147,8 +138,8 @@ class ModuleIRCv3 : public Module
 		for (UserMembCIter it = userlist->begin(); it != userlist->end(); ++it)
 		{
 			// Send the extended join line if the current member is local, has the extended-join cap and isn't excepted
-			User* member = IS_LOCAL(it->first);
-			if ((member) && (cap_extendedjoin.ext.get(member)) && (excepts.find(member) == excepts.end()))
+			LocalUser* member = IS_LOCAL(it->first);
+			if ((member) && (member->caps & cap_extendedjoin.bit) && (excepts.find(member) == excepts.end()))
 			{
 				// Construct the lines we're going to send if we haven't constructed them already
 				if (line.empty())
@@ -205,7 +196,7 @@ class ModuleIRCv3 : public Module
 			if (!awaymsg.empty())
 				line += " :" + awaymsg;
 
-			WriteNeighboursWithExt(user, line, cap_awaynotify.ext);
+			WriteNeighboursWithCap(user, line, cap_awaynotify);
 		}
 		return MOD_RES_PASSTHRU;
 	}
@@ -217,16 +208,9 @@ class ModuleIRCv3 : public Module
 
 		std::string line = ":" + memb->user->GetFullHost() + " AWAY :" + memb->user->awaymsg;
 
-		const UserMembList* userlist = memb->chan->GetUsers();
-		for (UserMembCIter it = userlist->begin(); it != userlist->end(); ++it)
-		{
-			// Send the away notify line if the current member is local, has the away-notify cap and isn't excepted
-			User* member = IS_LOCAL(it->first);
-			if ((member) && (cap_awaynotify.ext.get(member)) && (last_excepts.find(member) == last_excepts.end()))
-			{
-				member->Write(line);
-			}
-		}
+		// Send the away notify line to members with the away-notify cap who saw the JOIN
+		CapMessage msg(line, cap_awaynotify);
+		memb->chan->WriteVariants(msg, last_excepts);
 
 		last_excepts.clear();
 	}
@@ -238,7 +222,7 @@ class ModuleIRCv3 : public Module
 
 	Version GetVersion()
 	{
-		return Version("Provides support for extended-join, away-notify and account-notify CAP capabilities", VF_VENDOR);
+		return Version("Provides support for extended-join, away-notify, account-notify and batch CAP capabilities", VF_VENDOR);
 	}
 };
 
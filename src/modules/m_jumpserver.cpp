@@ -99,9 +99,9 @@ class CommandJumpserver : public Command
 			if (redirect_all_immediately)
 			{
 				/* Redirect everyone but the oper sending the command */
-				for (LocalUserList::const_iterator i = ServerInstance->Users->local_users.begin(); i != ServerInstance->Users->local_users.end(); ++i)
+				for (LocalUserList::const_iterator i = ServerInstance->Users->local_users.begin(); i != ServerInstance->Users->local_users.end(); )
 				{
-					User* t = *i;
+					User* t = *i++;
 					if (!IS_OPER(t))
 					{
 						t->WriteNumeric(10, "%s %s %s :Please use this Server/Port instead", t->nick.c_str(), parameters[0].c_str(), parameters[1].c_str());
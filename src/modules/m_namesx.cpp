@@ -35,7 +35,7 @@ class ModuleNamesX : public Module
 
 	void init()
 	{
-		Implementation eventlist[] = { I_OnPreCommand, I_OnNamesListItem, I_On005Numeric, I_OnEvent, I_OnSendWhoLine };
+		Implementation eventlist[] = { I_OnPreCommand, I_OnNamesListItem, I_OnNamesListCache, I_On005Numeric, I_OnEvent, I_OnSendWhoLine };
 		ServerInstance->Modules->Attach(eventlist, this, sizeof(eventlist)/sizeof(Implementation));
 	}
 
@@ -65,7 +65,7 @@ class ModuleNamesX : public Module
 		{
 			if ((parameters.size()) && (!strcasecmp(parameters[0].c_str(),"NAMESX")))
 			{
-				cap.ext.set(user, 1);
+				cap.set(user, true);
 				return MOD_RES_DENY;
 			}
 		}
@@ -74,7 +74,7 @@ class ModuleNamesX : public Module
 
 	void OnNamesListItem(User* issuer, Membership* memb, std::string &prefixes, std::string &nick)
 	{
-		if (!cap.ext.get(issuer))
+		if (!cap.get(issuer))
 			return;
 
 		/* Some module hid this from being displayed, dont bother */
@@ -84,9 +84,16 @@ class ModuleNamesX : public Module
 		prefixes = memb->chan->GetAllPrefixChars(memb->user);
 	}
 
+	ModResult OnNamesListCache(User* issuer, Channel* chan, unsigned int& format)
+	{
+		if (cap.get(issuer))
+			format |= NAMES_ALLPREFIXES;
+		return MOD_RES_PASSTHRU;
+	}
+
 	void OnSendWhoLine(User* source, const std::vector<std::string>& params, User* user, std::string& line)
 	{
-		if (!cap.ext.get(source))
+		if (!cap.get(source))
 			return;
 
 		// Channel names can contain ":", and ":" as a 'start-of-token' delimiter is
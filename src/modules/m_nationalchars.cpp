@@ -272,10 +272,10 @@ class ModuleNationalChars : public Module
 		if (!forcequit)
 			return;
 
-		for (LocalUserList::const_iterator iter = ServerInstance->Users->local_users.begin(); iter != ServerInstance->Users->local_users.end(); ++iter)
+		for (LocalUserList::const_iterator iter = ServerInstance->Users->local_users.begin(); iter != ServerInstance->Users->local_users.end(); )
 		{
 			/* Fix by Brain: Dont quit UID users */
-			User* n = *iter;
+			User* n = *iter++;
 			if (!isdigit(n->nick[0]) && !ServerInstance->IsNick(n->nick.c_str(), ServerInstance->Config->Limits.NickMax))
 				ServerInstance->Users->QuitUser(n, message);
 		}
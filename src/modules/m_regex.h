@@ -53,6 +53,17 @@ class RegexFactory : public DataProvider
 	RegexFactory(Module* Creator, const std::string& Name) : DataProvider(Creator, Name) {}
 
 	virtual Regex* Create(const std::string& expr) = 0;
+
+	/** Compile an expression on a thread other than the main one, such as in a
+	 * ConfigPrepareJob. Unlike Create(), this must not log, send messages or
+	 * depend on settings which a rehash can change. Providers which cannot do
+	 * that keep this default, which returns NULL, and the expression must then
+	 * be compiled with Create() on the main thread.
+	 * @param expr The expression to compile
+	 * @return The compiled expression, or NULL if this provider cannot compile off the main thread
+	 * @throw ModuleException if the expression is not valid
+	 */
+	virtual Regex* CreateThreaded(const std::string& expr) { return NULL; }
 };
 
 #endif
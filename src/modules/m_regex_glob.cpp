@@ -48,6 +48,11 @@ class GlobFactory : public RegexFactory
 		return new GlobRegex(expr);
 	}
 
+	Regex* CreateThreaded(const std::string& expr)
+	{
+		return new GlobRegex(expr);
+	}
+
 	GlobFactory(Module* m) : RegexFactory(m, "regex/glob") {}
 };
 
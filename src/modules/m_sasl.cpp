@@ -190,7 +190,7 @@ class CommandAuthenticate : public Command
 		/* Only allow AUTHENTICATE on unregistered clients */
 		if (user->registered != REG_ALL)
 		{
-			if (!cap.ext.get(user))
+			if (!cap.get(user))
 				return CMD_FAILURE;
 
 			SaslAuthenticator *sasl = authExt.get(user);
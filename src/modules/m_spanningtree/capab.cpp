@@ -157,7 +157,9 @@ void TreeSocket::SendCapabilities(int phase)
 			" PREFIX="+ServerInstance->Modes->BuildPrefixes()+
 			" CHANMODES="+ServerInstance->Modes->GiveModeList(MASK_CHANNEL)+
 			" USERMODES="+ServerInstance->Modes->GiveModeList(MASK_USER)+
-			" SVSPART=1");
+			" SVSPART=1"+
+			" BURSTV2=1"+
+			(Utils->ResyncWindow ? " RESYNC=1" : ""));
 
 	this->WriteLine("CAPAB END");
 }
@@ -250,6 +252,14 @@ bool TreeSocket::Capab(const parameterlist &params)
 			}
 		}
 
+		/* Batched FJOINs (BJOIN) may be sent in our burst if they understand them */
+		std::map<std::string,std::string>::iterator burstv2 = this->capab->CapKeys.find("BURSTV2");
+		BatchedBurst = ((burstv2 != this->capab->CapKeys.end()) && (burstv2->second == "1"));
+
+		/* Both sides must journal their links to resync after a short split */
+		std::map<std::string,std::string>::iterator resync = this->capab->CapKeys.find("RESYNC");
+		CanResync = ((Utils->ResyncWindow) && (resync != this->capab->CapKeys.end()) && (resync->second == "1"));
+
 		if (this->capab->CapKeys.find("PROTOCOL") == this->capab->CapKeys.end())
 		{
 			reason = "Protocol version not specified";
@@ -364,6 +374,14 @@ bool TreeSocket::Capab(const parameterlist &params)
 			capab->OptModuleList.append(params[1]);
 		}
 	}
+	else if ((params[0] == "RESYNC") && (params.size() == 4))
+	{
+		/* Sent before SERVER by a server that is holding our lost link */
+		capab->resync = true;
+		capab->resync_received = strtoul(params[1].c_str(), NULL, 10);
+		capab->resync_first = strtoul(params[2].c_str(), NULL, 10);
+		capab->resync_sent = strtoul(params[3].c_str(), NULL, 10);
+	}
 	else if ((params[0] == "CHANMODES") && (params.size() == 2))
 	{
 		capab->ChanModes = params[1];
@@ -22,6 +22,8 @@
 
 #include "main.h"
 
+class TreeSocket;
+
 /** Handle /RCONNECT
  */
 class CommandRConnect : public Command
@@ -85,12 +87,21 @@ class CommandOpertype : public Command
 	CmdResult Handle (const std::vector<std::string>& parameters, User *user);
 	RouteDescriptor GetRouting(User* user, const std::vector<std::string>& parameters) { return ROUTE_BROADCAST; }
 };
+/** Handle FJOIN, and BJOIN which is its batched form used for netbursts to
+ * servers which negotiated BURSTV2
+ */
 class CommandFJoin : public Command
 {
+	/** True if this handles BJOIN rather than FJOIN */
+	bool batched;
+
+	/** Pass a BJOIN on to the other directly connected servers
+	 */
+	void ForwardBatched(const std::vector<std::string>& params, User* srcuser, TreeSocket* src_socket, const std::vector<std::string>& items);
  public:
-	CommandFJoin(Module* Creator) : Command(Creator, "FJOIN", 3) { flags_needed = FLAG_SERVERONLY; }
+	CommandFJoin(Module* Creator, bool Batched = false) : Command(Creator, Batched ? "BJOIN" : "FJOIN", 3), batched(Batched) { flags_needed = FLAG_SERVERONLY; }
 	CmdResult Handle (const std::vector<std::string>& parameters, User *user);
-	RouteDescriptor GetRouting(User* user, const std::vector<std::string>& parameters) { return ROUTE_BROADCAST; }
+	RouteDescriptor GetRouting(User* user, const std::vector<std::string>& parameters) { return batched ? ROUTE_LOCALONLY : ROUTE_BROADCAST; }
 	/** Remove all modes from a channel, including statusmodes (+qaovh etc), simplemodes, parameter modes.
 	 * This does not update the timestamp of the target channel, this must be done seperately.
 	 */
@@ -144,6 +155,7 @@ class SpanningTreeCommands
 	CommandUID uid;
 	CommandOpertype opertype;
 	CommandFJoin fjoin;
+	CommandFJoin bjoin;
 	CommandFMode fmode;
 	CommandFTopic ftopic;
 	CommandFHost fhost;
@@ -113,6 +113,13 @@ void TreeSocket::CompatAddModules(std::vector<std::string>& modlist)
 
 void TreeSocket::WriteLine(std::string line)
 {
+	if (LinkState == DETACHED)
+	{
+		// Kept for the remote server until it comes back
+		journal.Add(line, Utils->ResyncJournalMax);
+		return;
+	}
+
 	if (LinkState == CONNECTED)
 	{
 		if (line[0] != ':')
@@ -193,4 +200,6 @@ void TreeSocket::WriteLine(std::string line)
 		this->WriteData(wide_newline);
 	else
 		this->WriteData(newline);
+	if (journal.active)
+		journal.Add(line, Utils->ResyncJournalMax);
 }
@@ -25,6 +25,57 @@
 #include "treeserver.h"
 #include "treesocket.h"
 
+/** Read the next member from an FJOIN or BJOIN member list.
+ * FJOIN members are 'modes,uuid' pairs. BJOIN only names a SID when it
+ * changes, as '=SID', and members are '[modes,]ID' with the SID stripped.
+ * The list is walked in place rather than through irc::tokenstream.
+ */
+static bool GetMember(const std::string& list, std::string::size_type& pos, bool batched, std::string& sid, std::string& modes, std::string& uuid)
+{
+	while (pos < list.length())
+	{
+		std::string::size_type start = list.find_first_not_of(' ', pos);
+		if (start == std::string::npos)
+			break;
+		std::string::size_type end = list.find(' ', start);
+		if (end == std::string::npos)
+			end = list.length();
+		pos = end;
+
+		if (batched && list[start] == '=')
+		{
+			sid.assign(list, start + 1, end - start - 1);
+			continue;
+		}
+
+		std::string::size_type comma = list.find(',', start);
+		std::string::size_type idpos;
+		if (comma < end)
+		{
+			modes.assign(list, start, comma - start);
+			idpos = comma + 1;
+		}
+		else if (batched)
+		{
+			modes.clear();
+			idpos = start;
+		}
+		else
+		{
+			modes.assign(list, start, end - start);
+			idpos = end;
+		}
+
+		uuid.clear();
+		if (batched)
+			uuid.append(sid);
+		if (idpos < end)
+			uuid.append(list, idpos, end - idpos);
+		return true;
+	}
+	return false;
+}
+
 /** FJOIN, almost identical to TS6 SJOIN, except for nicklist handling. */
 CmdResult CommandFJoin::Handle(const std::vector<std::string>& params, User *srcuser)
 {
@@ -60,11 +111,13 @@ CmdResult CommandFJoin::Handle(const std::vector<std::string>& params, User *src
 	User* who = NULL;		   				/* User we are currently checking */
 	std::string channel = params[0];				/* Channel name, as a string */
 	time_t TS = atoi(params[1].c_str());    			/* Timestamp given to us for remote side */
-	irc::tokenstream users((params.size() > 3) ? params[params.size() - 1] : "");   /* users from the user list */
+	const std::string& users = params.back();			/* users from the user list */
 	bool apply_other_sides_modes = true;				/* True if we are accepting the other side's modes */
 	Channel* chan = ServerInstance->FindChan(channel);		/* The channel we're sending joins to */
 	bool created = !chan;						/* True if the channel doesnt exist here yet */
-	std::string item;						/* One item in the list of nicks */
+	std::string::size_type userpos = (params.size() > 3) ? 0 : std::string::npos;	/* Position of the next item in the list of nicks */
+	std::string sid, modes, uuid;					/* One item in the list of nicks */
+	std::vector<std::string> fjoinitems;				/* Members as 'modes,uuid' for forwarding a BJOIN as FJOIN */
 
 	TreeSocket* src_socket = Utils->FindServer(srcuser->server)->GetRoute()->GetSocket();
 
@@ -156,53 +209,41 @@ CmdResult CommandFJoin::Handle(const std::vector<std::string>& params, User *src
 	}
 
 	/* Now, process every 'modes,nick' pair */
-	while (users.GetToken(item))
+	while (GetMember(users, userpos, batched, sid, modes, uuid))
 	{
-		const char* usr = item.c_str();
-		if (usr && *usr)
+		/* Iterate through all modes for this user and check they are valid. */
+		for (std::string::const_iterator x = modes.begin(); x != modes.end(); ++x)
 		{
-			const char* unparsedmodes = usr;
-			std::string modes;
-
-
-			/* Iterate through all modes for this user and check they are valid. */
-			while ((*unparsedmodes) && (*unparsedmodes != ','))
+			ModeHandler *mh = ServerInstance->Modes->FindMode(*x, MODETYPE_CHANNEL);
+			if (!mh)
 			{
-				ModeHandler *mh = ServerInstance->Modes->FindMode(*unparsedmodes, MODETYPE_CHANNEL);
-				if (!mh)
-				{
-					ServerInstance->Logs->Log("m_spanningtree", SPARSE, "Unrecognised mode %c, dropping link", *unparsedmodes);
-					return CMD_INVALID;
-				}
-
-				modes += *unparsedmodes;
-				usr++;
-				unparsedmodes++;
+				ServerInstance->Logs->Log("m_spanningtree", SPARSE, "Unrecognised mode %c, dropping link", *x);
+				return CMD_INVALID;
 			}
+		}
 
-			/* Advance past the comma, to the nick */
-			usr++;
+		if (batched)
+			fjoinitems.push_back(modes + "," + uuid);
 
-			/* Check the user actually exists */
-			who = ServerInstance->FindUUID(usr);
-			if (who)
-			{
-				/* Check that the user's 'direction' is correct */
-				TreeServer* route_back_again = Utils->BestRouteTo(who->server);
-				if ((!route_back_again) || (route_back_again->GetSocket() != src_socket))
-					continue;
+		/* Check the user actually exists */
+		who = ServerInstance->FindUUID(uuid);
+		if (who)
+		{
+			/* Check that the user's 'direction' is correct */
+			TreeServer* route_back_again = Utils->BestRouteTo(who->server);
+			if ((!route_back_again) || (route_back_again->GetSocket() != src_socket))
+				continue;
 
-				/* Add any modes this user had to the mode stack */
-				for (std::string::iterator x = modes.begin(); x != modes.end(); ++x)
-					modestack.Push(*x, who->nick);
+			/* Add any modes this user had to the mode stack */
+			for (std::string::iterator x = modes.begin(); x != modes.end(); ++x)
+				modestack.Push(*x, who->nick);
 
-				Channel::JoinUser(who, channel.c_str(), true, "", route_back_again->bursting, TS);
-			}
-			else
-			{
-				ServerInstance->Logs->Log("m_spanningtree",SPARSE, "Ignored nonexistant user %s in fjoin to %s (probably quit?)", usr, channel.c_str());
-				continue;
-			}
+			Channel::JoinUser(who, channel.c_str(), true, "", route_back_again->bursting, TS);
+		}
+		else
+		{
+			ServerInstance->Logs->Log("m_spanningtree",SPARSE, "Ignored nonexistant user %s in fjoin to %s (probably quit?)", uuid.c_str(), channel.c_str());
+			continue;
 		}
 	}
 
@@ -218,9 +259,67 @@ CmdResult CommandFJoin::Handle(const std::vector<std::string>& params, User *src
 			stackresult.erase(stackresult.begin() + 1, stackresult.end());
 		}
 	}
+
+	if (batched)
+		ForwardBatched(params, srcuser, src_socket, fjoinitems);
 	return CMD_SUCCESS;
 }
 
+/** BJOIN is not routed by RouteCommand as servers without BURSTV2 cannot
+ * parse it. Pass it on unchanged where the link allows it, and as FJOIN
+ * lines split at 480 bytes everywhere else.
+ */
+void CommandFJoin::ForwardBatched(const std::vector<std::string>& params, User* srcuser, TreeSocket* src_socket, const std::vector<std::string>& items)
+{
+	SpanningTreeUtilities* Utils = ((ModuleSpanningTree*)(Module*)creator)->Utils;
+	const unsigned int headparams = (params.size() > 3) ? params.size() - 1 : params.size();
+	std::string head;
+	for (unsigned int i = 0; i < headparams; i++)
+		head.append(" ").append(params[i]);
+	head.append(" :");
+
+	std::string batchline;
+	std::string fjoinlines;
+
+	for (unsigned int x = 0; x < Utils->TreeRoot->ChildCount(); x++)
+	{
+		TreeSocket* sock = Utils->TreeRoot->GetChild(x)->GetSocket();
+		if (!sock || sock == src_socket)
+			continue;
+
+		if (sock->CanBatchBurst())
+		{
+			if (batchline.empty())
+			{
+				batchline = ":" + srcuser->uuid + " BJOIN" + head;
+				if (params.size() > 3)
+					batchline.append(params.back());
+			}
+			sock->WriteLine(batchline);
+			continue;
+		}
+
+		if (fjoinlines.empty())
+		{
+			std::string line = ":" + srcuser->uuid + " FJOIN" + head;
+			const std::string::size_type headlen = line.length();
+			for (std::vector<std::string>::const_iterator i = items.begin(); i != items.end(); ++i)
+			{
+				if ((line.length() > headlen) && (line.length() + i->length() + 1 > 480))
+				{
+					fjoinlines.append(line).append("\r\n");
+					line.erase(headlen);
+				}
+				if (line.length() > headlen)
+					line.push_back(' ');
+				line.append(*i);
+			}
+			fjoinlines.append(line);
+		}
+		sock->WriteLine(fjoinlines);
+	}
+}
+
 void CommandFJoin::RemoveStatus(User* srcuser, parameterlist &params)
 {
 	if (params.size() < 1)
@@ -47,7 +47,7 @@ ModuleSpanningTree::ModuleSpanningTree()
 SpanningTreeCommands::SpanningTreeCommands(ModuleSpanningTree* module)
 	: rconnect(module, module->Utils), rsquit(module, module->Utils),
 	svsjoin(module), svspart(module), svsnick(module), metadata(module),
-	uid(module), opertype(module), fjoin(module), fmode(module), ftopic(module),
+	uid(module), opertype(module), fjoin(module), bjoin(module, true), fmode(module), ftopic(module),
 	fhost(module), fident(module), fname(module)
 {
 }
@@ -63,11 +63,13 @@ void ModuleSpanningTree::init()
 	ServerInstance->Modules->AddService(commands->uid);
 	ServerInstance->Modules->AddService(commands->opertype);
 	ServerInstance->Modules->AddService(commands->fjoin);
+	ServerInstance->Modules->AddService(commands->bjoin);
 	ServerInstance->Modules->AddService(commands->fmode);
 	ServerInstance->Modules->AddService(commands->ftopic);
 	ServerInstance->Modules->AddService(commands->fhost);
 	ServerInstance->Modules->AddService(commands->fident);
 	ServerInstance->Modules->AddService(commands->fname);
+	ServerInstance->Modules->AddService(Utils->ChannelRoutes);
 	RefreshTimer = new CacheRefreshTimer(Utils);
 	ServerInstance->Timers->AddTimer(RefreshTimer);
 
@@ -170,6 +172,23 @@ restart:
 			goto restart;
 		}
 
+		if (s->GetSocket() && s->GetSocket()->GetLinkState() == DETACHED)
+		{
+			TreeSocket* sock = s->GetSocket();
+			if (curtime >= sock->GetDetachTime() + Utils->ResyncWindow)
+			{
+				ServerInstance->SNO->WriteGlobalSno('l', "Server \002%s\002 did not come back within %d seconds, splitting it", s->GetName().c_str(), Utils->ResyncWindow);
+				sock->DropDetached();
+				goto restart;
+			}
+
+			// Only the server with the lower SID reconnects, so both do not race to resync
+			Link* x = Utils->FindLink(s->GetName());
+			if ((x) && (ServerInstance->Config->GetSID() < s->GetID()) && (!Utils->IsConnecting(assign(x->Name))))
+				ConnectServer(x);
+			continue;
+		}
+
 		// Fix for bug #792, do not ping servers that are not connected yet!
 		// Remote servers have Socket == NULL and local connected servers have
 		// Socket->LinkState == CONNECTED
@@ -179,6 +198,10 @@ restart:
 		// Now do PING checks on all servers
 		TreeServer *mts = Utils->BestRouteTo(s->GetID());
 
+		// Servers behind a lost link are pinged again once it has resynced
+		if (mts && mts->GetSocket() && mts->GetSocket()->GetLinkState() == DETACHED)
+			continue;
+
 		if (mts)
 		{
 			// Only ping if this server needs one
@@ -205,7 +228,7 @@ restart:
 					TreeSocket *sock = s->GetSocket();
 					if (sock)
 					{
-						sock->SendError("Ping timeout");
+						sock->LoseLink("Ping timeout");
 						sock->Close();
 						goto restart;
 					}
@@ -601,10 +624,13 @@ void ModuleSpanningTree::OnUserConnect(LocalUser* user)
 		Utils->DoOneToMany(user->uuid,"OPERTYPE",params);
 	}
 
-	for(Extensible::ExtensibleStore::const_iterator i = user->GetExtList().begin(); i != user->GetExtList().end(); i++)
+	const Extensible::ExtensibleStore& list = user->GetExtList();
+	for (unsigned int slot = 0; slot < list.size(); slot++)
 	{
-		ExtensionItem* item = i->first;
-		std::string value = item->serialize(FORMAT_NETWORK, user, i->second);
+		ExtensionItem* item = ExtensionItem::FromSlot(slot);
+		if (!item || !list[slot])
+			continue;
+		std::string value = item->serialize(FORMAT_NETWORK, user, list[slot]);
 		if (!value.empty())
 			ServerInstance->PI->SendMetaData(user, item->name, value);
 	}
@@ -614,6 +640,8 @@ void ModuleSpanningTree::OnUserConnect(LocalUser* user)
 
 void ModuleSpanningTree::OnUserJoin(Membership* memb, bool sync, bool created, CUList& excepts)
 {
+	Utils->AddChannelRoute(memb);
+
 	// Only do this for local users
 	if (IS_LOCAL(memb->user))
 	{
@@ -661,6 +689,8 @@ void ModuleSpanningTree::OnChangeIdent(User* user, const std::string &ident)
 
 void ModuleSpanningTree::OnUserPart(Membership* memb, std::string &partmessage, CUList& excepts)
 {
+	Utils->DelChannelRoute(memb);
+
 	if (IS_LOCAL(memb->user))
 	{
 		parameterlist params;
@@ -686,6 +716,16 @@ void ModuleSpanningTree::OnUserQuit(User* user, const std::string &reason, const
 		params.push_back(":"+reason);
 		Utils->DoOneToMany(user->uuid,"QUIT",params);
 	}
+	else if (!IS_LOCAL(user))
+	{
+		// The channels are only left when the user is culled, drop the routes now
+		for (UCListIter i = user->chans.begin(); i != user->chans.end(); ++i)
+		{
+			Membership* memb = (*i)->GetUser(user);
+			if (memb)
+				Utils->DelChannelRoute(memb);
+		}
+	}
 
 	// Regardless, We need to modify the user Counts..
 	TreeServer* SourceServer = Utils->FindServer(user->server);
@@ -721,6 +761,8 @@ void ModuleSpanningTree::OnUserPostNick(User* user, const std::string &oldnick)
 
 void ModuleSpanningTree::OnUserKick(User* source, Membership* memb, const std::string &reason, CUList& excepts)
 {
+	Utils->DelChannelRoute(memb);
+
 	parameterlist params;
 	params.push_back(memb->chan->name);
 	params.push_back(memb->user->uuid);
@@ -41,6 +41,7 @@ void TreeSocket::DoBurst(TreeServer* s)
 		capab->auth_challenge ? "challenge-response" : "plaintext password");
 	this->CleanNegotiationInfo();
 	this->WriteLine(":" + ServerInstance->Config->GetSID() + " BURST " + ConvToStr(ServerInstance->Time()));
+	journal.active = CanResync;
 	/* send our version string */
 	this->WriteLine(":" + ServerInstance->Config->GetSID() + " VERSION :"+ServerInstance->GetVersionString());
 	/* Send server tree */
@@ -91,53 +92,59 @@ void TreeSocket::SendServers(TreeServer* Current, TreeServer* s, int hops)
 void TreeSocket::SendFJoins(Channel* c)
 {
 	std::string buffer;
-	char list[MAXBUF];
-
-	size_t curlen, headlen;
-	curlen = headlen = snprintf(list,MAXBUF,":%s FJOIN %s %lu +%s :",
-		ServerInstance->Config->GetSID().c_str(), c->name.c_str(), (unsigned long)c->age, c->ChanModes(true));
-	int numusers = 0;
-	char* ptr = list + curlen;
-	bool looped_once = false;
-
-	const UserMembList *ulist = c->GetUsers();
 	std::string modes;
 	std::string params;
 
-	for (UserMembCIter i = ulist->begin(); i != ulist->end(); i++)
+	if (BatchedBurst)
+		SendBatchedFJoins(c, buffer);
+	else
 	{
-		size_t ptrlen = 0;
-		std::string modestr = i->second->modes;
+		char list[MAXBUF];
+
+		size_t curlen, headlen;
+		curlen = headlen = snprintf(list,MAXBUF,":%s FJOIN %s %lu +%s :",
+			ServerInstance->Config->GetSID().c_str(), c->name.c_str(), (unsigned long)c->age, c->ChanModes(true));
+		int numusers = 0;
+		char* ptr = list + curlen;
+		bool looped_once = false;
 
-		if ((curlen + modestr.length() + i->first->uuid.length() + 4) > 480)
+		const UserMembList *ulist = c->GetUsers();
+
+		for (UserMembCIter i = ulist->begin(); i != ulist->end(); i++)
 		{
-			// remove the final space
-			if (ptr[-1] == ' ')
-				ptr[-1] = '\0';
-			buffer.append(list).append("\r\n");
-			curlen = headlen;
-			ptr = list + headlen;
-			numusers = 0;
-		}
+			size_t ptrlen = 0;
+			std::string modestr = i->second->modes;
 
-		ptrlen = snprintf(ptr, MAXBUF-curlen, "%s,%s ", modestr.c_str(), i->first->uuid.c_str());
+			if ((curlen + modestr.length() + i->first->uuid.length() + 4) > 480)
+			{
+				// remove the final space
+				if (ptr[-1] == ' ')
+					ptr[-1] = '\0';
+				buffer.append(list).append("\r\n");
+				curlen = headlen;
+				ptr = list + headlen;
+				numusers = 0;
+			}
 
-		looped_once = true;
+			ptrlen = snprintf(ptr, MAXBUF-curlen, "%s,%s ", modestr.c_str(), i->first->uuid.c_str());
 
-		curlen += ptrlen;
-		ptr += ptrlen;
+			looped_once = true;
 
-		numusers++;
-	}
+			curlen += ptrlen;
+			ptr += ptrlen;
 
-	// Okay, permanent channels will (of course) need this \r\n anyway, numusers check is if there
-	// actually were people in the channel (looped_once == true)
-	if (!looped_once || numusers > 0)
-	{
-		// remove the final space
-		if (ptr[-1] == ' ')
-			ptr[-1] = '\0';
-		buffer.append(list).append("\r\n");
+			numusers++;
+		}
+
+		// Okay, permanent channels will (of course) need this \r\n anyway, numusers check is if there
+		// actually were people in the channel (looped_once == true)
+		if (!looped_once || numusers > 0)
+		{
+			// remove the final space
+			if (ptr[-1] == ' ')
+				ptr[-1] = '\0';
+			buffer.append(list).append("\r\n");
+		}
 	}
 
 	int linesize = 1;
@@ -168,6 +175,53 @@ void TreeSocket::SendFJoins(Channel* c)
 	this->WriteLine(buffer);
 }
 
+static bool MemberUUIDLess(Membership* a, Membership* b)
+{
+	return a->user->uuid < b->user->uuid;
+}
+
+/** Send the members of a channel as batched BJOIN lines.
+ * Members are sorted by UUID so that each SID is only sent once per line,
+ * as "=SID", and every member after it is sent as "[modes,]ID" with the
+ * SID stripped. A line carries up to BJOIN_MAX_MEMBERS members as the
+ * 512 byte limit does not apply between servers.
+ */
+void TreeSocket::SendBatchedFJoins(Channel* c, std::string& buffer)
+{
+	std::string header = ":" + ServerInstance->Config->GetSID() + " BJOIN " + c->name + " " + ConvToStr(c->age) + " +" + c->ChanModes(true) + " :";
+
+	const UserMembList *ulist = c->GetUsers();
+	std::vector<Membership*> members;
+	members.reserve(ulist->size());
+	for (UserMembCIter i = ulist->begin(); i != ulist->end(); i++)
+		members.push_back(i->second);
+	std::sort(members.begin(), members.end(), MemberUUIDLess);
+
+	std::vector<Membership*>::const_iterator i = members.begin();
+	do
+	{
+		buffer.append(header);
+		std::string::size_type listpos = buffer.length();
+		const char* cursid = NULL;
+		for (unsigned int count = 0; (i != members.end()) && (count < BJOIN_MAX_MEMBERS); ++i, ++count)
+		{
+			const std::string& uuid = (*i)->user->uuid;
+			if (buffer.length() != listpos)
+				buffer.push_back(' ');
+			if (!cursid || uuid.compare(0, 3, cursid, 3))
+			{
+				cursid = uuid.c_str();
+				buffer.push_back('=');
+				buffer.append(uuid, 0, 3).push_back(' ');
+			}
+			if (!(*i)->modes.empty())
+				buffer.append((*i)->modes).push_back(',');
+			buffer.append(uuid, 3, std::string::npos);
+		}
+		buffer.append("\r\n");
+	} while (i != members.end());
+}
+
 /** Send all XLines we know about */
 void TreeSocket::SendXLines()
 {
@@ -224,10 +278,13 @@ void TreeSocket::SendChannelModes()
 			this->WriteLine(data);
 		}
 
-		for(Extensible::ExtensibleStore::const_iterator i = c->second->GetExtList().begin(); i != c->second->GetExtList().end(); i++)
+		const Extensible::ExtensibleStore& list = c->second->GetExtList();
+		for (unsigned int slot = 0; slot < list.size(); slot++)
 		{
-			ExtensionItem* item = i->first;
-			std::string value = item->serialize(FORMAT_NETWORK, c->second, i->second);
+			ExtensionItem* item = ExtensionItem::FromSlot(slot);
+			if (!item || !list[slot])
+				continue;
+			std::string value = item->serialize(FORMAT_NETWORK, c->second, list[slot]);
 			if (!value.empty())
 				Utils->Creator->ProtoSendMetaData(this, c->second, item->name, value);
 		}
@@ -272,10 +329,13 @@ void TreeSocket::SendUsers()
 				}
 			}
 
-			for(Extensible::ExtensibleStore::const_iterator i = u->second->GetExtList().begin(); i != u->second->GetExtList().end(); i++)
+			const Extensible::ExtensibleStore& list = u->second->GetExtList();
+			for (unsigned int slot = 0; slot < list.size(); slot++)
 			{
-				ExtensionItem* item = i->first;
-				std::string value = item->serialize(FORMAT_NETWORK, u->second, i->second);
+				ExtensionItem* item = ExtensionItem::FromSlot(slot);
+				if (!item || !list[slot])
+					continue;
+				std::string value = item->serialize(FORMAT_NETWORK, u->second, list[slot]);
 				if (!value.empty())
 					Utils->Creator->ProtoSendMetaData(this, u->second, item->name, value);
 			}
@@ -60,6 +60,11 @@ bool TreeSocket::RemoteServer(const std::string &prefix, parameterlist &params)
 		this->SendError("Invalid format server ID: "+sid+"!");
 		return false;
 	}
+	// It has found another way to the network while we were waiting for it to resync
+	TreeSocket* held = FindDetached(servername, sid);
+	if (held)
+		held->DropDetached();
+
 	TreeServer* CheckDupe = Utils->FindServer(servername);
 	if (CheckDupe)
 	{
@@ -134,6 +139,29 @@ bool TreeSocket::Outbound_Reply_Server(parameterlist &params)
 			continue;
 		}
 
+		TreeSocket* held = FindDetached(sname, sid);
+		if (held)
+		{
+			if ((capab->resync) && (CanResync) && (held->MyRoot->GetName() == sname) && (held->MyRoot->GetID() == sid) &&
+				(held->journal.CanReplayFrom(capab->resync_received)) &&
+				(held->journal.received >= capab->resync_first) && (held->journal.received <= capab->resync_sent))
+			{
+				/*
+				 * Both sides kept the link and can replay what the other side missed,
+				 * so send that instead of a netburst. Nothing changes for the rest of
+				 * the network, so there is no SERVER to pass on either.
+				 */
+				this->LinkState = CONNECTED;
+				Utils->timeoutlist.erase(this);
+				linkID = sname;
+				this->Reattach(held, capab->resync_received);
+				return true;
+			}
+
+			// One side has lost track of the link, fall back to a netburst
+			held->DropDetached();
+		}
+
 		TreeServer* CheckDupe = Utils->FindServer(sname);
 		if (CheckDupe)
 		{
@@ -208,6 +236,20 @@ bool TreeSocket::CheckDuplicate(const std::string& sname, const std::string& sid
 	return true;
 }
 
+TreeSocket* TreeSocket::FindDetached(const std::string& sname, const std::string& sid)
+{
+	TreeServer* s = Utils->FindServer(sname);
+	if (!s)
+		s = Utils->FindServerID(sid);
+	if ((!s) || (s == Utils->TreeRoot))
+		return NULL;
+
+	TreeSocket* sock = s->GetRoute()->GetSocket();
+	if ((sock) && (sock->LinkState == DETACHED))
+		return sock;
+	return NULL;
+}
+
 /*
  * Someone else is attempting to connect to us if this is called. Validate their credentials etc.
  *		-- w
@@ -254,7 +296,15 @@ bool TreeSocket::Inbound_Server(parameterlist &params)
 			continue;
 		}
 
-		if (!CheckDuplicate(sname, sid))
+		TreeSocket* held = FindDetached(sname, sid);
+		if ((held) && ((!CanResync) || (held->MyRoot->GetName() != sname) || (held->MyRoot->GetID() != sid)))
+		{
+			// Only the same server can resync the lost link, and only if it kept it too
+			held->DropDetached();
+			held = NULL;
+		}
+
+		if ((!held) && (!CheckDuplicate(sname, sid)))
 			return false;
 
 		ServerInstance->SNO->WriteToSnoMask('l',"Verified incoming server connection " + linkID + " ("+description+")");
@@ -267,6 +317,10 @@ bool TreeSocket::Inbound_Server(parameterlist &params)
 		this->capab->description = description;
 		this->capab->name = sname;
 
+		// Offer to resync the link we are holding; they reply with BURST and a line count if they can
+		if (held)
+			this->WriteLine("CAPAB RESYNC " + ConvToStr(held->journal.received) + " " + ConvToStr(held->journal.first) + " " + ConvToStr(held->journal.sent));
+
 		// Send our details: Our server name and description and hopcount of 0,
 		// along with the sendpass from this block.
 		this->WriteLine("SERVER "+ServerInstance->Config->ServerName+" "+this->MakePass(x->SendPass, this->GetTheirChallenge())+" 0 "+ServerInstance->Config->GetSID()+" :"+ServerInstance->Config->ServerDesc);
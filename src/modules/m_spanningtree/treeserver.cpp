@@ -163,34 +163,6 @@ void TreeServer::SetID(const std::string &id)
 	Utils->sidlist[sid] = this;
 }
 
-int TreeServer::QuitUsers(const std::string &reason)
-{
-	const char* reason_s = reason.c_str();
-	std::vector<User*> time_to_die;
-	for (user_hash::iterator n = ServerInstance->Users->clientlist->begin(); n != ServerInstance->Users->clientlist->end(); n++)
-	{
-		if (n->second->server == ServerName)
-		{
-			time_to_die.push_back(n->second);
-		}
-	}
-	for (std::vector<User*>::iterator n = time_to_die.begin(); n != time_to_die.end(); n++)
-	{
-		User* a = (User*)*n;
-		if (!IS_LOCAL(a))
-		{
-			if (this->Utils->quiet_bursts)
-				a->quietquit = true;
-
-			if (ServerInstance->Config->HideSplits)
-				ServerInstance->Users->QuitUser(a, "*.net *.split", reason_s);
-			else
-				ServerInstance->Users->QuitUser(a, reason_s);
-		}
-	}
-	return time_to_die.size();
-}
-
 /** This method is used to add the structure to the
  * hash_map for linear searches. It is only called
  * by the constructors.
@@ -282,6 +254,11 @@ TreeSocket* TreeServer::GetSocket()
 	return Socket;
 }
 
+void TreeServer::SetSocket(TreeSocket* sock)
+{
+	Socket = sock;
+}
+
 TreeServer* TreeServer::GetParent()
 {
 	return Parent;
@@ -79,8 +79,6 @@ class TreeServer : public classbase
 	 */
 	TreeServer(SpanningTreeUtilities* Util, std::string Name, std::string Desc, const std::string &id, TreeServer* Above, TreeSocket* Sock, bool Hide);
 
-	int QuitUsers(const std::string &reason);
-
 	/** This method is used to add the structure to the
 	 * hash_map for linear searches. It is only called
 	 * by the constructors.
@@ -164,6 +162,10 @@ class TreeServer : public classbase
 	 */
 	TreeSocket* GetSocket();
 
+	/** Move a directly connected server to a new socket, see TreeSocket::Reattach
+	 */
+	void SetSocket(TreeSocket* sock);
+
 	/** Get the parent server.
 	 * For the root node, this returns NULL.
 	 */
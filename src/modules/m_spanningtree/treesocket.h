@@ -61,8 +61,43 @@
  * CONNECTED:   represents a fully authorized, fully
  *							connected server.
  * DYING:       represents a server that has had an error.
+ * DETACHED:    represents a connected server whose link was
+ *							lost, but which is kept on the network
+ *							for a while in case it comes back and
+ *							can be resynchronised from the journal.
  */
-enum ServerState { CONNECTING, WAIT_AUTH_1, WAIT_AUTH_2, CONNECTED, DYING };
+enum ServerState { CONNECTING, WAIT_AUTH_1, WAIT_AUTH_2, CONNECTED, DYING, DETACHED };
+
+/** Lines sent to a directly connected server after our BURST, numbered from
+ * zero, and a count of the lines received from it after its BURST. When a
+ * link is lost and re-established within <options:resyncwindow>, each side
+ * replays what the other did not receive instead of sending a netburst.
+ */
+class ResyncJournal
+{
+ public:
+	std::deque<std::string> lines;		/* Lines kept for a replay, oldest first */
+	unsigned long first;			/* Sequence number of lines.front() */
+	unsigned long sent;			/* Sequence number of the next line we send */
+	unsigned long received;			/* Lines received from the remote server */
+	size_t bytes;				/* Total size of lines */
+	bool active;				/* True once our BURST has been sent */
+
+	ResyncJournal() : first(0), sent(0), received(0), bytes(0), active(false) { }
+
+	/** Record one or more lines (separated by CRLF) sent to the remote server,
+	 * dropping the oldest lines once the journal is larger than maxbytes
+	 */
+	void Add(const std::string& line, size_t maxbytes);
+
+	/** Returns true if every line from seq onwards is still in the journal
+	 */
+	bool CanReplayFrom(unsigned long seq) const { return ((seq >= first) && (seq <= sent)); }
+};
+
+/** Maximum number of channel members sent in a single BJOIN line
+ */
+const unsigned int BJOIN_MAX_MEMBERS = 512;
 
 struct CapabData
 {
@@ -78,6 +113,10 @@ struct CapabData
 	int capab_phase;			/* Have sent CAPAB already */
 	bool auth_fingerprint;			/* Did we auth using SSL fingerprint */
 	bool auth_challenge;			/* Did we auth using challenge/response */
+	bool resync;				/* Other server is holding our lost link (CAPAB RESYNC) */
+	unsigned long resync_received;		/* Lines it received from us on that link */
+	unsigned long resync_first;		/* First line it can still replay to us */
+	unsigned long resync_sent;		/* Lines it has sent us on that link */
 
 	// Data saved from incoming SERVER command, for later use when our credentials have been accepted by the other party
 	std::string description;
@@ -100,12 +139,30 @@ class TreeSocket : public BufferedSocket
 	time_t NextPing;			/* Time when we are due to ping this server */
 	bool LastPingWasGood;			/* Responded to last ping we sent? */
 	int proto_version;			/* Remote protocol version */
+	bool BatchedBurst;			/* Remote side accepts batched BJOIN (BURSTV2 in CAPAB) */
+	bool CanResync;				/* Remote side can resync after a split (RESYNC in CAPAB) */
+	bool LinkLost;				/* Link was lost rather than closed on purpose */
+	time_t DetachTime;			/* When the link was lost, if DETACHED */
+	ResyncJournal journal;			/* Data for resynchronising after a lost link */
 	bool ConnectionFailureShown; /* Set to true if a connection failure message was shown */
 
 	/** Checks if the given servername and sid are both free
 	 */
 	bool CheckDuplicate(const std::string& servername, const std::string& sid);
 
+	/** Find a lost link to the given server that can still be resynchronised
+	 */
+	TreeSocket* FindDetached(const std::string& servername, const std::string& sid);
+
+	/** Take over the server, journal and sequence numbers of a lost link to
+	 * the same server and send it everything it missed from seq onwards
+	 */
+	void Reattach(TreeSocket* old, unsigned long seq);
+
+	/** Keep the server on the network after the link was lost, see DETACHED
+	 */
+	void Detach();
+
  public:
 	time_t age;
 
@@ -206,13 +263,15 @@ class TreeSocket : public BufferedSocket
 
 	bool Capab(const parameterlist &params);
 
-	/** This function forces this server to quit, removing this server
-	 * and any users on it (and servers and users below that, etc etc).
-	 * It's very slow and pretty clunky, but luckily unless your network
-	 * is having a REAL bad hair day, this function shouldnt be called
-	 * too many times a month ;-)
+	/** Collect the names of a server which is quitting and of all the
+	 * servers behind it, so their users can be removed in one batch
+	 */
+	void SquitServer(TreeServer* Current, std::set<std::string>& lost_servers);
+
+	/** Quit every user on the given servers at once
+	 * @return The number of users removed
 	 */
-	void SquitServer(std::string &from, TreeServer* Current, int& num_lost_servers, int& num_lost_users);
+	int QuitUsers(const std::set<std::string>& lost_servers, const std::string& from);
 
 	/** This is a wrapper function for SquitServer above, which
 	 * does some validation first and passes on the SQUIT to all
@@ -229,6 +288,29 @@ class TreeSocket : public BufferedSocket
 	 */
 	void SendFJoins(Channel* c);
 
+	/** Send the members of a channel as BJOIN lines of up to
+	 * BJOIN_MAX_MEMBERS members each, only naming each SID once.
+	 * Used instead of FJOIN when the remote side has BURSTV2.
+	 */
+	void SendBatchedFJoins(Channel* c, std::string& buffer);
+
+	/** Returns true if the remote side negotiated BURSTV2 and accepts BJOIN
+	 */
+	bool CanBatchBurst() const { return BatchedBurst; }
+
+	/** Returns the time the link was lost at, if it is DETACHED
+	 */
+	time_t GetDetachTime() const { return DetachTime; }
+
+	/** Give up on an unresponsive link (ping timeout). If the link can
+	 * resync it is closed without sending ERROR, so that both sides hold it.
+	 */
+	void LoseLink(const std::string& reason);
+
+	/** Give up waiting for a lost link to come back and split the server
+	 */
+	void DropDetached();
+
 	/** Send G, Q, Z and E lines */
 	void SendXLines();
 
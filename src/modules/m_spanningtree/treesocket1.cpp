@@ -47,8 +47,13 @@ TreeSocket::TreeSocket(SpanningTreeUtilities* Util, Link* link, Autoconnect* mya
 	capab->link = link;
 	capab->ac = myac;
 	capab->capab_phase = 0;
+	capab->resync = false;
 	MyRoot = NULL;
 	proto_version = 0;
+	BatchedBurst = false;
+	CanResync = false;
+	LinkLost = false;
+	DetachTime = 0;
 	ConnectionFailureShown = false;
 	LinkState = CONNECTING;
 	if (!link->Hook.empty())
@@ -75,10 +80,15 @@ TreeSocket::TreeSocket(SpanningTreeUtilities* Util, int newfd, ListenSocket* via
 {
 	capab = new CapabData;
 	capab->capab_phase = 0;
+	capab->resync = false;
 	MyRoot = NULL;
 	age = ServerInstance->Time();
 	LinkState = WAIT_AUTH_1;
 	proto_version = 0;
+	BatchedBurst = false;
+	CanResync = false;
+	LinkLost = false;
+	DetachTime = 0;
 	ConnectionFailureShown = false;
 	linkID = "inbound from " + client->addr();
 
@@ -138,9 +148,23 @@ void TreeSocket::OnError(BufferedSocketError e)
 {
 	ServerInstance->SNO->WriteGlobalSno('l', "Connection to '\002%s\002' failed with error: %s",
 		linkID.c_str(), getError().c_str());
+	if ((LinkState == CONNECTED) && (CanResync))
+		LinkLost = true;
 	LinkState = DYING;
 }
 
+void TreeSocket::LoseLink(const std::string& reason)
+{
+	if ((LinkState == CONNECTED) && (CanResync))
+	{
+		LinkLost = true;
+		LinkState = DYING;
+		SetError(reason);
+	}
+	else
+		SendError(reason);
+}
+
 void TreeSocket::SendError(const std::string &errormessage)
 {
 	WriteLine("ERROR :"+errormessage);
@@ -149,29 +173,36 @@ void TreeSocket::SendError(const std::string &errormessage)
 	SetError(errormessage);
 }
 
-/** This function forces this server to quit, removing this server
- * and any users on it (and servers and users below that, etc etc).
- * It's very slow and pretty clunky, but luckily unless your network
- * is having a REAL bad hair day, this function shouldnt be called
- * too many times a month ;-)
+/** This function collects a server which is quitting and the servers
+ * attached to it, so that their users can be removed together.
  */
-void TreeSocket::SquitServer(std::string &from, TreeServer* Current, int& num_lost_servers, int& num_lost_users)
-{
-	std::string servername = Current->GetName();
-	ServerInstance->Logs->Log("m_spanningtree",DEBUG,"SquitServer for %s from %s",
-		servername.c_str(), from.c_str());
-	/* recursively squit the servers attached to 'Current'.
-	 * We're going backwards so we don't remove users
-	 * while we still need them ;)
-	 */
+void TreeSocket::SquitServer(TreeServer* Current, std::set<std::string>& lost_servers)
+{
+	ServerInstance->Logs->Log("m_spanningtree",DEBUG,"SquitServer for %s", Current->GetName().c_str());
 	for (unsigned int q = 0; q < Current->ChildCount(); q++)
+		this->SquitServer(Current->GetChild(q), lost_servers);
+	lost_servers.insert(Current->GetName());
+}
+
+int TreeSocket::QuitUsers(const std::set<std::string>& lost_servers, const std::string& from)
+{
+	std::vector<User*> time_to_die;
+	for (user_hash::iterator n = ServerInstance->Users->clientlist->begin(); n != ServerInstance->Users->clientlist->end(); n++)
 	{
-		TreeServer* recursive_server = Current->GetChild(q);
-		this->SquitServer(from,recursive_server, num_lost_servers, num_lost_users);
+		User* a = n->second;
+		if (!IS_LOCAL(a) && lost_servers.find(a->server) != lost_servers.end())
+		{
+			if (this->Utils->quiet_bursts)
+				a->quietquit = true;
+			time_to_die.push_back(a);
+		}
 	}
-	/* Now we've whacked the kids, whack self */
-	num_lost_servers++;
-	num_lost_users += Current->QuitUsers(from);
+
+	if (ServerInstance->Config->HideSplits)
+		ServerInstance->Users->QuitUsers(time_to_die, "*.net *.split", from.c_str(), "*.net *.split");
+	else
+		ServerInstance->Users->QuitUsers(time_to_die, from, "", from);
+	return time_to_die.size();
 }
 
 /** This is a wrapper function for SquitServer above, which
@@ -203,10 +234,10 @@ void TreeSocket::Squit(TreeServer* Current, const std::string &reason)
 		{
 			ServerInstance->SNO->WriteGlobalSno('L', "Server \002"+Current->GetName()+"\002 split from server \002"+Current->GetParent()->GetName()+"\002 with reason: "+reason);
 		}
-		int num_lost_servers = 0;
-		int num_lost_users = 0;
-		std::string from = Current->GetParent()->GetName()+" "+Current->GetName();
-		SquitServer(from, Current, num_lost_servers, num_lost_users);
+		std::set<std::string> lost_servers;
+		SquitServer(Current, lost_servers);
+		int num_lost_servers = lost_servers.size();
+		int num_lost_users = QuitUsers(lost_servers, Current->GetParent()->GetName()+" "+Current->GetName());
 		ServerInstance->SNO->WriteToSnoMask(LocalSquit ? 'l' : 'L', "Netsplit complete, lost \002%d\002 user%s on \002%d\002 server%s.",
 			num_lost_users, num_lost_users != 1 ? "s" : "", num_lost_servers, num_lost_servers != 1 ? "s" : "");
 		Current->Tidy();
@@ -253,3 +284,91 @@ bool TreeSocket::Introduced()
 {
 	return (capab == NULL);
 }
+
+void ResyncJournal::Add(const std::string& data, size_t maxbytes)
+{
+	std::string::size_type start = 0;
+	while (start < data.length())
+	{
+		std::string::size_type end = data.find('\n', start);
+		if (end == std::string::npos)
+			end = data.length();
+		std::string line = data.substr(start, end - start);
+		start = end + 1;
+
+		// The remote server does not count empty lines, so neither do we
+		if (!line.empty() && line[line.length() - 1] == '\r')
+			line.erase(line.length() - 1);
+		if (line.empty())
+			continue;
+
+		bytes += line.length();
+		lines.push_back(line);
+		sent++;
+	}
+
+	while (bytes > maxbytes && !lines.empty())
+	{
+		bytes -= lines.front().length();
+		lines.pop_front();
+		first++;
+	}
+}
+
+static void ResetPings(TreeServer* s)
+{
+	s->SetPingFlag();
+	s->Warned = false;
+	for (unsigned int q = 0; q < s->ChildCount(); q++)
+		ResetPings(s->GetChild(q));
+}
+
+void TreeSocket::Detach()
+{
+	this->BufferedSocket::Close();
+	LinkState = DETACHED;
+	DetachTime = ServerInstance->Time();
+	ServerInstance->SNO->WriteGlobalSno('l', "Lost link to \2%s\2 (%s), holding it for %d seconds to resync",
+		linkID.c_str(), getError().c_str(), Utils->ResyncWindow);
+}
+
+void TreeSocket::DropDetached()
+{
+	LinkState = DYING;
+	ServerInstance->GlobalCulls.AddItem(this);
+	if (MyRoot)
+		Squit(MyRoot, getError());
+}
+
+void TreeSocket::Reattach(TreeSocket* old, unsigned long seq)
+{
+	this->CleanNegotiationInfo();
+	MyRoot = old->MyRoot;
+	MyRoot->SetSocket(this);
+	ResetPings(MyRoot);
+	old->MyRoot = NULL;
+	old->LinkState = DYING;
+	old->ConnectionFailureShown = true;
+	ServerInstance->GlobalCulls.AddItem(old);
+
+	// Tell them where to resume from; this line is not part of the journal
+	this->WriteLine(":" + ServerInstance->Config->GetSID() + " BURST " + ConvToStr(ServerInstance->Time()) + " " + ConvToStr(old->journal.received));
+
+	journal.lines.swap(old->journal.lines);
+	journal.first = old->journal.first;
+	journal.sent = old->journal.sent;
+	journal.received = old->journal.received;
+	journal.bytes = old->journal.bytes;
+	journal.active = true;
+
+	unsigned long replayed = journal.sent - seq;
+	for (std::deque<std::string>::iterator i = journal.lines.begin() + (seq - journal.first); i != journal.lines.end(); ++i)
+	{
+		this->WriteData(*i);
+		this->WriteData("\n");
+	}
+
+	time_t lost = ServerInstance->Time() - old->GetDetachTime();
+	ServerInstance->SNO->WriteGlobalSno('l', "Link to \2%s\2 resynchronised after %s, replayed %lu line%s",
+		linkID.c_str(), Utils->Creator->TimeToStr(lost).c_str(), replayed, replayed != 1 ? "s" : "");
+}
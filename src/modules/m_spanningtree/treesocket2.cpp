@@ -39,6 +39,8 @@ void TreeSocket::Error(parameterlist &params)
 {
 	std::string msg = params.size() ? params[0] : "";
 	SetError("received ERROR " + msg);
+	// The remote server closed the link on purpose, so it will not resync
+	LinkState = DYING;
 }
 
 void TreeSocket::Split(const std::string& line, std::string& prefix, std::string& command, parameterlist& params)
@@ -91,6 +93,11 @@ void TreeSocket::ProcessLine(std::string &line)
 	if (command.empty())
 		return;
 
+	/* Count what the remote server sent after its BURST, for a later resync */
+	if ((this->LinkState == CONNECTED) && (CanResync) && (MyRoot) &&
+		((command != "BURST") || ((!prefix.empty()) && (prefix != MyRoot->GetID()))))
+		journal.received++;
+
 	switch (this->LinkState)
 	{
 		case WAIT_AUTH_1:
@@ -165,6 +172,29 @@ void TreeSocket::ProcessLine(std::string &line)
 					}
 				}
 
+				TreeSocket* held = FindDetached(capab->name, capab->sid);
+				if (params.size() > 1)
+				{
+					// BURST with a line count: they are resyncing with the link we are holding
+					unsigned long seq = strtoul(params[1].c_str(), NULL, 10);
+					if ((!held) || (held->MyRoot->GetID() != capab->sid) || (!held->journal.CanReplayFrom(seq)))
+					{
+						SendError("Unable to resync, a full burst is required");
+						return;
+					}
+
+					this->LinkState = CONNECTED;
+					Utils->timeoutlist.erase(this);
+					linkID = capab->name;
+					this->Reattach(held, seq);
+					return;
+				}
+				else if (held)
+				{
+					// They did not keep our side of the link, so neither can we
+					held->DropDetached();
+				}
+
 				// Check for duplicate server name/sid again, it's possible that a new
 				// server was introduced while we were waiting for them to send BURST.
 				// (we do not reserve their server name/sid when they send SERVER, we do it now)
@@ -231,6 +261,7 @@ void TreeSocket::ProcessLine(std::string &line)
 			this->ProcessConnectedLine(prefix, command, params);
 		break;
 		case DYING:
+		case DETACHED:
 		break;
 	}
 }
@@ -399,6 +430,10 @@ void TreeSocket::ProcessConnectedLine(std::string& prefix, std::string& command,
 			return;
 		}
 
+		// A resync after a lost link, nothing has changed for the rest of the network
+		if ((ServerSource == MyRoot) && (params.size() > 1))
+			return;
+
 		ServerSource->bursting = true;
 		Utils->DoOneToAllButSender(prefix, command, params, prefix);
 	}
@@ -494,7 +529,12 @@ void TreeSocket::ProcessConnectedLine(std::string& prefix, std::string& command,
 			params.pop_back();
 		}
 
-		CmdResult res = cmd->Handle(params, who);
+		CmdResult res;
+		{
+			CommandTimer timer(cmd, true);
+			timer.Ran();
+			res = cmd->Handle(params, who);
+		}
 
 		if (res == CMD_INVALID)
 		{
@@ -515,6 +555,19 @@ void TreeSocket::OnTimeout()
 
 void TreeSocket::Close()
 {
+	if (LinkState == DETACHED)
+	{
+		DropDetached();
+		return;
+	}
+
+	// Keep a lost link on the network for a while in case it can resync
+	if ((MyRoot) && (LinkLost) && (Utils->ResyncWindow))
+	{
+		Detach();
+		return;
+	}
+
 	if (fd != -1)
 		ServerInstance->GlobalCulls.AddItem(this);
 	this->BufferedSocket::Close();
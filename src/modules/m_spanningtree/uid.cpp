@@ -100,6 +100,7 @@ CmdResult CommandUID::Handle(const parameterlist &params, User* serversrc)
 	_new->registered = REG_ALL;
 	_new->signon = signon;
 	_new->age = age_t;
+	ServerInstance->Users->index.Add(_new);
 
 	/* we need to remove the + from the modestring, so we can do our stuff */
 	std::string::size_type pos_after_plus = modestr.find_first_not_of('+');
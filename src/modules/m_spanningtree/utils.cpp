@@ -130,7 +130,8 @@ TreeServer* SpanningTreeUtilities::FindServerID(const std::string &id)
 		return NULL;
 }
 
-SpanningTreeUtilities::SpanningTreeUtilities(ModuleSpanningTree* C) : Creator(C)
+SpanningTreeUtilities::SpanningTreeUtilities(ModuleSpanningTree* C)
+	: Creator(C), ChannelRoutes("spanningtree_routes", C)
 {
 	ServerInstance->Logs->Log("m_spanningtree",DEBUG,"***** Using SID for hash: %s *****", ServerInstance->Config->GetSID().c_str());
 
@@ -140,6 +141,8 @@ SpanningTreeUtilities::SpanningTreeUtilities(ModuleSpanningTree* C) : Creator(C)
 
 CullResult SpanningTreeUtilities::cull()
 {
+	// Lost links are split rather than held when unloading
+	ResyncWindow = 0;
 	while (TreeRoot->ChildCount())
 	{
 		TreeServer* child_server = TreeRoot->GetChild(0);
@@ -171,6 +174,45 @@ void SpanningTreeUtilities::AddThisServer(TreeServer* server, TreeServerList &li
 		list[server] = server;
 }
 
+void SpanningTreeUtilities::AddChannelRoute(Membership* memb)
+{
+	if (IS_LOCAL(memb->user))
+		return;
+
+	TreeServer* best = this->BestRouteTo(memb->user->server);
+	if (!best)
+		return;
+
+	TreeRouteCounts* routes = ChannelRoutes.get(memb->chan);
+	if (!routes)
+	{
+		routes = new TreeRouteCounts;
+		ChannelRoutes.set(memb->chan, routes);
+	}
+	(*routes)[best]++;
+}
+
+void SpanningTreeUtilities::DelChannelRoute(Membership* memb)
+{
+	if (IS_LOCAL(memb->user))
+		return;
+
+	TreeRouteCounts* routes = ChannelRoutes.get(memb->chan);
+	if (!routes)
+		return;
+
+	TreeServer* best = this->BestRouteTo(memb->user->server);
+	TreeRouteCounts::iterator i = routes->find(best);
+	if (i == routes->end())
+		return;
+
+	/* Drop the entry once it reaches zero so that no pointer to a split server is kept */
+	if (--i->second == 0)
+		routes->erase(i);
+	if (routes->empty())
+		ChannelRoutes.unset(memb->chan);
+}
+
 /* returns a list of DIRECT servernames for a specific channel */
 void SpanningTreeUtilities::GetListOfServersForChannel(Channel* c, TreeServerList &list, char status, const CUList &exempt_list)
 {
@@ -184,12 +226,49 @@ void SpanningTreeUtilities::GetListOfServersForChannel(Channel* c, TreeServerLis
 
 	const UserMembList *ulist = c->GetUsers();
 
+	if (!minrank)
+	{
+		/* Without a status filter the precomputed route counts are enough,
+		 * exempt users are taken off a copy of them. This is O(links) rather
+		 * than O(members).
+		 */
+		TreeRouteCounts* routes = ChannelRoutes.get(c);
+		if (!routes)
+			return;
+
+		if (exempt_list.empty())
+		{
+			for (TreeRouteCounts::const_iterator i = routes->begin(); i != routes->end(); ++i)
+				AddThisServer(i->first, list);
+			return;
+		}
+
+		TreeRouteCounts remaining(*routes);
+		for (CUList::const_iterator i = exempt_list.begin(); i != exempt_list.end(); ++i)
+		{
+			User* u = *i;
+			if (IS_LOCAL(u) || ulist->find(u) == ulist->end())
+				continue;
+
+			TreeRouteCounts::iterator r = remaining.find(this->BestRouteTo(u->server));
+			if (r != remaining.end())
+				r->second--;
+		}
+
+		for (TreeRouteCounts::const_iterator i = remaining.begin(); i != remaining.end(); ++i)
+		{
+			if (i->second)
+				AddThisServer(i->first, list);
+		}
+		return;
+	}
+
 	for (UserMembCIter i = ulist->begin(); i != ulist->end(); i++)
 	{
 		if (IS_LOCAL(i->first))
 			continue;
 
-		if (minrank && i->second->getRank() < minrank)
+		if (i->second->getRank() < minrank)
 			continue;
 
 		if (exempt_list.find(i->first) == exempt_list.end())
@@ -330,6 +409,13 @@ void SpanningTreeUtilities::ReadConfiguration()
 	if (PingWarnTime < 0 || PingWarnTime > PingFreq - 1)
 		PingWarnTime = 0;
 
+	ResyncWindow = options->getInt("resyncwindow");
+	ResyncJournalMax = options->getInt("resyncjournal", 4 * 1024 * 1024);
+	if (ResyncWindow < 0)
+		ResyncWindow = 0;
+	if (ResyncJournalMax < 1024)
+		ResyncJournalMax = 1024;
+
 	AutoconnectBlocks.clear();
 	LinkBlocks.clear();
 	ConfigTagList tags = ServerInstance->Config->ConfTags("link");
@@ -428,3 +514,13 @@ Link* SpanningTreeUtilities::FindLink(const std::string& name)
 	}
 	return NULL;
 }
+
+bool SpanningTreeUtilities::IsConnecting(const std::string& name)
+{
+	for (TimeoutList::iterator i = timeoutlist.begin(); i != timeoutlist.end(); ++i)
+	{
+		if (i->second.first == name)
+			return true;
+	}
+	return false;
+}
@@ -44,6 +44,11 @@ class SpanningTreeUtilities;
 
 typedef std::map<TreeServer*,TreeServer*> TreeServerList;
 
+/** Number of remote channel members reachable through each directly
+ * connected server, keyed by that server's route.
+ */
+typedef std::map<TreeServer*,unsigned int> TreeRouteCounts;
+
 /** Contains helper functions and variables for this module,
  * and keeps them out of the global namespace
  */
@@ -112,6 +117,20 @@ class SpanningTreeUtilities : public classbase
 	 */
 	int PingFreq;
 
+	/** Number of seconds a lost link is kept on the network while waiting
+	 * for it to come back and resync, or 0 to split it immediately
+	 */
+	int ResyncWindow;
+
+	/** Maximum number of bytes kept in the resync journal of each link
+	 */
+	unsigned long ResyncJournalMax;
+
+	/** Per-channel member counts by route, kept up to date on join, part,
+	 * kick and quit so that channel messages do not walk the member list
+	 */
+	SimpleExtItem<TreeRouteCounts> ChannelRoutes;
+
 	/** Initialise utility class
 	 */
 	SpanningTreeUtilities(ModuleSpanningTree* Creator);
@@ -146,6 +165,14 @@ class SpanningTreeUtilities : public classbase
 	 */
 	void AddThisServer(TreeServer* server, TreeServerList &list);
 
+	/** Account for a remote member joining a channel in its route count
+	 */
+	void AddChannelRoute(Membership* memb);
+
+	/** Account for a remote member leaving a channel in its route count
+	 */
+	void DelChannelRoute(Membership* memb);
+
 	/** Compile a list of servers which contain members of channel c
 	 */
 	void GetListOfServersForChannel(Channel* c, TreeServerList &list, char status, const CUList &exempt_list);
@@ -170,6 +197,10 @@ class SpanningTreeUtilities : public classbase
 	 */
 	Link* FindLink(const std::string& name);
 
+	/** Returns true if an outgoing connection to the named server is in progress
+	 */
+	bool IsConnecting(const std::string& name);
+
 	/** Refresh the IP cache used for allowing inbound connections
 	 */
 	void RefreshIPCache();
@@ -170,6 +170,8 @@ static void checkall(Module* noimpl)
 	CHK(OnPassCompare);
 	CHK(OnRunTestSuite);
 	CHK(OnNamesListItem);
+	CHK(OnNamesListCache);
+	CHK(OnMemoryReport);
 	CHK(OnNumeric);
 	CHK(OnHookIO);
 	CHK(OnPreRehash);
@@ -181,7 +183,10 @@ static void checkall(Module* noimpl)
 class CommandTest : public Command
 {
  public:
-	CommandTest(Module* parent) : Command(parent, "TEST", 1)
+	/** Number of users still to be quit as they finish connecting */
+	unsigned int quitconnect;
+
+	CommandTest(Module* parent) : Command(parent, "TEST", 1), quitconnect(0)
 	{
 		syntax = "<action> <parameters>";
 	}
@@ -204,6 +209,10 @@ class CommandTest : public Command
 			checkall(creator);
 			ServerInstance->SNO->WriteToSnoMask('a', "Module check complete");
 		}
+		else if (parameters[0] == "quitconnect")
+		{
+			quitconnect = parameters.size() > 1 ? atoi(parameters[1].c_str()) : 1;
+		}
 		return CMD_SUCCESS;
 	}
 };
@@ -221,6 +230,16 @@ class ModuleTest : public Module
 		if (!strstr(ServerInstance->Config->ServerName.c_str(), ".test"))
 			throw ModuleException("Don't load modules without reading their descriptions!");
 		ServerInstance->Modules->AddService(cmd);
+		Implementation eventlist[] = { I_OnUserConnect };
+		ServerInstance->Modules->Attach(eventlist, this, sizeof(eventlist)/sizeof(Implementation));
+	}
+
+	void OnUserConnect(LocalUser* user)
+	{
+		if (!cmd.quitconnect)
+			return;
+		cmd.quitconnect--;
+		ServerInstance->Users->QuitUser(user, "Quit while connecting by TEST quitconnect");
 	}
 
 	Version GetVersion()
@@ -35,7 +35,7 @@ class ModuleUHNames : public Module
 
 	void init()
 	{
-		Implementation eventlist[] = { I_OnEvent, I_OnPreCommand, I_OnNamesListItem, I_On005Numeric };
+		Implementation eventlist[] = { I_OnEvent, I_OnPreCommand, I_OnNamesListItem, I_OnNamesListCache, I_On005Numeric };
 		ServerInstance->Modules->Attach(eventlist, this, sizeof(eventlist)/sizeof(Implementation));
 	}
 
@@ -64,7 +64,7 @@ class ModuleUHNames : public Module
 		{
 			if ((parameters.size()) && (!strcasecmp(parameters[0].c_str(),"UHNAMES")))
 			{
-				cap.ext.set(user, 1);
+				cap.set(user, true);
 				return MOD_RES_DENY;
 			}
 		}
@@ -73,7 +73,7 @@ class ModuleUHNames : public Module
 
 	void OnNamesListItem(User* issuer, Membership* memb, std::string &prefixes, std::string &nick)
 	{
-		if (!cap.ext.get(issuer))
+		if (!cap.get(issuer))
 			return;
 
 		if (nick.empty())
@@ -82,6 +82,13 @@ class ModuleUHNames : public Module
 		nick = memb->user->GetFullHost();
 	}
 
+	ModResult OnNamesListCache(User* issuer, Channel* chan, unsigned int& format)
+	{
+		if (cap.get(issuer))
+			format |= NAMES_USERHOST;
+		return MOD_RES_PASSTHRU;
+	}
+
 	void OnEvent(Event& ev)
 	{
 		cap.HandleEvent(ev);
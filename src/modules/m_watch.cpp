@@ -22,89 +22,282 @@
 
 #include "inspircd.h"
 
-/* $ModDesc: Provides support for the /WATCH command */
+/* $ModDesc: Provides support for the /WATCH and /MONITOR commands */
 
 
 /*
- * Okay, it's nice that this was documented and all, but I at least understood very little
- * of it, so I'm going to attempt to explain the data structures in here a bit more.
+ * The data structures, since the last explanation of them no longer applies:
  *
- * For efficiency, many data structures are kept.
+ * There is one global hash_map `watchentries' from a nickname to a WatchEntry, for every
+ * nick which somebody is watching. The entry holds the nick's online status, which is
+ * "ident host signon" when they are online and an empty string when they are not, and a
+ * doubly linked list of WatchLinks, one for each user watching the nick.
  *
- * The first is a global list `watchentries':
- *	hash_map<irc::string, std::deque<User*> >
+ * Each user who is watching anyone has a WatchList attached via Extensible, which maps
+ * every nick on their list to the same WatchLink. So each link can be reached from both
+ * sides: signing on walks the nick's links to notify the watchers, and WATCH -nick or a
+ * quit goes straight from the user's list to the link and unhooks it. Neither has to
+ * search the other watchers of a popular nick.
  *
- * That is, if nick 'w00t' is being watched by user pointer 'Brain' and 'Om', <w00t, (Brain, Om)>
- * will be in the watchentries list.
- *
- * The second is that each user has a per-user data structure attached to their user record via Extensible:
- *	std::map<irc::string, std::string> watchlist;
- * So, in the above example with w00t watched by Brain and Om, we'd have:
- * 	Brain-
- * 	      `- w00t
- * 	Om-
- * 	   `- w00t
- *
- * Hopefully this helps any brave soul that ventures into this file other than me. :-)
- *		-- w00t (mar 30, 2008)
+ * WATCH and MONITOR share the index. Each link remembers which of the two commands added
+ * it, so a user sees two separate lists, each with its own limit.
  */
 
+/** Which command added a nick to a user's list */
+enum WatchType
+{
+	WATCH_WATCH = 1,
+	WATCH_MONITOR = 2
+};
 
-/* This module has been refactored to provide a very efficient (in terms of cpu time)
- * implementation of /WATCH.
- *
- * To improve the efficiency of watch, many lists are kept. The first primary list is
- * a hash_map of who's being watched by who. For example:
- *
- * KEY: Brain   --->  Watched by:  Boo, w00t, Om
- * KEY: Boo     --->  Watched by:  Brain, w00t
- *
- * This is used when we want to tell all the users that are watching someone that
- * they are now available or no longer available. For example, if the hash was
- * populated as shown above, then when Brain signs on, messages are sent to Boo, w00t
- * and Om by reading their 'watched by' list. When this occurs, their online status
- * in each of these users lists (see below) is also updated.
- *
- * Each user also has a seperate (smaller) map attached to their User whilst they
- * have any watch entries, which is managed by class Extensible. When they add or remove
- * a watch entry from their list, it is inserted here, as well as the main list being
- * maintained. This map also contains the user's online status. For users that are
- * offline, the key points at an empty string, and for users that are online, the key
- * points at a string containing "users-ident users-host users-signon-time". This is
- * stored in this manner so that we don't have to FindUser() to fetch this info, the
- * users signon can populate the field for us.
- *
- * For example, going again on the example above, this would be w00t's watchlist:
- *
- * KEY: Boo    --->  Status: "Boo brains.sexy.babe 535342348"
- * KEY: Brain  --->  Status: ""
- *
- * In this list we can see that Boo is online, and Brain is offline. We can then
- * use this list for 'WATCH L', and 'WATCH S' can be implemented as a combination
- * of the above two data structures, with minimum CPU penalty for doing so.
- *
- * In short, the least efficient this ever gets is O(n), and thats only because
- * there are parts that *must* loop (e.g. telling all users that are watching a
- * nick that the user online), however this is a *major* improvement over the
- * 1.0 implementation, which in places had O(n^n) and worse in it, because this
- * implementation scales based upon the sizes of the watch entries, whereas the
- * old system would scale (or not as the case may be) according to the total number
- * of users using WATCH.
- */
+struct WatchEntry;
 
-/*
- * Before you start screaming, this definition is only used here, so moving it to a header is pointless.
- * Yes, it's horrid. Blame cl for being different. -- w00t
+/** One user watching one nick, linked into the list of the nick's watchers */
+struct WatchLink
+{
+	/** The nick being watched */
+	WatchEntry* entry;
+	/** The user watching it */
+	User* user;
+	/** Neighbours in the entry's list of watchers */
+	WatchLink* prev;
+	WatchLink* next;
+	/** WatchType flags for the commands which added the nick */
+	unsigned int types;
+};
+
+/** A nick which somebody is watching */
+struct WatchEntry
+{
+	irc::string nick;
+	/** "ident host signon" if the nick is online, empty otherwise */
+	std::string status;
+	/** The first user watching the nick */
+	WatchLink* watchers;
+	/** Number of links added by WATCH and by MONITOR */
+	unsigned int watches;
+	unsigned int monitors;
+};
+
+typedef nspace::hash_map<irc::string, WatchEntry*, irc::hash> watchentries;
+typedef std::map<irc::string, WatchLink*> watchlinks;
+
+/** The nicks a user is watching */
+struct WatchList
+{
+	watchlinks links;
+	/** Number of nicks added by WATCH and by MONITOR */
+	unsigned int watches;
+	unsigned int monitors;
+	WatchList() : watches(0), monitors(0) { }
+};
+
+/** Who's watching each nickname, and what each user watches
  */
+class WatchIndex
+{
+	/** Take some of the flags off a link, freeing it once none are left */
+	void Drop(WatchList* wl, watchlinks::iterator i, unsigned int types)
+	{
+		WatchLink* link = i->second;
+		WatchEntry* e = link->entry;
+		types &= link->types;
+		if (types & WATCH_WATCH)
+		{
+			wl->watches--;
+			e->watches--;
+		}
+		if (types & WATCH_MONITOR)
+		{
+			wl->monitors--;
+			e->monitors--;
+		}
+		link->types &= ~types;
+		if (link->types)
+			return;
 
-typedef nspace::hash_map<irc::string, std::deque<User*>, irc::hash> watchentries;
-typedef std::map<irc::string, std::string> watchlist;
+		if (link->prev)
+			link->prev->next = link->next;
+		else
+			e->watchers = link->next;
+		if (link->next)
+			link->next->prev = link->prev;
+		delete link;
+		wl->links.erase(i);
+
+		if (!e->watchers)
+		{
+			entries.erase(e->nick);
+			delete e;
+		}
+	}
+
+ public:
+	watchentries entries;
+	SimpleExtItem<WatchList> ext;
+
+	WatchIndex(Module* parent) : ext("watchlist", parent)
+	{
+	}
+
+	~WatchIndex()
+	{
+		for (watchentries::iterator i = entries.begin(); i != entries.end(); ++i)
+		{
+			WatchLink* link = i->second->watchers;
+			while (link)
+			{
+				WatchLink* next = link->next;
+				delete link;
+				link = next;
+			}
+			delete i->second;
+		}
+	}
+
+	static std::string Status(User* user)
+	{
+		return std::string(user->ident).append(" ").append(user->dhost).append(" ").append(ConvToStr(user->age));
+	}
+
+	WatchEntry* Find(const irc::string& nick)
+	{
+		watchentries::iterator i = entries.find(nick);
+		return (i == entries.end() ? NULL : i->second);
+	}
+
+	/** Add a nick to a user's list
+	 * @param user The user watching
+	 * @param nick The nick to watch
+	 * @param type The command doing the adding
+	 * @return The link, or NULL if this command had already added the nick
+	 */
+	WatchLink* Add(User* user, const irc::string& nick, WatchType type)
+	{
+		WatchList* wl = ext.get(user);
+		if (!wl)
+		{
+			wl = new WatchList;
+			ext.set(user, wl);
+		}
 
-/* Who's watching each nickname.
- * NOTE: We do NOT iterate this to display a user's WATCH list!
- * See the comments above!
+		WatchLink* link;
+		watchlinks::iterator i = wl->links.find(nick);
+		if (i != wl->links.end())
+		{
+			link = i->second;
+			if (link->types & type)
+				return NULL;
+		}
+		else
+		{
+			WatchEntry* e = Find(nick);
+			if (!e)
+			{
+				e = new WatchEntry;
+				e->nick = nick;
+				e->watchers = NULL;
+				e->watches = e->monitors = 0;
+				User* target = ServerInstance->FindNickOnly(nick.c_str());
+				if (target && target->registered == REG_ALL)
+					e->status = Status(target);
+				entries[nick] = e;
+			}
+
+			link = new WatchLink;
+			link->entry = e;
+			link->user = user;
+			link->types = 0;
+			link->prev = NULL;
+			link->next = e->watchers;
+			if (e->watchers)
+				e->watchers->prev = link;
+			e->watchers = link;
+			wl->links[nick] = link;
+		}
+
+		link->types |= type;
+		if (type == WATCH_WATCH)
+		{
+			wl->watches++;
+			link->entry->watches++;
+		}
+		else
+		{
+			wl->monitors++;
+			link->entry->monitors++;
+		}
+		return link;
+	}
+
+	/** Remove a nick from a user's list
+	 * @return True if the nick had been added by this command
+	 */
+	bool Remove(User* user, const irc::string& nick, WatchType type)
+	{
+		WatchList* wl = ext.get(user);
+		if (!wl)
+			return false;
+
+		watchlinks::iterator i = wl->links.find(nick);
+		if (i == wl->links.end() || !(i->second->types & type))
+			return false;
+
+		Drop(wl, i, type);
+		if (wl->links.empty())
+			ext.unset(user);
+		return true;
+	}
+
+	/** Remove every nick added by some commands from a user's list
+	 * @param types WatchType flags of the commands
+	 */
+	void RemoveAll(User* user, unsigned int types)
+	{
+		WatchList* wl = ext.get(user);
+		if (!wl)
+			return;
+
+		for (watchlinks::iterator i = wl->links.begin(); i != wl->links.end(); )
+		{
+			watchlinks::iterator cur = i++;
+			Drop(wl, cur, types);
+		}
+		if (wl->links.empty())
+			ext.unset(user);
+	}
+};
+
+/** Collects targets for one MONITOR numeric, sending as many to a line as will fit
  */
-watchentries* whos_watching_me;
+class MonitorBatch
+{
+	User* const user;
+	const unsigned int numeric;
+	std::string list;
+
+ public:
+	MonitorBatch(User* u, unsigned int num) : user(u), numeric(num)
+	{
+	}
+
+	void Add(const std::string& item)
+	{
+		if (!list.empty() && user->nick.length() + list.length() + item.length() > 400)
+			Flush();
+		if (!list.empty())
+			list.push_back(',');
+		list.append(item);
+	}
+
+	void Flush()
+	{
+		if (list.empty())
+			return;
+		user->WriteNumeric(numeric, "%s :%s", user->nick.c_str(), list.c_str());
+		list.clear();
+	}
+};
 
 class CommandSVSWatch : public Command
 {
@@ -146,8 +339,8 @@ class CommandSVSWatch : public Command
 class CommandWatch : public Command
 {
 	unsigned int& MAX_WATCH;
+	WatchIndex& index;
  public:
-	SimpleExtItem<watchlist> ext;
 	CmdResult remove_watch(User* user, const char* nick)
 	{
 		// removing an item from the list
@@ -157,43 +350,19 @@ class CommandWatch : public Command
 			return CMD_FAILURE;
 		}
 
-		watchlist* wl = ext.get(user);
-		if (wl)
-		{
-			/* Yup, is on my list */
-			watchlist::iterator n = wl->find(nick);
-
-			if (!wl)
-				return CMD_FAILURE;
+		WatchEntry* e = index.Find(nick);
+		if (!e)
+			return CMD_SUCCESS;
 
-			if (n != wl->end())
-			{
-				if (!n->second.empty())
-					user->WriteNumeric(602, "%s %s %s :stopped watching", user->nick.c_str(), n->first.c_str(), n->second.c_str());
-				else
-					user->WriteNumeric(602, "%s %s * * 0 :stopped watching", user->nick.c_str(), nick);
-
-				wl->erase(n);
-			}
-
-			if (wl->empty())
-			{
-				ext.unset(user);
-			}
-
-			watchentries::iterator x = whos_watching_me->find(nick);
-			if (x != whos_watching_me->end())
-			{
-				/* People are watching this user, am i one of them? */
-				std::deque<User*>::iterator n2 = std::find(x->second.begin(), x->second.end(), user);
-				if (n2 != x->second.end())
-					/* I'm no longer watching you... */
-					x->second.erase(n2);
-
-				if (x->second.empty())
-					/* nobody else is, either. */
-					whos_watching_me->erase(nick);
-			}
+		/* Removing the last watcher frees the entry */
+		std::string status = e->status;
+		if (index.Remove(user, nick, WATCH_WATCH))
+		{
+			/* Yup, was on my list */
+			if (!status.empty())
+				user->WriteNumeric(602, "%s %s %s :stopped watching", user->nick.c_str(), nick, status.c_str());
+			else
+				user->WriteNumeric(602, "%s %s * * 0 :stopped watching", user->nick.c_str(), nick);
 		}
 
 		return CMD_SUCCESS;
@@ -207,57 +376,36 @@ class CommandWatch : public Command
 			return CMD_FAILURE;
 		}
 
-		watchlist* wl = ext.get(user);
-		if (!wl)
-		{
-			wl = new watchlist();
-			ext.set(user, wl);
-		}
-
-		if (wl->size() == MAX_WATCH)
+		WatchList* wl = index.ext.get(user);
+		if (wl && wl->watches >= MAX_WATCH)
 		{
 			user->WriteNumeric(512, "%s %s :Too many WATCH entries", user->nick.c_str(), nick);
 			return CMD_FAILURE;
 		}
 
-		watchlist::iterator n = wl->find(nick);
-		if (n == wl->end())
-		{
-			/* Don't already have the user on my watch list, proceed */
-			watchentries::iterator x = whos_watching_me->find(nick);
-			if (x != whos_watching_me->end())
-			{
-				/* People are watching this user, add myself */
-				x->second.push_back(user);
-			}
-			else
-			{
-				std::deque<User*> newlist;
-				newlist.push_back(user);
-				(*(whos_watching_me))[nick] = newlist;
-			}
+		/* Don't already have the user on my watch list, proceed */
+		WatchLink* link = index.Add(user, nick, WATCH_WATCH);
+		if (!link)
+			return CMD_SUCCESS;
 
+		if (!link->entry->status.empty())
+		{
+			user->WriteNumeric(604, "%s %s %s :is online",user->nick.c_str(), nick, link->entry->status.c_str());
 			User* target = ServerInstance->FindNick(nick);
-			if (target)
+			if (target && IS_AWAY(target))
 			{
-				(*wl)[nick] = std::string(target->ident).append(" ").append(target->dhost).append(" ").append(ConvToStr(target->age));
-				user->WriteNumeric(604, "%s %s %s :is online",user->nick.c_str(), nick, (*wl)[nick].c_str());
-				if (IS_AWAY(target))
-				{
-					user->WriteNumeric(609, "%s %s %s %s %lu :is away", user->nick.c_str(), target->nick.c_str(), target->ident.c_str(), target->dhost.c_str(), (unsigned long) target->awaytime);
-				}
-			}
-			else
-			{
-				(*wl)[nick].clear();
-				user->WriteNumeric(605, "%s %s * * 0 :is offline",user->nick.c_str(), nick);
+				user->WriteNumeric(609, "%s %s %s %s %lu :is away", user->nick.c_str(), target->nick.c_str(), target->ident.c_str(), target->dhost.c_str(), (unsigned long) target->awaytime);
 			}
 		}
+		else
+		{
+			user->WriteNumeric(605, "%s %s * * 0 :is offline",user->nick.c_str(), nick);
+		}
 
 		return CMD_SUCCESS;
 	}
 
-	CommandWatch(Module* parent, unsigned int &maxwatch) : Command(parent,"WATCH", 0), MAX_WATCH(maxwatch), ext("watchlist", parent)
+	CommandWatch(Module* parent, unsigned int &maxwatch, WatchIndex& idx) : Command(parent,"WATCH", 0), MAX_WATCH(maxwatch), index(idx)
 	{
 		syntax = "[C|L|S]|[+|-<nick>]";
 		TRANSLATE2(TR_TEXT, TR_END); /* we watch for a nick. not a UID. */
@@ -267,13 +415,14 @@ class CommandWatch : public Command
 	{
 		if (parameters.empty())
 		{
-			watchlist* wl = ext.get(user);
+			WatchList* wl = index.ext.get(user);
 			if (wl)
 			{
-				for (watchlist::iterator q = wl->begin(); q != wl->end(); q++)
+				for (watchlinks::iterator q = wl->links.begin(); q != wl->links.end(); q++)
 				{
-					if (!q->second.empty())
-						user->WriteNumeric(604, "%s %s %s :is online", user->nick.c_str(), q->first.c_str(), q->second.c_str());
+					WatchLink* link = q->second;
+					if ((link->types & WATCH_WATCH) && !link->entry->status.empty())
+						user->WriteNumeric(604, "%s %s %s :is online", user->nick.c_str(), q->first.c_str(), link->entry->status.c_str());
 				}
 			}
 			user->WriteNumeric(607, "%s :End of WATCH list",user->nick.c_str());
@@ -286,41 +435,23 @@ class CommandWatch : public Command
 				if (!strcasecmp(nick,"C"))
 				{
 					// watch clear
-					watchlist* wl = ext.get(user);
-					if (wl)
-					{
-						for (watchlist::iterator i = wl->begin(); i != wl->end(); i++)
-						{
-							watchentries::iterator i2 = whos_watching_me->find(i->first);
-							if (i2 != whos_watching_me->end())
-							{
-								/* People are watching this user, am i one of them? */
-								std::deque<User*>::iterator n = std::find(i2->second.begin(), i2->second.end(), user);
-								if (n != i2->second.end())
-									/* I'm no longer watching you... */
-									i2->second.erase(n);
-
-								if (i2->second.empty())
-									/* nobody else is, either. */
-									whos_watching_me->erase(i2);
-							}
-						}
-
-						ext.unset(user);
-					}
+					index.RemoveAll(user, WATCH_WATCH);
 				}
 				else if (!strcasecmp(nick,"L"))
 				{
-					watchlist* wl = ext.get(user);
+					WatchList* wl = index.ext.get(user);
 					if (wl)
 					{
-						for (watchlist::iterator q = wl->begin(); q != wl->end(); q++)
+						for (watchlinks::iterator q = wl->links.begin(); q != wl->links.end(); q++)
 						{
-							if (!q->second.empty())
+							WatchLink* link = q->second;
+							if (!(link->types & WATCH_WATCH))
+								continue;
+							if (!link->entry->status.empty())
 							{
-								user->WriteNumeric(604, "%s %s %s :is online", user->nick.c_str(), q->first.c_str(), q->second.c_str());
+								user->WriteNumeric(604, "%s %s %s :is online", user->nick.c_str(), q->first.c_str(), link->entry->status.c_str());
 								User *targ = ServerInstance->FindNick(q->first.c_str());
-								if (IS_AWAY(targ))
+								if (targ && IS_AWAY(targ))
 								{
 									user->WriteNumeric(609, "%s %s %s %s %lu :is away", user->nick.c_str(), targ->nick.c_str(), targ->ident.c_str(), targ->dhost.c_str(), (unsigned long) targ->awaytime);
 								}
@@ -333,21 +464,24 @@ class CommandWatch : public Command
 				}
 				else if (!strcasecmp(nick,"S"))
 				{
-					watchlist* wl = ext.get(user);
+					WatchList* wl = index.ext.get(user);
 					int you_have = 0;
 					int youre_on = 0;
 					std::string list;
 
 					if (wl)
 					{
-						for (watchlist::iterator q = wl->begin(); q != wl->end(); q++)
-							list.append(q->first.c_str()).append(" ");
-						you_have = wl->size();
+						for (watchlinks::iterator q = wl->links.begin(); q != wl->links.end(); q++)
+						{
+							if (q->second->types & WATCH_WATCH)
+								list.append(q->first.c_str()).append(" ");
+						}
+						you_have = wl->watches;
 					}
 
-					watchentries::iterator i2 = whos_watching_me->find(user->nick.c_str());
-					if (i2 != whos_watching_me->end())
-						youre_on = i2->second.size();
+					WatchEntry* e = index.Find(user->nick.c_str());
+					if (e)
+						youre_on = e->watches;
 
 					user->WriteNumeric(603, "%s :You have %d and are on %d WATCH entries", user->nick.c_str(), you_have, youre_on);
 					user->WriteNumeric(606, "%s :%s",user->nick.c_str(), list.c_str());
@@ -369,25 +503,160 @@ class CommandWatch : public Command
 	}
 };
 
+/** Handle /MONITOR, the IRCv3 equivalent of /WATCH
+ */
+class CommandMonitor : public Command
+{
+	unsigned int& MAX_MONITOR;
+	WatchIndex& index;
+
+	/** Queue a target for a 730 or 731 reply */
+	void AddStatus(const irc::string& nick, MonitorBatch& online, MonitorBatch& offline)
+	{
+		User* target = ServerInstance->FindNickOnly(nick.c_str());
+		if (target && target->registered == REG_ALL)
+			online.Add(target->GetFullHost());
+		else
+			offline.Add(nick.c_str());
+	}
+
+ public:
+	CommandMonitor(Module* parent, unsigned int &maxmonitor, WatchIndex& idx) : Command(parent, "MONITOR", 1), MAX_MONITOR(maxmonitor), index(idx)
+	{
+		syntax = "C|L|S|{+|-} <nick>[,<nick>]+";
+		TRANSLATE3(TR_TEXT, TR_TEXT, TR_END);
+	}
+
+	CmdResult Handle (const std::vector<std::string> &parameters, User *user)
+	{
+		const std::string& subcmd = parameters[0];
+		if ((subcmd == "+" || subcmd == "-") && parameters.size() > 1)
+		{
+			MonitorBatch online(user, 730);
+			MonitorBatch offline(user, 731);
+			irc::commasepstream targets(parameters[1]);
+			std::string nick;
+			while (targets.GetToken(nick))
+			{
+				if (!ServerInstance->IsNick(nick.c_str(), ServerInstance->Config->Limits.NickMax))
+					continue;
+
+				if (subcmd == "-")
+				{
+					index.Remove(user, nick.c_str(), WATCH_MONITOR);
+					continue;
+				}
+
+				WatchList* wl = index.ext.get(user);
+				if (wl && wl->monitors >= MAX_MONITOR)
+				{
+					watchlinks::iterator i = wl->links.find(nick.c_str());
+					if (i == wl->links.end() || !(i->second->types & WATCH_MONITOR))
+					{
+						std::string rest = targets.GetRemaining();
+						if (!rest.empty())
+							nick.append(",").append(rest);
+						online.Flush();
+						offline.Flush();
+						user->WriteNumeric(734, "%s %u %s :Monitor list is full.", user->nick.c_str(), MAX_MONITOR, nick.c_str());
+						return CMD_FAILURE;
+					}
+				}
+
+				index.Add(user, nick.c_str(), WATCH_MONITOR);
+				AddStatus(nick.c_str(), online, offline);
+			}
+			online.Flush();
+			offline.Flush();
+		}
+		else if (subcmd == "C" || subcmd == "c")
+		{
+			index.RemoveAll(user, WATCH_MONITOR);
+		}
+		else if (subcmd == "L" || subcmd == "l")
+		{
+			WatchList* wl = index.ext.get(user);
+			if (wl)
+			{
+				MonitorBatch list(user, 732);
+				for (watchlinks::iterator i = wl->links.begin(); i != wl->links.end(); ++i)
+				{
+					if (i->second->types & WATCH_MONITOR)
+						list.Add(i->first.c_str());
+				}
+				list.Flush();
+			}
+			user->WriteNumeric(733, "%s :End of MONITOR list", user->nick.c_str());
+		}
+		else if (subcmd == "S" || subcmd == "s")
+		{
+			WatchList* wl = index.ext.get(user);
+			if (wl)
+			{
+				MonitorBatch online(user, 730);
+				MonitorBatch offline(user, 731);
+				for (watchlinks::iterator i = wl->links.begin(); i != wl->links.end(); ++i)
+				{
+					if (i->second->types & WATCH_MONITOR)
+						AddStatus(i->first, online, offline);
+				}
+				online.Flush();
+				offline.Flush();
+			}
+		}
+		return CMD_SUCCESS;
+	}
+};
+
 class Modulewatch : public Module
 {
 	unsigned int maxwatch;
+	WatchIndex index;
 	CommandWatch cmdw;
+	CommandMonitor cmdm;
 	CommandSVSWatch sw;
 
+	/** Tell everyone watching a nick that it has come online */
+	void Online(User* user, WatchEntry* e)
+	{
+		e->status = WatchIndex::Status(user);
+		for (WatchLink* link = e->watchers; link; link = link->next)
+		{
+			User* watcher = link->user;
+			if (link->types & WATCH_WATCH)
+				watcher->WriteNumeric(600, "%s %s %s :arrived online", watcher->nick.c_str(), user->nick.c_str(), e->status.c_str());
+			if (link->types & WATCH_MONITOR)
+				watcher->WriteNumeric(730, "%s :%s", watcher->nick.c_str(), user->GetFullHost().c_str());
+		}
+	}
+
+	/** Tell everyone watching a nick that it has gone offline */
+	void Offline(User* user, WatchEntry* e, const std::string& nick, time_t when)
+	{
+		e->status.clear();
+		for (WatchLink* link = e->watchers; link; link = link->next)
+		{
+			User* watcher = link->user;
+			if (link->types & WATCH_WATCH)
+				watcher->WriteNumeric(601, "%s %s %s %s %lu :went offline", watcher->nick.c_str(), nick.c_str(), user->ident.c_str(), user->dhost.c_str(), (unsigned long) when);
+			if (link->types & WATCH_MONITOR)
+				watcher->WriteNumeric(731, "%s :%s", watcher->nick.c_str(), nick.c_str());
+		}
+	}
+
  public:
 	Modulewatch()
-		: maxwatch(32), cmdw(this, maxwatch), sw(this)
+		: maxwatch(32), index(this), cmdw(this, maxwatch, index), cmdm(this, maxwatch, index), sw(this)
 	{
-		whos_watching_me = new watchentries();
 	}
 
 	void init()
 	{
 		OnRehash(NULL);
 		ServerInstance->Modules->AddService(cmdw);
+		ServerInstance->Modules->AddService(cmdm);
 		ServerInstance->Modules->AddService(sw);
-		ServerInstance->Modules->AddService(cmdw.ext);
+		ServerInstance->Modules->AddService(index.ext);
 		Implementation eventlist[] = { I_OnRehash, I_OnGarbageCollect, I_OnUserQuit, I_OnPostConnect, I_OnUserPostNick, I_On005Numeric, I_OnSetAway };
 		ServerInstance->Modules->Attach(eventlist, this, sizeof(eventlist)/sizeof(Implementation));
 	}
@@ -401,6 +670,10 @@ class Modulewatch : public Module
 
 	virtual ModResult OnSetAway(User *user, const std::string &awaymsg)
 	{
+		WatchEntry* e = index.Find(user->nick.c_str());
+		if (!e || !e->watches)
+			return MOD_RES_PASSTHRU;
+
 		std::string numeric;
 		int inum;
 
@@ -415,13 +688,10 @@ class Modulewatch : public Module
 			inum = 598;
 		}
 
-		watchentries::iterator x = whos_watching_me->find(user->nick.c_str());
-		if (x != whos_watching_me->end())
+		for (WatchLink* link = e->watchers; link; link = link->next)
 		{
-			for (std::deque<User*>::iterator n = x->second.begin(); n != x->second.end(); n++)
-			{
-				(*n)->WriteNumeric(inum, numeric);
-			}
+			if (link->types & WATCH_WATCH)
+				link->user->WriteNumeric(inum, numeric);
 		}
 
 		return MOD_RES_PASSTHRU;
@@ -429,120 +699,55 @@ class Modulewatch : public Module
 
 	virtual void OnUserQuit(User* user, const std::string &reason, const std::string &oper_message)
 	{
-		watchentries::iterator x = whos_watching_me->find(user->nick.c_str());
-		if (x != whos_watching_me->end())
-		{
-			for (std::deque<User*>::iterator n = x->second.begin(); n != x->second.end(); n++)
-			{
-				(*n)->WriteNumeric(601, "%s %s %s %s %lu :went offline", (*n)->nick.c_str() ,user->nick.c_str(), user->ident.c_str(), user->dhost.c_str(), (unsigned long) ServerInstance->Time());
-
-				watchlist* wl = cmdw.ext.get(*n);
-				if (wl)
-					/* We were on somebody's notify list, set ourselves offline */
-					(*wl)[user->nick.c_str()].clear();
-			}
-		}
+		WatchEntry* e = index.Find(user->nick.c_str());
+		if (e)
+			Offline(user, e, user->nick, ServerInstance->Time());
 
 		/* Now im quitting, if i have a notify list, im no longer watching anyone */
-		watchlist* wl = cmdw.ext.get(user);
-		if (wl)
-		{
-			/* Iterate every user on my watch list, and take me out of the whos_watching_me map for each one we're watching */
-			for (watchlist::iterator i = wl->begin(); i != wl->end(); i++)
-			{
-				watchentries::iterator i2 = whos_watching_me->find(i->first);
-				if (i2 != whos_watching_me->end())
-				{
-						/* People are watching this user, am i one of them? */
-						std::deque<User*>::iterator n = std::find(i2->second.begin(), i2->second.end(), user);
-						if (n != i2->second.end())
-							/* I'm no longer watching you... */
-							i2->second.erase(n);
-
-						if (i2->second.empty())
-							/* and nobody else is, either. */
-							whos_watching_me->erase(i2);
-				}
-			}
-		}
+		index.RemoveAll(user, WATCH_WATCH | WATCH_MONITOR);
 	}
 
 	virtual void OnGarbageCollect()
 	{
-		watchentries* old_watch = whos_watching_me;
-		whos_watching_me = new watchentries();
-
-		for (watchentries::const_iterator n = old_watch->begin(); n != old_watch->end(); n++)
-			whos_watching_me->insert(*n);
+		watchentries old_watch;
+		old_watch.swap(index.entries);
 
-		delete old_watch;
+		for (watchentries::const_iterator n = old_watch.begin(); n != old_watch.end(); n++)
+			index.entries.insert(*n);
 	}
 
 	virtual void OnPostConnect(User* user)
 	{
-		watchentries::iterator x = whos_watching_me->find(user->nick.c_str());
-		if (x != whos_watching_me->end())
-		{
-			for (std::deque<User*>::iterator n = x->second.begin(); n != x->second.end(); n++)
-			{
-				(*n)->WriteNumeric(600, "%s %s %s %s %lu :arrived online", (*n)->nick.c_str(), user->nick.c_str(), user->ident.c_str(), user->dhost.c_str(), (unsigned long) user->age);
-
-				watchlist* wl = cmdw.ext.get(*n);
-				if (wl)
-					/* We were on somebody's notify list, set ourselves online */
-					(*wl)[user->nick.c_str()] = std::string(user->ident).append(" ").append(user->dhost).append(" ").append(ConvToStr(user->age));
-			}
-		}
+		WatchEntry* e = index.Find(user->nick.c_str());
+		if (e)
+			Online(user, e);
 	}
 
 	virtual void OnUserPostNick(User* user, const std::string &oldnick)
 	{
-		watchentries::iterator new_offline = whos_watching_me->find(oldnick.c_str());
-		watchentries::iterator new_online = whos_watching_me->find(user->nick.c_str());
+		WatchEntry* e = index.Find(oldnick.c_str());
+		if (e)
+			Offline(user, e, oldnick, user->age);
 
-		if (new_offline != whos_watching_me->end())
-		{
-			for (std::deque<User*>::iterator n = new_offline->second.begin(); n != new_offline->second.end(); n++)
-			{
-				watchlist* wl = cmdw.ext.get(*n);
-				if (wl)
-				{
-					(*n)->WriteNumeric(601, "%s %s %s %s %lu :went offline", (*n)->nick.c_str(), oldnick.c_str(), user->ident.c_str(), user->dhost.c_str(), (unsigned long) user->age);
-					(*wl)[oldnick.c_str()].clear();
-				}
-			}
-		}
-
-		if (new_online != whos_watching_me->end())
-		{
-			for (std::deque<User*>::iterator n = new_online->second.begin(); n != new_online->second.end(); n++)
-			{
-				watchlist* wl = cmdw.ext.get(*n);
-				if (wl)
-				{
-					(*wl)[user->nick.c_str()] = std::string(user->ident).append(" ").append(user->dhost).append(" ").append(ConvToStr(user->age));
-					(*n)->WriteNumeric(600, "%s %s %s :arrived online", (*n)->nick.c_str(), user->nick.c_str(), (*wl)[user->nick.c_str()].c_str());
-				}
-			}
-		}
+		e = index.Find(user->nick.c_str());
+		if (e)
+			Online(user, e);
 	}
 
 	virtual void On005Numeric(std::string &output)
 	{
 		// we don't really have a limit...
-		output = output + " WATCH=" + ConvToStr(maxwatch);
+		output = output + " WATCH=" + ConvToStr(maxwatch) + " MONITOR=" + ConvToStr(maxwatch);
 	}
 
 	virtual ~Modulewatch()
 	{
-		delete whos_watching_me;
 	}
 
 	virtual Version GetVersion()
 	{
-		return Version("Provides support for the /WATCH command", VF_OPTCOMMON | VF_VENDOR);
+		return Version("Provides support for the /WATCH and /MONITOR commands", VF_OPTCOMMON | VF_VENDOR);
 	}
 };
 
 MODULE_INIT(Modulewatch)
-
@@ -55,6 +55,25 @@ typedef std::list<ListItem> modelist;
  */
 typedef std::list<ListLimit> limitlist;
 
+/** Storage for a channel's list, which knows the size of the list for /STATS M
+ */
+class ListExtItem : public SimpleExtItem<modelist>
+{
+ public:
+	ListExtItem(const std::string& Key, Module* parent) : SimpleExtItem<modelist>(Key, parent)
+	{
+	}
+
+	size_t GetSize(void* item) const
+	{
+		modelist* el = static_cast<modelist*>(item);
+		size_t bytes = sizeof(modelist);
+		for (modelist::iterator it = el->begin(); it != el->end(); ++it)
+			bytes += sizeof(ListItem) + 2 * sizeof(void*) + it->nick.length() + it->mask.length() + it->time.length();
+		return bytes;
+	}
+};
+
 /** The base class for list modes, should be inherited.
  */
 class ListModeBase : public ModeHandler
@@ -83,7 +102,7 @@ class ListModeBase : public ModeHandler
  public:
 	/** Storage key
 	 */
-	SimpleExtItem<modelist> extItem;
+	ListExtItem extItem;
 
 	/** Constructor.
 	 * @param Instance The creator of this class
@@ -192,7 +192,7 @@ int EPollEngine::DispatchEvents()
 {
 	socklen_t codesize = sizeof(int);
 	int errcode;
-	int i = epoll_wait(EngineHandle, events, GetMaxFds() - 1, 1000);
+	int i = epoll_wait(EngineHandle, events, GetMaxFds() - 1, DispatchTimeout);
 	ServerInstance->UpdateTime();
 
 	TotalEvents += i;
@@ -212,7 +212,7 @@ void PollEngine::DelFd(EventHandler* eh)
 
 int PollEngine::DispatchEvents()
 {
-	int i = poll(events, CurrentSetSize, 1000);
+	int i = poll(events, CurrentSetSize, DispatchTimeout);
 	int index;
 	socklen_t codesize = sizeof(int);
 	int errcode;
@@ -132,7 +132,9 @@ void SelectEngine::OnSetEvent(EventHandler* eh, int old_mask, int new_mask)
 
 int SelectEngine::DispatchEvents()
 {
-	static timeval tval = { 1, 0 };
+	timeval tval;
+	tval.tv_sec = DispatchTimeout / 1000;
+	tval.tv_usec = (DispatchTimeout % 1000) * 1000;
 
 	fd_set rfdset = ReadSet, wfdset = WriteSet, errfdset = ErrSet;
 
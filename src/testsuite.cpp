@@ -64,6 +64,8 @@ TestSuite::TestSuite()
 		std::cout << "(6) Comma sepstream tests\n";
 		std::cout << "(7) Space sepstream tests\n";
 		std::cout << "(8) UID generation tests\n";
+		std::cout << "(9) Nick hash lookup benchmarks\n";
+		std::cout << "(A) Wildcard benchmarks\n";
 
 		std::cout << std::endl << "(X) Exit test suite\n";
 
@@ -107,6 +109,12 @@ TestSuite::TestSuite()
 			case '8':
 				std::cout << (DoGenerateUIDTests() ? "\nSUCCESS!\n" : "\nFAILURE\n");
 				break;
+			case '9':
+				std::cout << (DoHashBenchmarks() ? "\nSUCCESS!\n" : "\nFAILURE\n");
+				break;
+			case 'A':
+				std::cout << (DoWildBenchmarks() ? "\nSUCCESS!\n" : "\nFAILURE\n");
+				break;
 			case 'X':
 				return;
 				break;
@@ -118,15 +126,15 @@ TestSuite::TestSuite()
 	}
 }
 
-/* Test that x matches y with match() */
-#define WCTEST(x, y) std::cout << "match(\"" << x << "\",\"" << y "\") " << ((passed = (InspIRCd::Match(x, y, NULL))) ? " SUCCESS!\n" : " FAILURE\n")
-/* Test that x does not match y with match() */
-#define WCTESTNOT(x, y) std::cout << "!match(\"" << x << "\",\"" << y "\") " << ((passed = ((!InspIRCd::Match(x, y, NULL)))) ? " SUCCESS!\n" : " FAILURE\n")
+/* Test that x matches y with match() and with y compiled */
+#define WCTEST(x, y) std::cout << "match(\"" << x << "\",\"" << y "\") " << ((passed = (InspIRCd::Match(x, y, NULL) && irc::wildcard_mask(y).Match(x))) ? " SUCCESS!\n" : " FAILURE\n")
+/* Test that x does not match y with match() or with y compiled */
+#define WCTESTNOT(x, y) std::cout << "!match(\"" << x << "\",\"" << y "\") " << ((passed = ((!InspIRCd::Match(x, y, NULL)) && (!irc::wildcard_mask(y).Match(x)))) ? " SUCCESS!\n" : " FAILURE\n")
 
 /* Test that x matches y with match() and cidr enabled */
-#define CIDRTEST(x, y) std::cout << "match(\"" << x << "\",\"" << y "\", true) " << ((passed = (InspIRCd::MatchCIDR(x, y, NULL))) ? " SUCCESS!\n" : " FAILURE\n")
+#define CIDRTEST(x, y) std::cout << "match(\"" << x << "\",\"" << y "\", true) " << ((passed = (InspIRCd::MatchCIDR(x, y, NULL) && irc::wildcard_mask(y).MatchCIDR(x))) ? " SUCCESS!\n" : " FAILURE\n")
 /* Test that x does not match y with match() and cidr enabled */
-#define CIDRTESTNOT(x, y) std::cout << "!match(\"" << x << "\",\"" << y "\", true) " << ((passed = ((!InspIRCd::MatchCIDR(x, y, NULL)))) ? " SUCCESS!\n" : " FAILURE\n")
+#define CIDRTESTNOT(x, y) std::cout << "!match(\"" << x << "\",\"" << y "\", true) " << ((passed = ((!InspIRCd::MatchCIDR(x, y, NULL)) && (!irc::wildcard_mask(y).MatchCIDR(x)))) ? " SUCCESS!\n" : " FAILURE\n")
 
 bool TestSuite::DoWildTests()
 {
@@ -168,6 +176,10 @@ bool TestSuite::DoWildTests()
 	WCTEST("aaaaaaaaa", "*a");
 	WCTEST("aaaaaaaaaa", "*a");
 	WCTEST("aaaaaaaaaaa", "*a");
+	WCTEST("FooBar.Example.NET", "*.example.net");
+	WCTEST("xxabcXbd", "*abc?bd");
+	WCTEST("abcabd", "*ab?*bd");
+	WCTEST("x{a}y", "*[A]*");
 
 	WCTESTNOT("foobar", "bazqux");
 	WCTESTNOT("foobar", "*qux");
@@ -184,10 +196,15 @@ bool TestSuite::DoWildTests()
 	WCTESTNOT("O", "OperServ");
 	WCTESTNOT("foobar.tst", "fo?bar.*g");
 	WCTESTNOT("foobar.test", "fo?bar.*tt");
+	WCTESTNOT("foobar", "*o?r*");
+	WCTESTNOT("abcabd", "*abc?bc*");
+	WCTESTNOT("ab", "a*b*b");
 
 	CIDRTEST("brain@1.2.3.4", "*@1.2.0.0/16");
 	CIDRTEST("brain@1.2.3.4", "*@1.2.3.0/24");
 	CIDRTEST("192.168.3.97", "192.168.3.0/24");
+	CIDRTEST("2001:db8::1", "2001:db8::/32");
+	CIDRTEST("brain@2001:db8::1", "2001:db8::/32");
 
 	CIDRTESTNOT("brain@1.2.3.4", "x*@1.2.0.0/16");
 	CIDRTESTNOT("brain@1.2.3.4", "*@1.3.4.0/24");
@@ -407,3 +424,160 @@ TestSuite::~TestSuite()
 	std::cout << "\n\n*** END OF TEST SUITE ***\n";
 }
 
+static double BenchClock()
+{
+#ifdef _WIN32
+	return GetTickCount() / 1000.0;
+#else
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+#endif
+}
+
+/** Time lookups in a 500k entry nick hash with the given case map, looking
+ * up every nick once as stored and once with its case swapped
+ */
+static bool HashBenchmark(const char* name, const unsigned char* map, const std::vector<std::string>& nicks, const std::vector<std::string>& swapped)
+{
+	const unsigned char* old = national_case_insensitive_map;
+	national_case_insensitive_map = map;
+
+	user_hash table;
+	for (size_t i = 0; i < nicks.size(); i++)
+		table[nicks[i]] = NULL;
+
+	size_t found = 0;
+	double start = BenchClock();
+	for (size_t i = 0; i < nicks.size(); i++)
+		found += (table.find(nicks[i]) != table.end());
+	double exact = BenchClock() - start;
+
+	start = BenchClock();
+	for (size_t i = 0; i < swapped.size(); i++)
+		found += (table.find(swapped[i]) != table.end());
+	double folded = BenchClock() - start;
+
+	national_case_insensitive_map = old;
+
+	std::cout << name << ": " << (exact * 1000000000.0 / nicks.size()) << " ns/lookup as stored, "
+		<< (folded * 1000000000.0 / swapped.size()) << " ns/lookup case swapped, "
+		<< found << "/" << (nicks.size() + swapped.size()) << " found\n";
+	return (found == nicks.size() + swapped.size());
+}
+
+bool TestSuite::DoHashBenchmarks()
+{
+	std::vector<std::string> nicks, swapped;
+	const char* stems[] = { "Guest", "Brain", "w00t", "[Away]", "Dan_", "Adam|Work", "LongerNickname^", NULL };
+
+	for (unsigned int i = 0; i < 500000; i++)
+	{
+		std::string nick = stems[i % 7] + ConvToStr(i);
+		std::string swap(nick);
+		for (std::string::iterator c = swap.begin(); c != swap.end(); ++c)
+			if (isalpha(*c))
+				*c ^= 0x20;
+		nicks.push_back(nick);
+		swapped.push_back(swap);
+	}
+
+	/* A copy of the RFC map is folded through the table, like m_nationalchars */
+	unsigned char custom[256];
+	memcpy(custom, rfc_case_insensitive_map, sizeof(custom));
+
+	bool passed = HashBenchmark("rfc1459", rfc_case_insensitive_map, nicks, swapped);
+	passed = HashBenchmark("ascii", ascii_case_insensitive_map, nicks, swapped) && passed;
+	passed = HashBenchmark("custom table", custom, nicks, swapped) && passed;
+	return passed;
+}
+
+/** Match every host against every mask, uncompiled and compiled, checking that both agree */
+static bool WildBenchmark(const char* name, const std::vector<std::string>& hosts, const std::vector<std::string>& masks, bool cidr)
+{
+	std::vector<irc::wildcard_mask> compiled;
+	for (std::vector<std::string>::const_iterator i = masks.begin(); i != masks.end(); ++i)
+		compiled.push_back(irc::wildcard_mask(*i));
+
+	std::vector<char> expected;
+	expected.reserve(hosts.size() * masks.size());
+	size_t matches = 0;
+	double start = BenchClock();
+	for (size_t h = 0; h < hosts.size(); h++)
+	{
+		for (size_t m = 0; m < masks.size(); m++)
+		{
+			bool hit = cidr ? InspIRCd::MatchCIDR(hosts[h], masks[m], NULL) : InspIRCd::Match(hosts[h], masks[m], NULL);
+			expected.push_back(hit);
+			matches += hit;
+		}
+	}
+	double plain = BenchClock() - start;
+
+	size_t wrong = 0;
+	std::vector<char>::const_iterator want = expected.begin();
+	start = BenchClock();
+	for (size_t h = 0; h < hosts.size(); h++)
+	{
+		for (size_t m = 0; m < compiled.size(); m++, ++want)
+		{
+			bool hit = cidr ? compiled[m].MatchCIDR(hosts[h]) : compiled[m].Match(hosts[h]);
+			if (hit != (bool)*want)
+				wrong++;
+		}
+	}
+	double fast = BenchClock() - start;
+
+	double count = (double)hosts.size() * masks.size();
+	std::cout << name << ": " << (plain * 1000000000.0 / count) << " ns/match uncompiled, " << (fast * 1000000000.0 / count)
+		<< " ns/match compiled, " << matches << " matches, " << wrong << " disagreements\n";
+	return (wrong == 0);
+}
+
+bool TestSuite::DoWildBenchmarks()
+{
+	const char* isps[] = { "example.net", "dsl.example.com", "res.provider.co.uk", "dynamic.cable.example.org", "users.irc.test" };
+	const char* idents[] = { "~user", "brain", "~w00t", "dan", "~Guest", "webchat" };
+	std::vector<std::string> hosts, ips;
+
+	for (unsigned int i = 0; i < 20000; i++)
+	{
+		std::string ip = ConvToStr(10 + i % 200) + "." + ConvToStr(i % 251) + "." + ConvToStr((i * 7) % 253) + "." + ConvToStr((i * 13) % 254 + 1);
+		std::string host;
+		switch (i % 4)
+		{
+			case 0:
+				host = ip;
+				break;
+			case 1:
+				host = "cpe-" + ConvToStr(i % 251) + "-" + ConvToStr((i * 7) % 253) + "." + isps[i % 5];
+				break;
+			case 2:
+				host = "Host-" + ConvToStr(i * 2654435761U % 100000) + "." + isps[(i / 3) % 5];
+				break;
+			default:
+				host = "2001:db8:" + ConvToStr(i % 97) + "::" + ConvToStr(i % 89);
+				break;
+		}
+		hosts.push_back("Nick" + ConvToStr(i) + "!" + idents[i % 6] + "@" + host);
+		ips.push_back(ip);
+	}
+
+	std::vector<std::string> bans, ranges;
+	for (unsigned int i = 0; i < 50; i++)
+	{
+		bans.push_back(std::string("*!*@*.") + isps[i % 5]);
+		bans.push_back("*!" + std::string(idents[i % 6]) + "@*");
+		bans.push_back("Nick" + ConvToStr(i * 37) + "*!*@*");
+		bans.push_back("*!*@cpe-" + ConvToStr(i) + "-*.*");
+		bans.push_back("*!*@Host-?" + ConvToStr(i) + "*");
+		bans.push_back("*!*@10." + ConvToStr(i) + ".*");
+		ranges.push_back("10." + ConvToStr(i) + ".0.0/16");
+		ranges.push_back("*@" + ConvToStr(10 + i) + ".0.0.0/8");
+		ranges.push_back("1" + ConvToStr(i) + ".*.*.1");
+	}
+
+	bool passed = WildBenchmark("nick!user@host vs 300 bans", hosts, bans, false);
+	passed = WildBenchmark("ip vs 150 ranges", ips, ranges, true) && passed;
+	return passed;
+}
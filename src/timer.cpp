@@ -23,6 +23,7 @@
 /* $Core */
 
 #include "inspircd.h"
+#include <typeinfo>
 #include "timer.h"
 
 TimerManager::TimerManager()
@@ -45,7 +46,10 @@ void TimerManager::TickTimers(time_t TIME)
 		// Probable fix: move vector manipulation to *before* we modify the vector.
 		Timers.erase(i);
 
-		t->Tick(TIME);
+		{
+			TraceTimer trace(LoopTimings::TRACE_TIMER, typeid(*t).name());
+			t->Tick(TIME);
+		}
 		if (t->GetRepeat())
 		{
 			t->SetTimer(TIME + t->GetSecs());
@@ -25,7 +25,7 @@
 #include "bancache.h"
 
 UserManager::UserManager()
-	: unregistered_count(0), local_count(0)
+	: netsplit_batches(0), unregistered_count(0), local_count(0)
 {
 }
 
@@ -169,25 +169,87 @@ void UserManager::AddUser(int socket, ListenSocket* via, irc::sockets::sockaddrs
 	}
 }
 
-void UserManager::QuitUser(User *user, const std::string &quitreason, const char* operreason)
-{
-	if (user->quitting)
+namespace {
+	/** The QUITs of several users. Instead of being written as each user's neighbours
+	 * are found, every recipient's QUITs are gathered into one block, which Send()
+	 * writes once. During a netsplit, users with the batch capability get theirs
+	 * tagged with the netsplit batch and wrapped in its BATCH lines.
+	 */
+	class QuitBlocks : public MessageVariants
 	{
-		ServerInstance->Logs->Log("USERS", DEFAULT, "ERROR: Tried to quit quitting user: " + user->nick);
-		return;
-	}
+		struct Block
+		{
+			std::string text;
+			unsigned int count;
+			Block() : count(0) { }
+		};
+
+		const CapMask batchcap;
+		std::map<LocalUser*, Block> blocks;
+
+	 public:
+		QuitBlocks(CapMask cap) : batchcap(cap) { }
+
+		/** Set the QUIT of the next user
+		 * @param line The QUIT without a reason
+		 * @param reason The reason shown to normal users
+		 * @param oper_reason The reason shown to opers
+		 * @param ref The batch reference, if in a batch
+		 */
+		void SetQuit(const std::string& line, const std::string& reason, const std::string& oper_reason, const std::string& ref)
+		{
+			lines.clear();
+			lines.push_back((line + reason).substr(0, MAXBUF - 2));
+			lines.push_back((line + oper_reason).substr(0, MAXBUF - 2));
+			if (batchcap)
+			{
+				lines.push_back(("@batch=" + ref + " " + line + reason).substr(0, MAXBUF - 2));
+				lines.push_back(("@batch=" + ref + " " + line + oper_reason).substr(0, MAXBUF - 2));
+			}
+		}
 
-	if (IS_SERVER(user))
-	{
-		ServerInstance->Logs->Log("USERS", DEFAULT, "ERROR: Tried to quit server user: " + user->nick);
-		return;
-	}
+		int Select(LocalUser* user)
+		{
+			int variant = IS_OPER(user) ? 1 : 0;
+			if (user->caps & batchcap)
+				variant += 2;
+			Block& block = blocks[user];
+			block.text.append(lines[variant]).append("\r\n");
+			block.count++;
+			return -1;
+		}
 
-	user->quitting = true;
+		/** Write every recipient their block
+		 * @param ref The batch reference, if in a batch
+		 * @param servers The servers which split, if in a batch
+		 */
+		void Send(const std::string& ref, const std::string& servers)
+		{
+			for (std::map<LocalUser*, Block>::iterator i = blocks.begin(); i != blocks.end(); ++i)
+			{
+				LocalUser* user = i->first;
+				Block& block = i->second;
+				if (user->quitting)
+					continue;
+				if (user->caps & batchcap)
+				{
+					block.text.insert(0, "BATCH +" + ref + " netsplit " + servers + "\r\n");
+					block.text.append("BATCH -" + ref + "\r\n");
+					block.count += 2;
+				}
+				user->WriteBlock(block.text, block.count);
+			}
+		}
+	};
+}
 
-	ServerInstance->Logs->Log("USERS", DEBUG, "QuitUser: %s=%s '%s'", user->uuid.c_str(), user->nick.c_str(), quitreason.c_str());
-	user->Write("ERROR :Closing link: (%s@%s) [%s]", user->ident.c_str(), user->host.c_str(), *operreason ? operreason : quitreason.c_str());
+void UserManager::QuitUser(User *user, const std::string &quitreason, const char* operreason)
+{
+	QuitUsers(std::vector<User*>(1, user), quitreason, operreason);
+}
 
+void UserManager::QuitUsers(const std::vector<User*>& users, const std::string &quitreason, const char* operreason, const std::string& netsplit)
+{
 	std::string reason;
 	std::string oper_reason;
 	reason.assign(quitreason, 0, ServerInstance->Config->Limits.MaxQuit);
@@ -196,58 +258,138 @@ void UserManager::QuitUser(User *user, const std::string &quitreason, const char
 	else
 		oper_reason = quitreason;
 
-	ServerInstance->GlobalCulls.AddItem(user);
-
-	if (user->registered == REG_ALL)
+	std::vector<User*> gone;
+	gone.reserve(users.size());
+	for (std::vector<User*>::const_iterator i = users.begin(); i != users.end(); ++i)
 	{
-		FOREACH_MOD(I_OnUserQuit,OnUserQuit(user, reason, oper_reason));
-		user->WriteCommonQuit(reason, oper_reason);
+		User* user = *i;
+		if (user->quitting)
+		{
+			ServerInstance->Logs->Log("USERS", DEFAULT, "ERROR: Tried to quit quitting user: " + user->nick);
+			continue;
+		}
+
+		if (IS_SERVER(user))
+		{
+			ServerInstance->Logs->Log("USERS", DEFAULT, "ERROR: Tried to quit server user: " + user->nick);
+			continue;
+		}
+
+		user->quitting = true;
+		gone.push_back(user);
+
+		for (UCListIter c = user->chans.begin(); c != user->chans.end(); c++)
+			(*c)->names.Update(user);
+
+		ServerInstance->Logs->Log("USERS", DEBUG, "QuitUser: %s=%s '%s'", user->uuid.c_str(), user->nick.c_str(), quitreason.c_str());
+		user->Write("ERROR :Closing link: (%s@%s) [%s]", user->ident.c_str(), user->host.c_str(), *operreason ? operreason : quitreason.c_str());
+
+		ServerInstance->GlobalCulls.AddItem(user);
+
+		if (user->registered != REG_ALL)
+			if (ServerInstance->Users->unregistered_count)
+				ServerInstance->Users->unregistered_count--;
 	}
 
-	if (user->registered != REG_ALL)
-		if (ServerInstance->Users->unregistered_count)
-			ServerInstance->Users->unregistered_count--;
+	/* Modules hear about every user before anyone is sent a QUIT */
+	for (std::vector<User*>::iterator i = gone.begin(); i != gone.end(); ++i)
+	{
+		User* user = *i;
+		if (user->registered == REG_ALL)
+			FOREACH_MOD(I_OnUserQuit,OnUserQuit(user, reason, oper_reason));
+	}
 
-	if (IS_LOCAL(user))
+	CapMask batchcap = netsplit.empty() ? 0 : Caps.Find("batch");
+	if (gone.size() == 1 && !batchcap)
 	{
-		LocalUser* lu = IS_LOCAL(user);
-		FOREACH_MOD(I_OnUserDisconnect,OnUserDisconnect(lu));
-		lu->eh.Close();
+		/* Everyone sees one QUIT, so there is nothing to gather */
+		gone.front()->WriteCommonQuit(reason, oper_reason);
 	}
+	else if (!gone.empty())
+	{
+		std::string ref;
+		if (batchcap)
+			ref = "netsplit" + ConvToStr(++netsplit_batches);
 
-	/*
-	 * this must come before the ServerInstance->SNO->WriteToSnoMaskso that it doesnt try to fill their buffer with anything
-	 * if they were an oper with +s +qQ.
-	 */
-	if (user->registered == REG_ALL)
+		QuitBlocks blocks(batchcap);
+		for (std::vector<User*>::iterator i = gone.begin(); i != gone.end(); ++i)
+		{
+			User* user = *i;
+			if (user->registered != REG_ALL)
+				continue;
+
+			blocks.SetQuit(":" + user->GetFullHost() + " QUIT :", reason, oper_reason, ref);
+			user->WriteCommonVariants(blocks, false);
+		}
+		blocks.Send(ref, netsplit);
+	}
+
+	for (std::vector<User*>::iterator i = gone.begin(); i != gone.end(); ++i)
 	{
+		User* user = *i;
 		if (IS_LOCAL(user))
 		{
-			if (!user->quietquit)
+			LocalUser* lu = IS_LOCAL(user);
+			FOREACH_MOD(I_OnUserDisconnect,OnUserDisconnect(lu));
+			lu->eh.Close();
+		}
+
+		/*
+		 * this must come before the ServerInstance->SNO->WriteToSnoMaskso that it doesnt try to fill their buffer with anything
+		 * if they were an oper with +s +qQ.
+		 */
+		if (user->registered == REG_ALL)
+		{
+			if (IS_LOCAL(user))
 			{
-				ServerInstance->SNO->WriteToSnoMask('q',"Client exiting: %s (%s) [%s]",
-					user->GetFullRealHost().c_str(), user->GetIPString(), oper_reason.c_str());
+				if (!user->quietquit)
+				{
+					ServerInstance->SNO->WriteToSnoMask('q',"Client exiting: %s (%s) [%s]",
+						user->GetFullRealHost().c_str(), user->GetIPString(), oper_reason.c_str());
+				}
 			}
+			else
+			{
+				if ((!ServerInstance->SilentULine(user->server)) && (!user->quietquit))
+				{
+					ServerInstance->SNO->WriteToSnoMask('Q',"Client exiting on server %s: %s (%s) [%s]",
+						user->server.c_str(), user->GetFullRealHost().c_str(), user->GetIPString(), oper_reason.c_str());
+				}
+			}
+			user->AddToWhoWas();
 		}
+
+		user_hash::iterator iter = this->clientlist->find(user->nick);
+
+		if (iter != this->clientlist->end())
+			this->clientlist->erase(iter);
 		else
+			ServerInstance->Logs->Log("USERS", DEFAULT, "ERROR: Nick not found in clientlist, cannot remove: " + user->nick);
+
+		ServerInstance->Users->uuidlist->erase(user->uuid);
+		this->index.Remove(user);
+
+		/* Leave the channels and stop counting the user now rather than when culled, which
+		 * may be several main loop iterations later; until then, channels left empty would
+		 * linger and the user would still count towards the clone and softlimit checks.
+		 */
+		user->PurgeEmptyChannels();
+
+		if (user->client_sa.sa.sa_family != AF_UNSPEC)
+			RemoveCloneCounts(user);
+
+		LocalUser* lu = IS_LOCAL(user);
+		if (lu)
 		{
-			if ((!ServerInstance->SilentULine(user->server)) && (!user->quietquit))
+			lu->ClearInvites();
+			if (lu->localuseriter != local_users.end())
 			{
-				ServerInstance->SNO->WriteToSnoMask('Q',"Client exiting on server %s: %s (%s) [%s]",
-					user->server.c_str(), user->GetFullRealHost().c_str(), user->GetIPString(), oper_reason.c_str());
+				local_count--;
+				local_users.erase(lu->localuseriter);
+				lu->localuseriter = local_users.end();
 			}
 		}
-		user->AddToWhoWas();
 	}
-
-	user_hash::iterator iter = this->clientlist->find(user->nick);
-
-	if (iter != this->clientlist->end())
-		this->clientlist->erase(iter);
-	else
-		ServerInstance->Logs->Log("USERS", DEFAULT, "ERROR: Nick not found in clientlist, cannot remove: " + user->nick);
-
-	ServerInstance->Users->uuidlist->erase(user->uuid);
 }
 
 
@@ -396,3 +538,178 @@ int UserManager::ModeCount(const char mode)
 	}
 	return c;
 }
+
+static std::string IndexKey(const std::string& str, bool reverse)
+{
+	std::string key(str);
+	for (std::string::iterator i = key.begin(); i != key.end(); ++i)
+		*i = ascii_case_insensitive_map[(unsigned char)*i];
+	if (reverse)
+		std::reverse(key.begin(), key.end());
+	return key;
+}
+
+void UserIndex::Erase(KeyMap& map, const std::string& key, User* user)
+{
+	std::pair<KeyMap::iterator, KeyMap::iterator> range = map.equal_range(key);
+	for (KeyMap::iterator i = range.first; i != range.second; ++i)
+	{
+		if (i->second == user)
+		{
+			map.erase(i);
+			return;
+		}
+	}
+}
+
+void UserIndex::FindPrefix(const KeyMap& map, const std::string& prefix, std::vector<User*>& out)
+{
+	for (KeyMap::const_iterator i = map.lower_bound(prefix); i != map.end() && !i->first.compare(0, prefix.length(), prefix); ++i)
+		out.push_back(i->second);
+}
+
+void UserIndex::FindExact(const KeyMap& map, const std::string& key, std::vector<User*>& out)
+{
+	std::pair<KeyMap::const_iterator, KeyMap::const_iterator> range = map.equal_range(key);
+	for (KeyMap::const_iterator i = range.first; i != range.second; ++i)
+		out.push_back(i->second);
+}
+
+void UserIndex::Add(User* user)
+{
+	Entry& entry = entries[user];
+	entry.host = user->host;
+	entry.dhost = user->dhost;
+	entry.server = user->server;
+
+	hosts.insert(std::make_pair(IndexKey(entry.host, false), user));
+	rhosts.insert(std::make_pair(IndexKey(entry.host, true), user));
+	dhosts.insert(std::make_pair(IndexKey(entry.dhost, false), user));
+	rdhosts.insert(std::make_pair(IndexKey(entry.dhost, true), user));
+	servers[entry.server].insert(user);
+}
+
+void UserIndex::Remove(User* user)
+{
+	std::map<User*, Entry>::iterator it = entries.find(user);
+	if (it == entries.end())
+		return;
+
+	const Entry& entry = it->second;
+	Erase(hosts, IndexKey(entry.host, false), user);
+	Erase(rhosts, IndexKey(entry.host, true), user);
+	Erase(dhosts, IndexKey(entry.dhost, false), user);
+	Erase(rdhosts, IndexKey(entry.dhost, true), user);
+
+	std::map<std::string, std::set<User*> >::iterator server = servers.find(entry.server);
+	if (server != servers.end())
+	{
+		server->second.erase(user);
+		if (server->second.empty())
+			servers.erase(server);
+	}
+	entries.erase(it);
+}
+
+void UserIndex::Update(User* user)
+{
+	std::map<User*, Entry>::const_iterator it = entries.find(user);
+	if (it == entries.end())
+		return;
+
+	const Entry& entry = it->second;
+	if ((entry.host != user->host) || (entry.dhost != user->dhost) || (entry.server != user->server))
+	{
+		Remove(user);
+		Add(user);
+	}
+}
+
+bool UserIndex::Search(const std::string& mask, bool realhost, bool matchservers, std::vector<User*>& out) const
+{
+	std::string::size_type first = mask.find_first_of("*?");
+	if (first == std::string::npos)
+	{
+		/* No wildcards: at most one nick, plus exact hosts */
+		User* u = ServerInstance->FindNickOnly(mask);
+		if (u)
+			out.push_back(u);
+		FindExact(dhosts, IndexKey(mask, false), out);
+		if (realhost)
+			FindExact(hosts, IndexKey(mask, false), out);
+	}
+	else
+	{
+		/* A nick cannot contain '.', so a mask with one can only match a host or
+		 * server. Search whichever literal end of the mask is longer.
+		 */
+		if (mask.find('.') == std::string::npos)
+			return false;
+
+		std::string prefix = mask.substr(0, first);
+		std::string suffix = mask.substr(mask.find_last_of("*?") + 1);
+		if (prefix.empty() && suffix.empty())
+			return false;
+
+		if (suffix.length() >= prefix.length())
+		{
+			FindPrefix(rdhosts, IndexKey(suffix, true), out);
+			if (realhost)
+				FindPrefix(rhosts, IndexKey(suffix, true), out);
+		}
+		else
+		{
+			FindPrefix(dhosts, IndexKey(prefix, false), out);
+			if (realhost)
+				FindPrefix(hosts, IndexKey(prefix, false), out);
+		}
+	}
+
+	if (matchservers)
+	{
+		for (std::map<std::string, std::set<User*> >::const_iterator i = servers.begin(); i != servers.end(); ++i)
+		{
+			if (InspIRCd::Match(i->first, mask))
+				out.insert(out.end(), i->second.begin(), i->second.end());
+		}
+	}
+
+	std::sort(out.begin(), out.end());
+	out.erase(std::unique(out.begin(), out.end()), out.end());
+	return true;
+}
+
+CapMask CapabilityBits::Register(const std::string& name)
+{
+	for (CapMask bit = 1; bit; bit <<= 1)
+	{
+		if (!(used & bit))
+		{
+			used |= bit;
+			names[name] = bit;
+			return bit;
+		}
+	}
+	throw ModuleException("No capability bits are free for " + name);
+}
+
+void CapabilityBits::Unregister(CapMask bit)
+{
+	used &= ~bit;
+	for (std::map<std::string, CapMask>::iterator i = names.begin(); i != names.end(); ++i)
+	{
+		if (i->second == bit)
+		{
+			names.erase(i);
+			break;
+		}
+	}
+	for (LocalUserList::iterator i = ServerInstance->Users->local_users.begin(); i != ServerInstance->Users->local_users.end(); ++i)
+		(*i)->caps &= ~bit;
+}
+
+CapMask CapabilityBits::Find(const std::string& name) const
+{
+	std::map<std::string, CapMask>::const_iterator i = names.find(name);
+	return (i == names.end() ? 0 : i->second);
+}
@@ -54,13 +54,14 @@ void FloodQuitUserHandler::Call(User* current)
 void InspIRCd::DoBackgroundUserStuff()
 {
 	/*
-	 * loop over all local users..
+	 * loop over all local users.. Commands run by OnDataReady and the hooks run by
+	 * FullConnect may quit any of them, which takes them out of local_users, so walk
+	 * a copy; quit users are not deleted until the cull list is applied.
 	 */
-	LocalUserList::reverse_iterator count2 = this->Users->local_users.rbegin();
-	while (count2 != this->Users->local_users.rend())
+	std::vector<LocalUser*> users(this->Users->local_users.begin(), this->Users->local_users.end());
+	for (std::vector<LocalUser*>::iterator count2 = users.begin(); count2 != users.end(); ++count2)
 	{
 		LocalUser *curr = *count2;
-		count2++;
 
 		if (curr->quitting)
 			continue;
@@ -220,7 +220,7 @@ User::User(const std::string &uid, const std::string& sid, int type)
 LocalUser::LocalUser(int myfd, irc::sockets::sockaddrs* client, irc::sockets::sockaddrs* servaddr)
 	: User(ServerInstance->GetUID(), ServerInstance->Config->ServerName, USERTYPE_LOCAL), eh(this),
 	localuseriter(ServerInstance->Users->local_users.end()),
-	bytes_in(0), bytes_out(0), cmds_in(0), cmds_out(0), nping(0), CommandFloodPenalty(0),
+	bytes_in(0), bytes_out(0), cmds_in(0), cmds_out(0), caps(0), nping(0), CommandFloodPenalty(0),
 	already_sent(0)
 {
 	ident = "unknown";
@@ -445,6 +445,15 @@ bool LocalUser::HasPrivPermission(const std::string &privstr, bool noisy)
 	return false;
 }
 
+void UserIOHandler::DoWrite()
+{
+	bool pending = getSendQSize();
+	StreamSocket::DoWrite();
+	CountSendQ();
+	if (pending && !getSendQSize() && !user->quitting)
+		FOREACH_MOD(I_OnBufferFlushed, OnBufferFlushed(user));
+}
+
 void UserIOHandler::OnDataReady()
 {
 	if (user->quitting)
@@ -495,6 +504,7 @@ eol_found:
 		ServerInstance->stats->statsRecv += qpos;
 		user->bytes_in += qpos;
 		user->cmds_in++;
+		user->MyClass->bytes_in += qpos;
 
 		ServerInstance->Parser->ProcessBuffer(line, user);
 		if (user->quitting)
@@ -512,6 +522,7 @@ void UserIOHandler::AddWriteBuf(const std::string &data)
 		!user->HasPrivPermission("users/flood/increased-buffers"))
 	{
 		user->quitting_sendq = true;
+		ServerInstance->stats->statsSendQExceeded++;
 		ServerInstance->GlobalCulls.AddSQItem(user);
 		return;
 	}
@@ -520,6 +531,21 @@ void UserIOHandler::AddWriteBuf(const std::string &data)
 	// e.g. their ERROR message that says 'closing link'
 
 	WriteData(data);
+	CountSendQ();
+}
+
+void UserIOHandler::CountSendQ()
+{
+	ServerInstance->stats->statsSendQ += getSendQSize() - counted_sendq;
+	counted_sendq = getSendQSize();
+}
+
+CullResult UserIOHandler::cull()
+{
+	CullResult rv = StreamSocket::cull();
+	ServerInstance->stats->statsSendQ -= counted_sendq;
+	counted_sendq = 0;
+	return rv;
 }
 
 void UserIOHandler::OnError(BufferedSocketError)
@@ -531,28 +557,12 @@ CullResult User::cull()
 {
 	if (!quitting)
 		ServerInstance->Users->QuitUser(this, "Culled without QuitUser");
-	PurgeEmptyChannels();
-
-	if (client_sa.sa.sa_family != AF_UNSPEC)
-		ServerInstance->Users->RemoveCloneCounts(this);
 
 	return Extensible::cull();
 }
 
 CullResult LocalUser::cull()
 {
-	// The iterator is initialized to local_users.end() in the constructor. It is
-	// overwritten in UserManager::AddUser() with the real iterator so this check
-	// is only a precaution currently.
-	if (localuseriter != ServerInstance->Users->local_users.end())
-	{
-		ServerInstance->Users->local_count--;
-		ServerInstance->Users->local_users.erase(localuseriter);
-	}
-	else
-		ServerInstance->Logs->Log("USERS", DEFAULT, "ERROR: LocalUserIter does not point to a valid entry for " + this->nick);
-
-	ClearInvites();
 	eh.cull();
 	return User::cull();
 }
@@ -824,6 +834,10 @@ void LocalUser::FullConnect()
 
 	this->registered = REG_ALL;
 
+	/* A module may have quit the user above, in which case they have already been taken out of the index */
+	if (!quitting)
+		ServerInstance->Users->index.Add(this);
+
 	FOREACH_MOD(I_OnPostConnect,OnPostConnect(this));
 
 	ServerInstance->SNO->WriteToSnoMask('c',"Client connecting on port %d (class %s): %s (%s) [%s]",
@@ -841,6 +855,11 @@ void User::InvalidateCache()
 	cached_hostip.clear();
 	cached_makehost.clear();
 	cached_fullrealhost.clear();
+
+	ServerInstance->Users->index.Update(this);
+
+	for (UCListIter i = chans.begin(); i != chans.end(); i++)
+		(*i)->names.Update(this);
 }
 
 bool User::ChangeNick(const std::string& newnick, bool force)
@@ -1067,6 +1086,24 @@ void LocalUser::Write(const std::string& text)
 	ServerInstance->stats->statsSent += text.length() + 2;
 	this->bytes_out += text.length() + 2;
 	this->cmds_out++;
+	if (MyClass)
+		MyClass->bytes_out += text.length() + 2;
+}
+
+void LocalUser::WriteBlock(const std::string& block, unsigned int count)
+{
+	if (!ServerInstance->SE->BoundsCheckFd(&eh) || block.empty())
+		return;
+
+	ServerInstance->Logs->Log("USEROUTPUT", RAWIO, "C[%s] O (%u lines) %s", uuid.c_str(), count, block.c_str());
+
+	eh.AddWriteBuf(block);
+
+	ServerInstance->stats->statsSent += block.length();
+	this->bytes_out += block.length();
+	this->cmds_out += count;
+	if (MyClass)
+		MyClass->bytes_out += block.length();
 }
 
 /** Write()
@@ -1208,64 +1245,94 @@ void User::WriteCommonExcept(const char* text, ...)
 	this->WriteCommonRaw(std::string(textbuffer), false);
 }
 
-void User::WriteCommonRaw(const std::string &line, bool include_self)
-{
-	if (this->registered != REG_ALL || quitting)
-		return;
-
-	LocalUser::already_sent_id++;
-
-	UserChanList include_c(chans);
-	std::map<User*,bool> exceptions;
-
-	exceptions[this] = include_self;
+namespace {
+	/** A message which is the same for everyone */
+	class SingleMessage : public MessageVariants
+	{
+	 public:
+		SingleMessage(const std::string& line)
+		{
+			lines.push_back(line);
+		}
 
-	FOREACH_MOD(I_OnBuildNeighborList,OnBuildNeighborList(this, include_c, exceptions));
+		int Select(LocalUser*)
+		{
+			return 0;
+		}
+	};
 
-	for (std::map<User*,bool>::iterator i = exceptions.begin(); i != exceptions.end(); ++i)
+	/** A quit message with a different reason shown to opers */
+	class QuitMessage : public MessageVariants
 	{
-		LocalUser* u = IS_LOCAL(i->first);
-		if (u && !u->quitting)
+	 public:
+		int Select(LocalUser* user)
 		{
-			u->already_sent = LocalUser::already_sent_id;
-			if (i->second)
-				u->Write(line);
+			return IS_OPER(user) ? 1 : 0;
 		}
-	}
-	for (UCListIter v = include_c.begin(); v != include_c.end(); ++v)
+	};
+
+	/** Send a message once to every local user sharing one of the given channels
+	 * who has not already been marked with the given id
+	 */
+	void SendToMembers(const UserChanList& include_c, already_sent_t uniq_id, MessageVariants& msg)
 	{
-		Channel* c = *v;
-		const UserMembList* ulist = c->GetUsers();
-		for (UserMembList::const_iterator i = ulist->begin(); i != ulist->end(); i++)
+		for (UserChanList::const_iterator v = include_c.begin(); v != include_c.end(); ++v)
 		{
-			LocalUser* u = IS_LOCAL(i->first);
-			if (u && !u->quitting && u->already_sent != LocalUser::already_sent_id)
+			const UserMembList* ulist = (*v)->GetUsers();
+			for (UserMembList::const_iterator i = ulist->begin(); i != ulist->end(); i++)
 			{
-				u->already_sent = LocalUser::already_sent_id;
-				u->Write(line);
+				LocalUser* u = IS_LOCAL(i->first);
+				if (u && !u->quitting && (u->already_sent != uniq_id))
+				{
+					u->already_sent = uniq_id;
+					msg.SendTo(u);
+				}
 			}
 		}
 	}
 }
 
-void User::WriteCommonQuit(const std::string &normal_text, const std::string &oper_text)
+void MessageVariants::SendTo(LocalUser* user)
 {
-	char tb1[MAXBUF];
-	char tb2[MAXBUF];
+	int variant = Select(user);
+	if (variant >= 0)
+		user->Write(lines[variant]);
+}
 
-	if (this->registered != REG_ALL)
+void User::WriteCommonRaw(const std::string &line, bool include_self)
+{
+	if (this->registered != REG_ALL || quitting)
 		return;
 
+	SingleMessage msg(line);
+	WriteCommonVariants(msg, include_self);
+}
+
+void User::WriteCommonVariants(MessageVariants& msg, bool include_self)
+{
 	already_sent_t uniq_id = ++LocalUser::already_sent_id;
 
-	snprintf(tb1,MAXBUF,":%s QUIT :%s",this->GetFullHost().c_str(),normal_text.c_str());
-	snprintf(tb2,MAXBUF,":%s QUIT :%s",this->GetFullHost().c_str(),oper_text.c_str());
-	std::string out1 = tb1;
-	std::string out2 = tb2;
+	if (ServerInstance->Modules->EventHandlers[I_OnBuildNeighborList].empty())
+	{
+		/* Nothing can change who our neighbours are, so walk our own channels
+		 * instead of copying them and building an exception map
+		 */
+		LocalUser* self = IS_LOCAL(this);
+		if (self && !self->quitting)
+		{
+			self->already_sent = uniq_id;
+			if (include_self)
+				msg.SendTo(self);
+		}
+		SendToMembers(chans, uniq_id, msg);
+		return;
+	}
 
 	UserChanList include_c(chans);
 	std::map<User*,bool> exceptions;
 
+	exceptions[this] = include_self;
+
 	FOREACH_MOD(I_OnBuildNeighborList,OnBuildNeighborList(this, include_c, exceptions));
 
 	for (std::map<User*,bool>::iterator i = exceptions.begin(); i != exceptions.end(); ++i)
@@ -1275,22 +1342,26 @@ void User::WriteCommonQuit(const std::string &normal_text, const std::string &op
 		{
 			u->already_sent = uniq_id;
 			if (i->second)
-				u->Write(IS_OPER(u) ? out2 : out1);
-		}
-	}
-	for (UCListIter v = include_c.begin(); v != include_c.end(); ++v)
-	{
-		const UserMembList* ulist = (*v)->GetUsers();
-		for (UserMembList::const_iterator i = ulist->begin(); i != ulist->end(); i++)
-		{
-			LocalUser* u = IS_LOCAL(i->first);
-			if (u && !u->quitting && (u->already_sent != uniq_id))
-			{
-				u->already_sent = uniq_id;
-				u->Write(IS_OPER(u) ? out2 : out1);
-			}
+				msg.SendTo(u);
 		}
 	}
+	SendToMembers(include_c, uniq_id, msg);
+}
+
+void User::WriteCommonQuit(const std::string &normal_text, const std::string &oper_text)
+{
+	char tb[MAXBUF];
+
+	if (this->registered != REG_ALL)
+		return;
+
+	QuitMessage msg;
+	snprintf(tb,MAXBUF,":%s QUIT :%s",this->GetFullHost().c_str(),normal_text.c_str());
+	msg.lines.push_back(tb);
+	snprintf(tb,MAXBUF,":%s QUIT :%s",this->GetFullHost().c_str(),oper_text.c_str());
+	msg.lines.push_back(tb);
+
+	WriteCommonVariants(msg, false);
 }
 
 void LocalUser::SendText(const std::string& line)
@@ -1610,9 +1681,18 @@ void LocalUser::SetClass(const std::string &explicit_name)
 	}
 	else
 	{
-		for (ClassVector::iterator i = ServerInstance->Config->Classes.begin(); i != ServerInstance->Config->Classes.end(); i++)
+		/* Only the classes whose host and port can match this user are checked, in config order.
+		 * Modules may force any class though, so while one is listening every class is offered
+		 * to it, and those the index ruled out are skipped afterwards.
+		 */
+		const std::vector<size_t> candidates = ServerInstance->Config->ClassIndex.Find(client_sa, GetIPString(), GetServerPort(), host);
+		const bool offerall = !ServerInstance->Modules->EventHandlers[I_OnSetConnectClass].empty();
+		const size_t count = offerall ? ServerInstance->Config->Classes.size() : candidates.size();
+		std::vector<size_t>::const_iterator candidate = candidates.begin();
+		for (size_t n = 0; n < count; n++)
 		{
-			ConnectClass* c = *i;
+			size_t pos = offerall ? n : candidates[n];
+			ConnectClass* c = ServerInstance->Config->Classes[pos];
 			ServerInstance->Logs->Log("CONNECTCLASS", DEBUG, "Checking %s", c->GetName().c_str());
 
 			ModResult MOD_RESULT;
@@ -1626,21 +1706,21 @@ void LocalUser::SetClass(const std::string &explicit_name)
 				break;
 			}
 
-			if (c->type == CC_NAMED)
-				continue;
+			if (offerall)
+			{
+				while (candidate != candidates.end() && *candidate < pos)
+					candidate++;
+				if (candidate == candidates.end() || *candidate != pos)
+				{
+					ServerInstance->Logs->Log("CONNECTCLASS", DEBUG, "No host or port match, or named class");
+					continue;
+				}
+			}
 
 			bool regdone = (registered != REG_NONE);
 			if (c->config->getBool("registered", regdone) != regdone)
 				continue;
 
-			/* check if host matches.. */
-			if (!InspIRCd::MatchCIDR(this->GetIPString(), c->GetHost(), NULL) &&
-			    !InspIRCd::MatchCIDR(this->host, c->GetHost(), NULL))
-			{
-				ServerInstance->Logs->Log("CONNECTCLASS", DEBUG, "No host match (for %s)", c->GetHost().c_str());
-				continue;
-			}
-
 			/*
 			 * deny change if change will take class over the limit check it HERE, not after we found a matching class,
 			 * because we should attempt to find another class if this one doesn't match us. -- w00t
@@ -1651,17 +1731,6 @@ void LocalUser::SetClass(const std::string &explicit_name)
 				continue;
 			}
 
-			/* if it requires a port ... */
-			int port = c->config->getInt("port");
-			if (port)
-			{
-				ServerInstance->Logs->Log("CONNECTCLASS", DEBUG, "Requires port (%d)", port);
-
-				/* and our port doesn't match, fail. */
-				if (this->GetServerPort() != port)
-					continue;
-			}
-
 			if (regdone && !c->config->getString("password").empty())
 			{
 				if (ServerInstance->PassCompare(this, c->config->getString("password"), password, c->config->getString("hash")))
@@ -1709,6 +1778,7 @@ void User::PurgeEmptyChannels()
 		Channel* c = *f;
 		c->DelUser(this);
 	}
+	this->chans.clear();
 
 	this->UnOper();
 }
@@ -1730,7 +1800,8 @@ const std::string& FakeUser::GetFullRealHost()
 ConnectClass::ConnectClass(ConfigTag* tag, char t, const std::string& mask)
 	: config(tag), type(t), fakelag(true), name("unnamed"), registration_timeout(0), host(mask),
 	pingtime(0), softsendqmax(0), hardsendqmax(0), recvqmax(0),
-	penaltythreshold(0), commandrate(0), maxlocal(0), maxglobal(0), maxconnwarn(true), maxchans(0), limit(0)
+	penaltythreshold(0), commandrate(0), maxlocal(0), maxglobal(0), maxconnwarn(true), maxchans(0), limit(0),
+	bytes_in(0), bytes_out(0)
 {
 }
 
@@ -1740,7 +1811,7 @@ ConnectClass::ConnectClass(ConfigTag* tag, char t, const std::string& mask, cons
 	softsendqmax(parent.softsendqmax), hardsendqmax(parent.hardsendqmax), recvqmax(parent.recvqmax),
 	penaltythreshold(parent.penaltythreshold), commandrate(parent.commandrate),
 	maxlocal(parent.maxlocal), maxglobal(parent.maxglobal), maxconnwarn(parent.maxconnwarn), maxchans(parent.maxchans),
-	limit(parent.limit)
+	limit(parent.limit), bytes_in(0), bytes_out(0)
 {
 }
 
@@ -24,6 +24,9 @@
 #include "inspircd.h"
 #include "hashcomp.h"
 #include "inspstring.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 static bool match_internal(const unsigned char *str, const unsigned char *mask, unsigned const char *map)
 {
@@ -117,3 +120,204 @@ CoreExport bool InspIRCd::MatchCIDR(const  char *str, const char *mask, unsigned
 	return InspIRCd::Match(str, mask, map);
 }
 
+/********************************************************************
+ * Compiled masks
+ ********************************************************************/
+
+irc::wildcard_mask::wildcard_mask()
+{
+	compile("");
+}
+
+irc::wildcard_mask::wildcard_mask(const std::string& pattern, const unsigned char* casemap)
+{
+	compile(pattern, casemap);
+}
+
+void irc::wildcard_mask::CompileSegment(segment& seg, const std::string& text)
+{
+	seg.raw = text;
+	seg.folded = text;
+	for (std::string::iterator c = seg.folded.begin(); c != seg.folded.end(); ++c)
+		*c = foldmap[(unsigned char)*c];
+
+	/* Find which characters a search for the segment can look for directly */
+	seg.anchors = 0;
+	seg.anchor = text.find_first_not_of('?');
+	if (seg.anchor == std::string::npos)
+		return;
+
+	unsigned int count = 0;
+	for (unsigned int c = 1; c < 256; c++)
+	{
+		if (foldmap[c] == (unsigned char)seg.folded[seg.anchor])
+		{
+			if (count < 2)
+				seg.anchorchars[count] = c;
+			count++;
+		}
+	}
+	seg.anchors = (count <= 2) ? count : 0;
+}
+
+void irc::wildcard_mask::compile(const std::string& pattern, const unsigned char* casemap)
+{
+	/* Like match_internal, anything after a NUL is ignored */
+	mask.assign(pattern.c_str());
+	map = casemap;
+	foldmap = map ? map : national_case_insensitive_map;
+	middle.clear();
+
+	std::string::size_type first = mask.find('*');
+	stars = (first != std::string::npos);
+	if (!stars)
+	{
+		CompileSegment(prefix, mask);
+		CompileSegment(suffix, "");
+	}
+	else
+	{
+		std::string::size_type last = mask.rfind('*');
+		CompileSegment(prefix, mask.substr(0, first));
+		CompileSegment(suffix, mask.substr(last + 1));
+
+		irc::sepstream stream(mask.substr(first + 1, last - first), '*');
+		std::string text;
+		while (stream.GetToken(text))
+		{
+			if (text.empty())
+				continue;
+			middle.push_back(segment());
+			CompileSegment(middle.back(), text);
+		}
+	}
+
+	/* Anything in the mask after user@ containing a '/' is tried as a range first.
+	 * An empty or wildcard address depends on <bind> settings when parsed, so that
+	 * is left until it is matched.
+	 */
+	at = mask.rfind('@');
+	std::string host = mask.substr(at + 1);
+	std::string::size_type bits = host.rfind('/');
+	hascidr = (bits != std::string::npos);
+	cidrparsed = hascidr && bits && (host[0] != '*');
+	if (cidrparsed)
+		range = irc::sockets::cidr_mask(host);
+}
+
+bool irc::wildcard_mask::MatchSegment(const segment& seg, const char* str) const
+{
+	for (std::string::size_type i = 0; i < seg.raw.length(); i++)
+	{
+		if ((seg.raw[i] != '?') && (foldmap[(unsigned char)str[i]] != (unsigned char)seg.folded[i]))
+			return false;
+	}
+	return true;
+}
+
+/** Find the first of one or two characters between str and end */
+static const char* FindAnchor(const char* str, const char* end, unsigned char a, unsigned char b)
+{
+#ifdef __SSE2__
+	__m128i va = _mm_set1_epi8(a);
+	__m128i vb = _mm_set1_epi8(b);
+	for (; end - str >= 16; str += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)str);
+		int hits = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+		if (hits)
+			return str + __builtin_ctz(hits);
+	}
+#endif
+	for (; str < end; str++)
+		if (((unsigned char)*str == a) || ((unsigned char)*str == b))
+			return str;
+	return NULL;
+}
+
+const char* irc::wildcard_mask::FindSegment(const segment& seg, const char* str, const char* end) const
+{
+	if ((std::string::size_type)(end - str) < seg.raw.length())
+		return NULL;
+
+	const char* last = end - seg.raw.length();
+	if (seg.anchor == std::string::npos)
+		return str;
+
+	/* Look for the first literal character of the segment, then check the rest */
+	const char* pos = str + seg.anchor;
+	const char* stop = last + seg.anchor + 1;
+	while (pos < stop)
+	{
+		if (seg.anchors == 1)
+			pos = (const char*)memchr(pos, seg.anchorchars[0], stop - pos);
+		else if (seg.anchors == 2)
+			pos = FindAnchor(pos, stop, seg.anchorchars[0], seg.anchorchars[1]);
+		else
+		{
+			while ((pos < stop) && (foldmap[(unsigned char)*pos] != (unsigned char)seg.folded[seg.anchor]))
+				pos++;
+			if (pos == stop)
+				pos = NULL;
+		}
+
+		if (!pos)
+			return NULL;
+		if (MatchSegment(seg, pos - seg.anchor))
+			return pos - seg.anchor;
+		pos++;
+	}
+	return NULL;
+}
+
+bool irc::wildcard_mask::Match(const std::string& text) const
+{
+	/* The segments were folded with another map, e.g. m_nationalchars was loaded since */
+	if (foldmap != (map ? map : national_case_insensitive_map))
+		return InspIRCd::Match(text, mask, map);
+
+	const char* str = text.c_str();
+	size_t len = strlen(str);
+	if (!stars)
+		return (len == prefix.raw.length()) && MatchSegment(prefix, str);
+
+	if ((len < prefix.raw.length() + suffix.raw.length()) || (!MatchSegment(prefix, str)) ||
+		(!MatchSegment(suffix, str + len - suffix.raw.length())))
+		return false;
+
+	/* With only fixed length segments between the '*'s, the leftmost match of each is always the best */
+	const char* pos = str + prefix.raw.length();
+	const char* end = str + len - suffix.raw.length();
+	for (std::vector<segment>::const_iterator seg = middle.begin(); seg != middle.end(); ++seg)
+	{
+		pos = FindSegment(*seg, pos, end);
+		if (!pos)
+			return false;
+		pos += seg->raw.length();
+	}
+	return true;
+}
+
+bool irc::wildcard_mask::MatchRange(const std::string& address) const
+{
+	if (!hascidr)
+		return false;
+
+	/* As irc::sockets::MatchCIDR: a user@ on both sides is matched as a glob, otherwise it is dropped */
+	std::string::size_type addrat = address.rfind('@');
+	if ((at != std::string::npos) && (addrat != std::string::npos) &&
+		(!InspIRCd::Match(address.substr(0, addrat), mask.substr(0, at), ascii_case_insensitive_map)))
+		return false;
+
+	if (!cidrparsed)
+		return irc::sockets::MatchCIDR(address.substr(addrat + 1), mask.substr(at + 1), false);
+
+	irc::sockets::sockaddrs addr;
+	irc::sockets::aptosa(address.substr(addrat + 1), 0, addr);
+	return (range == irc::sockets::cidr_mask(addr, range.length));
+}
+
+bool irc::wildcard_mask::MatchCIDR(const std::string& text) const
+{
+	return MatchRange(text) || Match(text);
+}
@@ -226,6 +226,20 @@ std::vector<std::string> XLineManager::GetAllTypes()
 	return items;
 }
 
+unsigned long XLineManager::GetHits(const std::string& type)
+{
+	std::map<std::string, unsigned long>::const_iterator r = removed_hits.find(type);
+	unsigned long total = (r == removed_hits.end() ? 0 : r->second);
+
+	ContainerIter x = lookup_lines.find(type);
+	if (x != lookup_lines.end())
+	{
+		for (LookupIter i = x->second.begin(); i != x->second.end(); ++i)
+			total += i->second->hits;
+	}
+	return total;
+}
+
 IdentHostPair XLineManager::IdentSplit(const std::string &ident_and_host)
 {
 	IdentHostPair n = std::make_pair<std::string,std::string>("*","*");
@@ -316,6 +330,8 @@ bool XLineManager::DelLine(const char* hostmask, const std::string &type, User*
 	if (pptr != pending_lines.end())
 		pending_lines.erase(pptr);
 
+	if (y->second->hits)
+		removed_hits[y->second->type] += y->second->hits;
 	delete y->second;
 	x->second.erase(y);
 
@@ -363,6 +379,7 @@ XLine* XLineManager::MatchesLine(const std::string &type, User* user)
 
 		if (i->second->Matches(user))
 		{
+			i->second->hits++;
 			return i->second;
 		}
 
@@ -398,7 +415,10 @@ XLine* XLineManager::MatchesLine(const std::string &type, const std::string &pat
 				continue;
 			}
 			else
+			{
+				i->second->hits++;
 				return i->second;
+			}
 		}
 
 		i = safei;
@@ -422,6 +442,8 @@ void XLineManager::ExpireLine(ContainerIter container, LookupIter item)
 	if (pptr != pending_lines.end())
 		pending_lines.erase(pptr);
 
+	if (item->second->hits)
+		removed_hits[item->second->type] += item->second->hits;
 	delete item->second;
 	container->second.erase(item);
 }
@@ -430,8 +452,8 @@ void XLineManager::ExpireLine(ContainerIter container, LookupIter item)
 // applies lines, removing clients and changing nicks etc as applicable
 void XLineManager::ApplyLines()
 {
-	LocalUserList::reverse_iterator u2 = ServerInstance->Users->local_users.rbegin();
-	while (u2 != ServerInstance->Users->local_users.rend())
+	LocalUserList::iterator u2 = ServerInstance->Users->local_users.begin();
+	while (u2 != ServerInstance->Users->local_users.end())
 	{
 		User* u = *u2++;
 
@@ -443,7 +465,10 @@ void XLineManager::ApplyLines()
 		{
 			XLine *x = *i;
 			if (x->Matches(u))
+			{
+				x->hits++;
 				x->Apply(u);
+			}
 		}
 	}
 
@@ -557,10 +582,9 @@ bool KLine::Matches(User *u)
 	if (u->exempt)
 		return false;
 
-	if (InspIRCd::Match(u->ident, this->identmask, ascii_case_insensitive_map))
+	if (identpattern.Match(u->ident))
 	{
-		if (InspIRCd::MatchCIDR(u->host, this->hostmask, ascii_case_insensitive_map) ||
-		    InspIRCd::MatchCIDR(u->GetIPString(), this->hostmask, ascii_case_insensitive_map))
+		if (hostpattern.MatchCIDR(u->host) || hostpattern.MatchCIDR(u->GetIPString()))
 		{
 			return true;
 		}
@@ -579,10 +603,9 @@ bool GLine::Matches(User *u)
 	if (u->exempt)
 		return false;
 
-	if (InspIRCd::Match(u->ident, this->identmask, ascii_case_insensitive_map))
+	if (identpattern.Match(u->ident))
 	{
-		if (InspIRCd::MatchCIDR(u->host, this->hostmask, ascii_case_insensitive_map) ||
-		    InspIRCd::MatchCIDR(u->GetIPString(), this->hostmask, ascii_case_insensitive_map))
+		if (hostpattern.MatchCIDR(u->host) || hostpattern.MatchCIDR(u->GetIPString()))
 		{
 			return true;
 		}
@@ -601,10 +624,9 @@ bool ELine::Matches(User *u)
 	if (u->exempt)
 		return false;
 
-	if (InspIRCd::Match(u->ident, this->identmask, ascii_case_insensitive_map))
+	if (identpattern.Match(u->ident))
 	{
-		if (InspIRCd::MatchCIDR(u->host, this->hostmask, ascii_case_insensitive_map) ||
-		    InspIRCd::MatchCIDR(u->GetIPString(), this->hostmask, ascii_case_insensitive_map))
+		if (hostpattern.MatchCIDR(u->host) || hostpattern.MatchCIDR(u->GetIPString()))
 		{
 			return true;
 		}
@@ -618,7 +640,7 @@ bool ZLine::Matches(User *u)
 	if (u->exempt)
 		return false;
 
-	if (InspIRCd::MatchCIDR(u->GetIPString(), this->ipaddr))
+	if (ippattern.MatchCIDR(u->GetIPString()))
 		return true;
 	else
 		return false;
@@ -632,7 +654,7 @@ void ZLine::Apply(User* u)
 
 bool QLine::Matches(User *u)
 {
-	if (InspIRCd::Match(u->nick, this->nick))
+	if (nickpattern.Match(u->nick))
 		return true;
 
 	return false;
@@ -647,7 +669,7 @@ void QLine::Apply(User* u)
 
 bool ZLine::Matches(const std::string &str)
 {
-	if (InspIRCd::MatchCIDR(str, this->ipaddr))
+	if (ippattern.MatchCIDR(str))
 		return true;
 	else
 		return false;
@@ -655,7 +677,7 @@ bool ZLine::Matches(const std::string &str)
 
 bool QLine::Matches(const std::string &str)
 {
-	if (InspIRCd::Match(str, this->nick))
+	if (nickpattern.Match(str))
 		return true;
 
 	return false;
@@ -663,17 +685,17 @@ bool QLine::Matches(const std::string &str)
 
 bool ELine::Matches(const std::string &str)
 {
-	return (InspIRCd::MatchCIDR(str, matchtext));
+	return textpattern.MatchCIDR(str);
 }
 
 bool KLine::Matches(const std::string &str)
 {
-	return (InspIRCd::MatchCIDR(str.c_str(), matchtext));
+	return textpattern.MatchCIDR(str);
 }
 
 bool GLine::Matches(const std::string &str)
 {
-	return (InspIRCd::MatchCIDR(str, matchtext));
+	return textpattern.MatchCIDR(str);
 }
 
 void ELine::OnAdd()